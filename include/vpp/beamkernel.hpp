@@ -0,0 +1,85 @@
+// $Id$
+
+#ifndef VPP_BEAMKERNEL_HPP
+#define VPP_BEAMKERNEL_HPP
+
+//! \file beamkernel.hpp
+//! Beam geometry of many shots per call without per shot virtual calls.
+
+#include <riegl/scanmech.hpp>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace vpp {
+
+//!\brief block beam computation for one scan mechanism
+//!\details scanmech::compute_beam_raw decodes the raw angles and then
+//! calls compute_beam through the vtable, so every shot costs two
+//! indirect calls. The kernel selects a loop for the concrete class once,
+//! from kind(), when it is bound. The loop decodes the raw angles inline,
+//! exactly as the class does, and calls the compute_beam of that class
+//! directly. Kinds without a loop of their own use the virtual functions.
+//!
+//! The mechanism must be fully set up (parameters and precompute()); it
+//! is used as the workspace of the kernel, so its beam_origin,
+//! beam_direction and angle members change with every call.
+class beam_kernel
+{
+public:
+    beam_kernel();
+    explicit beam_kernel(scanlib::scanmech& mech);
+
+    //! select the loop for mech
+    void bind(scanlib::scanmech& mech);
+
+    //! the mechanism has a loop of its own
+    bool direct() const { return direct_; }
+
+    //! compute beams from angles
+    //!\param facet mirror facet of each shot, null for facet 0
+    //!\param line_angle rad
+    //!\param frame_angle rad, null for 0
+    //!\param n number of shots
+    //!\param origin receives n beam origins, 3 values each
+    //!\param direction receives n unit beam directions, 3 values each
+    void compute(
+        const unsigned* facet
+        , const double* line_angle
+        , const double* frame_angle
+        , std::size_t n
+        , double* origin
+        , double* direction
+    ) const;
+
+    //! compute beams from raw angles as found in the laser shot packets
+    //!\param line_angle_raw raw line angle of each shot
+    //!\param frame_angle_raw raw frame angle, null for 0
+    //!\param segment segment of each shot, null for 0
+    //!\param n number of shots
+    //!\param origin receives n beam origins, 3 values each
+    //!\param direction receives n unit beam directions, 3 values each
+    void compute_raw(
+        const uint32_t* line_angle_raw
+        , const uint32_t* frame_angle_raw
+        , const unsigned* segment
+        , std::size_t n
+        , double* origin
+        , double* direction
+    ) const;
+
+    typedef void (*angle_loop)(scanlib::scanmech&, const unsigned*, const double*
+        , const double*, std::size_t, double*, double*);
+    typedef void (*raw_loop)(scanlib::scanmech&, const uint32_t*, const uint32_t*
+        , const unsigned*, std::size_t, double*, double*);
+
+private:
+    scanlib::scanmech* mech;
+    angle_loop angles;
+    raw_loop raw;
+    bool direct_;
+};
+
+} // namespace vpp
+
+#endif // VPP_BEAMKERNEL_HPP
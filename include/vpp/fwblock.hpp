@@ -0,0 +1,176 @@
+// $Id$
+
+#ifndef VPP_FWBLOCK_HPP
+#define VPP_FWBLOCK_HPP
+
+//! \file fwblock.hpp
+//! Bulk reading of RiWaveLib waveform files into caller supplied arrays.
+//!
+//! fwifc_read returns one shot per call with sample pointers valid until
+//! the next call. The functions here read many shots per call into flat,
+//! caller owned arrays (structure of arrays), which map directly onto
+//! NumPy arrays, e.g. via ctypes and numpy.ctypeslib.as_ctypes. The
+//! interface has C linkage and follows the conventions of fwifc.h: all
+//! functions return one of the FWIFC_* codes.
+//!
+//! The sample blocks of shot k are sbl_first[k] .. sbl_first[k+1]-1, the
+//! samples of sample block j are sample[sbl_offset[j] .. sbl_offset[j+1]-1].
+//! Both offset arrays therefore have one entry more than shots or sample
+//! blocks read, and restart at 0 with every call.
+//!
+//! Readers are independent: each keeps its own buffers and error message,
+//! and calls into RiWaveLib, whose error state and buffers are process
+//! global, are serialised internally. Different readers may therefore be
+//! used from different threads without coordination; a single reader
+//! must not be used by two threads at once. Several threads can share
+//! the work on one file by opening a reader each on disjoint record
+//! ranges with vpp_fwblock_open_range.
+
+#include <fwifc.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+//! caller supplied arrays of vpp_fwblock_read
+/*! Any array except those needed to hold a shot may be null, its field is
+    then skipped. Capacities are counted in elements of the per shot, per
+    sample block and per sample arrays, origin and direction hold three
+    values per shot.
+ */
+typedef struct vpp_fwblock_arrays_struct {
+    fwifc_uint32_t    max_shots;
+    fwifc_uint32_t    max_sbls;
+    uint64_t          max_samples;
+
+    fwifc_float64_t   *time_sorg;       /* [max_shots] s */
+    fwifc_float64_t   *time_external;   /* [max_shots] s */
+    fwifc_float64_t   *origin;          /* [max_shots][3] m */
+    fwifc_float64_t   *direction;       /* [max_shots][3] */
+    fwifc_uint16_t    *flags;           /* [max_shots] */
+    fwifc_uint16_t    *facet;           /* [max_shots] */
+    fwifc_uint32_t    *sbl_first;       /* [max_shots+1] */
+
+    fwifc_float64_t   *sbl_time;        /* [max_sbls] time_sosbl in s */
+    fwifc_uint32_t    *sbl_channel;     /* [max_sbls] */
+    uint64_t          *sbl_offset;      /* [max_sbls+1] */
+
+    fwifc_sample_t    *sample;          /* [max_samples] */
+} vpp_fwblock_arrays;
+
+struct vpp_fwblock_t;
+typedef struct vpp_fwblock_t* vpp_fwblock;
+
+//! open a waveform file for bulk reading
+fwifc_int32_t
+vpp_fwblock_open(
+    fwifc_csz path
+    , vpp_fwblock *reader
+);
+
+//! open a reader limited to records [first, first+count)
+/*! Needs the index of the file (FWIFC_ERR_MISSING_INDEX otherwise), see
+    fwifc_reindex. The reader reports FWIFC_END_OF_FILE after the last
+    record of its range.
+ */
+fwifc_int32_t
+vpp_fwblock_open_range(
+    fwifc_csz path
+    , fwifc_uint32_t first
+    , fwifc_uint32_t count
+    , vpp_fwblock *reader
+);
+
+//! close the reader and its file
+fwifc_int32_t
+vpp_fwblock_close(
+    vpp_fwblock reader
+);
+
+//! underlying file
+/*! Direct calls into RiWaveLib are not serialised with other readers. */
+fwifc_int32_t
+vpp_fwblock_file(
+    vpp_fwblock reader
+    , fwifc_file *file
+);
+
+//! file information, see fwifc_get_info
+/*! The strings stay valid until the next call with this reader. */
+fwifc_int32_t
+vpp_fwblock_get_info(
+    vpp_fwblock reader
+    , fwifc_csz       *instrument
+    , fwifc_csz       *serial
+    , fwifc_csz       *epoch
+    , fwifc_float64_t *v_group
+    , fwifc_float64_t *sampling_time
+    , fwifc_uint16_t  *flags
+    , fwifc_uint16_t  *num_facets
+);
+
+//! calibration table, see fwifc_get_calib
+/*! The tables stay valid until the next call with this reader. */
+fwifc_int32_t
+vpp_fwblock_get_calib(
+    vpp_fwblock reader
+    , fwifc_uint16_t          table_kind
+    , fwifc_uint32_t          *count
+    , const fwifc_float64_t*  *abscissa
+    , const fwifc_float64_t*  *ordinate
+);
+
+//! position at a record number, see fwifc_seek
+/*! Record numbers are those of the file. A reader opened on a record
+    range is positioned at its first record for records before the range;
+    for records at or after its end, the next read reports
+    FWIFC_END_OF_FILE.
+ */
+fwifc_int32_t
+vpp_fwblock_seek(
+    vpp_fwblock reader
+    , fwifc_uint32_t record
+);
+
+//! position at a time, see fwifc_seek_time
+/*! Clamped to the record range of the reader as vpp_fwblock_seek. */
+fwifc_int32_t
+vpp_fwblock_seek_time(
+    vpp_fwblock reader
+    , fwifc_float64_t time
+);
+
+//! read up to arrays->max_shots shots
+/*! Reading stops early when the next shot does not fit into the sample
+    block or sample arrays; that shot is returned first by the next call.
+    A single shot larger than the arrays is an FWIFC_ERR_BAD_ARG.
+    \return FWIFC_NO_ERROR if at least one shot was read,
+        FWIFC_END_OF_FILE if none was left
+ */
+fwifc_int32_t
+vpp_fwblock_read(
+    vpp_fwblock reader
+    , const vpp_fwblock_arrays *arrays
+    , fwifc_uint32_t *shots             /* shots read */
+    , fwifc_uint32_t *sbls              /* sample blocks read */
+    , uint64_t *samples                 /* samples read */
+);
+
+//! message of the last error of this reader
+/*! The message stays valid until the next call with this reader. Errors
+    of vpp_fwblock_open and vpp_fwblock_open_range are reported with a
+    null reader, which returns the message of the last failed open of the
+    calling thread.
+ */
+fwifc_int32_t
+vpp_fwblock_get_last_error(
+    vpp_fwblock reader
+    , fwifc_csz *message
+);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // VPP_FWBLOCK_HPP
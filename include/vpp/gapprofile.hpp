@@ -0,0 +1,144 @@
+// $Id$
+
+#ifndef VPP_GAPPROFILE_HPP
+#define VPP_GAPPROFILE_HPP
+
+//! \file gapprofile.hpp
+//! Gap probability per zenith ring and height, and vertical plant profiles.
+
+#include <vpp/groundplane.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace vpp {
+
+//!\brief accumulator of gap probability by zenith ring and height
+//!\details Every shot counts as a pulse of the ring of its zenith angle;
+//! its echoes are counted in the height bin of their height above the
+//! ground plane. Weighted, every echo of a shot with n echoes counts 1/n,
+//! otherwise only first (and single) echoes count. The gap probability at
+//! height bin j is 1 - (echoes in bins 0..j)/pulses.
+//!
+//! Rings are [min_zenith + i*zenith_bin, min_zenith + (i+1)*zenith_bin),
+//! height bins likewise from min_height. The vertical plant profiles are
+//! those of PAVD_CALDERS2014: the linear model of Jupp et al. (2009) and
+//! the solid angle weighted profile scaled by the PAI at the hinge angle.
+class gap_profile
+{
+public:
+    //! constructor
+    //!\param min_zenith deg
+    //!\param max_zenith deg
+    //!\param zenith_bin deg
+    //!\param min_height m
+    //!\param max_height m
+    //!\param height_bin m
+    //!\param weighted weight echoes by 1/target_count
+    //!\throw std::runtime_error for less than one ring or two height bins
+    gap_profile(
+        double min_zenith = 5
+        , double max_zenith = 70
+        , double zenith_bin = 5
+        , double min_height = 0
+        , double max_height = 60
+        , double height_bin = 0.5
+        , bool weighted = true
+    );
+
+    std::size_t rings() const { return zenith.size(); }
+    std::size_t heights() const { return height.size(); }
+    bool weighted() const { return weighted_; }
+
+    //! ring of a zenith angle in deg, -1 outside
+    int ring(double zenith_deg) const;
+
+    //! add a shot
+    //!\param ring ring of the shot, see ring()
+    //!\param heights height of every echo above the ground
+    //!\param n number of echoes, 0 for shots without echo
+    void add(int ring, const double* heights, unsigned n);
+
+    //! add the counts of a profile with the same bins
+    //!\throw std::runtime_error if the bins differ
+    void merge(const gap_profile& p);
+
+    double pulses(std::size_t ring) const { return pulses_[ring]; }
+    //! gap probability, NaN for rings without pulses
+    double pgap(std::size_t ring, std::size_t height) const;
+
+    //! vertical plant profiles over the height bins
+    struct profiles {
+        std::vector<double> lpp_pai, lpp_pavd, lpp_mla;
+        std::vector<double> sapp_pai, sapp_pavd;
+        std::vector<double> hpp_pai;
+    };
+    profiles compute() const;
+
+    //! write the profiles as csv: height, the gap probability of every ring
+    //! (named vz and the ring centre in 1/100 deg), lpp_pai, lpp_pavd,
+    //! lpp_mla, sapp_pai and sapp_pavd
+    void write(std::ostream& out) const;
+    //!\throw std::runtime_error if the file cannot be written
+    void write(const std::string& path) const;
+
+    std::vector<double> zenith;         //!< ring centres, deg
+    std::vector<double> height;         //!< lower bounds of the height bins, m
+
+private:
+    double min_zenith, zenith_bin;
+    double min_height, height_bin;
+    bool weighted_;
+    std::vector<double> pulses_;
+    std::vector<double> counts;         //!< ring major
+};
+
+//!\brief pointcloud feeding a gap profile
+//!\details The zenith angle is that of the transformed beam, so the scan
+//! has to be levelled by its transform. Heights are taken above the plane,
+//! in project coordinates. Only shots within [min_zenith, max_zenith) of
+//! this scan are counted, so an upright and a tilted scan can fill the
+//! rings of one profile. A shot is counted at on_shot_end(), or at the
+//! next on_shot() if it had no echo data; call flush() after the last
+//! packet.
+class gap_pointcloud
+    : public project_pointcloud
+{
+public:
+    //! constructor
+    //!\param profile receives the shots
+    //!\param plane the ground
+    //!\param min_zenith deg
+    //!\param max_zenith deg
+    //!\param sync_to_pps use pps synchronized time stamps
+    gap_pointcloud(
+        gap_profile& profile
+        , const plane_fit& plane
+        , double min_zenith = 0
+        , double max_zenith = 180
+        , bool sync_to_pps = false
+    );
+
+    //! count the last shot
+    void flush();
+
+    uint64_t shots;             //!< shots counted in a ring
+
+protected:
+    void on_shot();
+    void on_shot_end();
+
+private:
+    gap_profile& profile;
+    plane_fit plane;
+    double min_zenith, max_zenith;
+    int pending;
+    std::vector<double> heights;
+};
+
+} // namespace vpp
+
+#endif // VPP_GAPPROFILE_HPP
@@ -0,0 +1,119 @@
+// $Id$
+
+#ifndef VPP_GROUNDPLANE_HPP
+#define VPP_GROUNDPLANE_HPP
+
+//! \file groundplane.hpp
+//! Robust ground plane fitted from a grid of lowest echoes while decoding.
+
+#include <vpp/transform.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace vpp {
+
+//!\brief lowest point of every cell of a horizontal grid
+//!\details Cell (i, j) covers [x0 + i*cell, x0 + (i+1)*cell) by
+//! [y0 + j*cell, y0 + (j+1)*cell). Memory is independent of the number of
+//! points added.
+class ground_grid
+{
+public:
+    ground_grid();
+    ground_grid(double x0, double y0, double cell, uint32_t nx, uint32_t ny);
+
+    //! add a point, ignored outside the grid
+    void add(double x, double y, double z);
+
+    uint32_t nx() const { return nx_; }
+    uint32_t ny() const { return ny_; }
+    double cell() const { return cell_; }
+
+    //! cells holding at least one point
+    std::size_t occupied() const;
+
+    //! centres and lowest z of the occupied cells
+    void cells(std::vector<double>& x, std::vector<double>& y, std::vector<double>& z) const;
+
+    uint64_t points;            //!< points inside the grid
+
+private:
+    double x0, y0, cell_;
+    uint32_t nx_, ny_;
+    std::vector<double> zmin;
+};
+
+//!\brief plane z = a + b*x + c*y from a robust linear model
+//!\details Iteratively reweighted least squares with Huber's T norm
+//! (t = 1.345), the scale re-estimated every iteration as the median
+//! absolute residual over 0.6745, and H1 covariance, as statsmodels' RLM
+//! with its defaults.
+struct plane_fit
+{
+    plane_fit();
+
+    double params[3];           //!< a, b, c
+    double bse[3];              //!< standard errors
+    double scale;               //!< final scale of the residuals
+    double deviance;            //!< convergence criterion of the last iteration
+    unsigned iterations;
+    std::size_t observations;
+
+    //! fit a plane
+    //!\param x, y, z observations
+    //!\param n number of observations
+    //!\throw std::runtime_error for less than 4 observations or a singular design
+    static plane_fit huber(const double* x, const double* y, const double* z, std::size_t n);
+
+    //! z of the plane
+    double elevation(double x, double y) const { return params[0] + params[1]*x + params[2]*y; }
+    //! height of a point above the plane
+    double height(double x, double y, double z) const { return z - elevation(x, y); }
+
+    //! write the summary table of the fit, the contents of the plane report
+    void report(std::ostream& out) const;
+    //!\throw std::runtime_error if the file cannot be written
+    void report(const std::string& path) const;
+};
+
+//!\brief pointcloud collecting the lowest last and single echoes
+//!\details The grid is square and centred at the scanner position of the
+//! first shot unless placed with set_grid_centre(). Coordinates are project
+//! coordinates, i.e. including the offset of the project_pointcloud, so
+//! the plane applies to points of other passes over the same project.
+class plane_pointcloud
+    : public project_pointcloud
+{
+public:
+    //! constructor
+    //!\param extent edge length of the grid in m
+    //!\param cell edge length of a cell in m
+    //!\param sync_to_pps use pps synchronized time stamps
+    explicit plane_pointcloud(double extent = 20, double cell = 1, bool sync_to_pps = false);
+
+    //! centre the grid, before the first shot
+    void set_grid_centre(double x, double y);
+
+    const ground_grid& grid() const { return grid_; }
+
+    //! fit the plane to the cells seen so far
+    plane_fit fit() const;
+
+protected:
+    void on_shot();
+    void on_echo_transformed(echo_type echo);
+
+private:
+    double extent;
+    double cell;
+    bool placed;
+    ground_grid grid_;
+};
+
+} // namespace vpp
+
+#endif // VPP_GROUNDPLANE_HPP
@@ -0,0 +1,124 @@
+// $Id$
+
+#ifndef VPP_LEVELING_HPP
+#define VPP_LEVELING_HPP
+
+//! \file leveling.hpp
+//! Leveling of upright scans from the inclination data of the stream.
+
+#include <vpp/transform.hpp>
+
+#include <riegl/ridataspec.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace vpp {
+
+//!\brief running estimate of the up direction in scanner own coordinates
+//!\details Samples are up vectors, averaged after normalisation. The
+//! leveling rotation turns the mean up vector into +z about the horizontal
+//! axis perpendicular to both, leaving the heading unchanged.
+//!
+//! Inclination sensors give the line of gravity but not reliably its
+//! sign, so every sample is taken in the hemisphere of the scanner's z
+//! axis. This holds for upright scans only; tilted scan positions have to
+//! be registered as before.
+class leveling_estimate
+{
+public:
+    leveling_estimate();
+
+    void clear();
+
+    //! add a gravity or up vector, any length
+    void add_vector(const double v[3]);
+
+    //! add the tilt of the x and y axes against the horizontal
+    //!\param x_deg angle of the x axis, positive if it points upwards
+    //!\param y_deg angle of the y axis, positive if it points upwards
+    void add_tilt(double x_deg, double y_deg);
+
+    std::size_t samples() const { return count; }
+
+    //! mean up vector, unit length; +z without samples
+    void up(double u[3]) const;
+
+    //! tilt of the z axis against the vertical in deg
+    double tilt() const;
+
+    //! the leveling rotation
+    rigid_transform transform() const;
+
+private:
+    double sum[3];
+    std::size_t count;
+};
+
+//!\brief bounded read of the inclination data at the start of a stream
+//!\details Only the gravity_socs and inclination_static packets are
+//! decoded. Reading stops after max_samples samples or max_bytes bytes.
+class leveling_probe
+    : public scanlib::basic_packets
+{
+public:
+    //! constructor
+    //!\param max_samples samples to average
+    //!\param max_bytes upper bound of bytes to read
+    leveling_probe(std::size_t max_samples = 64, uint64_t max_bytes = 64u<<20);
+
+    //! probe a stream
+    //!\param uri connection uri, e.g. "file:scan.rxp"
+    //!\throw std::runtime_error if no inclination data was found
+    leveling_estimate probe(const std::string& uri);
+
+protected:
+    void on_gravity_socs(const scanlib::gravity_socs<iterator_type>& arg);
+    void on_inclination_static(const scanlib::inclination_static<iterator_type>& arg);
+
+private:
+    std::size_t max_samples;
+    uint64_t max_bytes;
+    leveling_estimate estimate;
+};
+
+//!\brief pointcloud leveling upright scans on the fly
+//!\details The inclination data is aggregated while decoding. Once
+//! min_samples samples have been seen the leveling rotation is fixed and,
+//! followed by post (e.g. a POP, or the heading of the SOP), becomes the
+//! transform of the project_pointcloud. Shots decoded before are delivered
+//! unlevelled and counted; inclination data is usually recorded before the
+//! first shot, otherwise use a leveling_probe and set_transform().
+class level_pointcloud
+    : public project_pointcloud
+{
+public:
+    //! constructor
+    //!\param sync_to_pps use pps synchronized time stamps
+    //!\param min_samples samples averaged before leveling
+    explicit level_pointcloud(bool sync_to_pps = false, std::size_t min_samples = 8);
+
+    rigid_transform post;               //!< applied after leveling
+
+    bool levelled() const { return fixed; }
+    const leveling_estimate& estimate() const { return estimate_; }
+
+    uint64_t shots_unlevelled;          //!< shots before leveling was fixed
+
+protected:
+    void on_shot();
+    void on_gravity_socs(const scanlib::gravity_socs<iterator_type>& arg);
+    void on_inclination_static(const scanlib::inclination_static<iterator_type>& arg);
+
+private:
+    std::size_t min_samples;
+    leveling_estimate estimate_;
+    bool fixed;
+
+    void update();
+};
+
+} // namespace vpp
+
+#endif // VPP_LEVELING_HPP
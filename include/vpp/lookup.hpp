@@ -0,0 +1,93 @@
+// $Id$
+
+#ifndef VPP_LOOKUP_HPP
+#define VPP_LOOKUP_HPP
+
+//! \file lookup.hpp
+//! Batch evaluation of waveform calibration tables.
+
+#include <riegl/wave.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace vpp {
+
+//!\brief piecewise linear calibration curve
+//!\details Decodes a scanlib::wave::lookup_table into knots
+//!   x[i] = abscissa[i] * abscissa_scale + abscissa_offset
+//!   y[i] = ordinate[i] * ordinate_scale + ordinate_offset
+//! sorted by x, and interpolates linearly between them. Arguments outside
+//! the table are clamped to the first and last knot.
+//!
+//! operator() and evaluate() without a dense table locate the interval by
+//! binary search. resample() builds a uniform table of float values over
+//! the abscissa range, after which evaluate() takes constant time per
+//! element in a branch-free loop reading the table by gather. gcc
+//! vectorises that loop with -O3 -mavx2 or -O2 -ftree-vectorize -mavx2,
+//! not at plain -O2. The dense table reproduces the curve exactly where
+//! the knots fall on its grid; the largest deviation at the knots is
+//! reported by dense_error().
+class lookup_evaluator
+{
+public:
+    lookup_evaluator();
+
+    //! constructor
+    //!\param t calibration table as filled in by scanlib::wave
+    //!\param dense size of the uniform table, 0 for none
+    explicit lookup_evaluator(const scanlib::wave::lookup_table& t, std::size_t dense = 0);
+
+    //! replace the curve, drops the dense table unless dense > 0
+    void assign(const scanlib::wave::lookup_table& t, std::size_t dense = 0);
+
+    //! build a uniform table of n >= 2 entries
+    void resample(std::size_t n);
+
+    bool empty() const { return x.empty(); }
+    std::size_t size() const { return x.size(); }
+    std::size_t dense_size() const { return value.size(); }
+    double dense_error() const { return error; }
+    double x_min() const { return x.empty() ? 0 : x.front(); }
+    double x_max() const { return x.empty() ? 0 : x.back(); }
+
+    //! evaluate at one point, NaN if the curve is empty
+    double operator()(double arg) const;
+
+    //! evaluate an array, out[k] = f(in[k])
+    /*! Uses the dense table if present. in and out may be the same array
+        for the overloads of equal type.
+     */
+    void evaluate(const double* in, double* out, std::size_t n) const;
+    void evaluate(const float* in, float* out, std::size_t n) const;
+    void evaluate(const uint16_t* in, float* out, std::size_t n) const;
+
+private:
+    std::vector<double> x;
+    std::vector<double> y;
+
+    // dense table: f(u) = value[i] + (u-i)*slope[i], u = (arg-origin)*inv_step
+    std::vector<float> value;
+    std::vector<float> slope;
+    float origin;
+    float inv_step;
+    double error;
+};
+
+//!\brief the four calibration curves of a waveform stream
+struct wave_calibration
+{
+    lookup_evaluator amplitude_low_power;
+    lookup_evaluator amplitude_high_power;
+    lookup_evaluator position_diff_low_power;
+    lookup_evaluator position_diff_high_power;
+
+    //! take the tables of a wave instance
+    //!\param dense size of the uniform tables, 0 for none
+    void assign(const scanlib::wave& w, std::size_t dense = 0);
+};
+
+} // namespace vpp
+
+#endif // VPP_LOOKUP_HPP
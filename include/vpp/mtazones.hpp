@@ -0,0 +1,136 @@
+// $Id$
+
+#ifndef VPP_MTAZONES_HPP
+#define VPP_MTAZONES_HPP
+
+//! \file mtazones.hpp
+//! Targets of several MTA zones per shot in one flat, reused layout.
+
+#include <vpp/reflectance.hpp>
+
+#include <riegl/pointcloud.hpp>
+
+#include <cstddef>
+#include <deque>
+#include <vector>
+
+namespace vpp {
+
+//!\brief near range correction of the range, as scanlib::pointcloud adds it
+//!\details The library adds table(r) to the range r of an echo in its zone
+//! if 0 < r < (size-1) step, the table (nrange_table packet) interpolated
+//! linearly on the grid 0, step, 2 step, ..
+struct near_range
+{
+    near_range() : step(0), values(0), size(0) {}
+    near_range(double step_, const float* values_, std::size_t size_)
+        : step(step_), values(values_), size(size_) {}
+
+    double step;                        //!< m
+    const float* values;                //!< m, not owned
+    std::size_t size;
+
+    //! corrected range of an echo at range
+    double apply(double range) const;
+    //! range before the correction, the inverse of apply()
+    double remove(double range) const;
+};
+
+//! move targets into another MTA zone
+/*! The range of each target is shifted by whole zone widths from its own
+    zone to zone, and its vertex recomputed along the beam.
+
+    The reflectance of the library depends on the range. Given the
+    reflectance table of the scan it is moved to the new range, see
+    reflectance_table::move(); without it it is set to NaN, as the value
+    of the old zone would be wrong. Given the near range table, its
+    correction is taken off the old range and applied to the new one;
+    without it the ranges are shifted as they are, which is exact beyond
+    the near range of either zone.
+    \param in targets as decoded
+    \param n number of targets
+    \param zone target zone, 1 is the nearest (zone == zone_index + 1)
+    \param zone_width unambiguous range in m, see pointcloud::unambiguous_range
+    \param origin beam origin of the shot
+    \param direction unit beam direction of the shot
+    \param out receives n targets, may equal in
+    \param reflectance reflectance correction of the scan, or 0
+    \param near near range correction of the scan, or 0
+ */
+void mta_transform(
+    const scanlib::target* in
+    , std::size_t n
+    , unsigned zone
+    , double zone_width
+    , const double origin[3]
+    , const double direction[3]
+    , scanlib::target* out
+    , const reflectance_table* reflectance = 0
+    , const near_range* near = 0
+);
+
+//!\brief targets of one shot in several MTA zones
+//!\details All targets are held in one array, zone k (counted in the
+//! order of zones) owns targets[offset[k]] .. targets[offset[k+1]-1].
+//! The arrays keep their capacity from shot to shot.
+struct mta_shot
+{
+    std::vector<unsigned> zones;                //!< candidate zones
+    std::vector<scanlib::target> targets;       //!< all zones, zone after zone
+    std::vector<std::size_t> offset;            //!< zones.size()+1 entries
+    std::size_t resolved;                       //!< index into zones, see mta_pointcloud::resolve
+
+    std::size_t count(std::size_t k) const { return offset[k+1] - offset[k]; }
+    const scanlib::target* begin(std::size_t k) const { return targets.data() + offset[k]; }
+    const scanlib::target* end(std::size_t k) const { return targets.data() + offset[k+1]; }
+};
+
+//!\brief pointcloud delivering the targets of several MTA zones at once
+//!\details The targets decoded in the standard zone of the stream are
+//! transformed into each candidate zone, instead of having
+//! set_multi_mta_zones() build a vector of target vectors per shot.
+//!
+//! With resolve set, the zone of every shot is chosen by range continuity:
+//! the candidate whose mean target range is closest to the median range
+//! of the last history shots with targets wins. Until the history is
+//! filled the standard zone is taken; shots without targets keep the
+//! zone of the shot before.
+//!
+//! The transformed targets get range, reflectance and vertex as the
+//! library would have decoded them in their zone, with the near range and
+//! reflectance tables of the scan, see mta_transform().
+class mta_pointcloud
+    : public reflectance_pointcloud
+{
+public:
+    //! constructor
+    //!\param zones candidate zones, 1 is the nearest
+    //!\param sync_to_pps use pps synchronized time stamps
+    explicit mta_pointcloud(const std::vector<unsigned>& zones, bool sync_to_pps = false);
+
+    bool resolve;                       //!< choose a zone per shot
+    std::size_t history;                //!< shots considered by resolve
+
+    const mta_shot& shot() const { return current; }
+
+    uint64_t zone_changes;              //!< shots resolved into another zone than the one before
+
+protected:
+    //! called for every shot with the zones of shot()
+    virtual void on_shot_zones() = 0;
+
+    void on_shot_end();
+
+private:
+    mta_shot current;
+    std::deque<double> ranges;          // resolved mean ranges of recent shots
+    std::vector<double> sorted;
+    std::size_t previous;
+    bool seen;
+
+    std::size_t choose();
+};
+
+} // namespace vpp
+
+#endif // VPP_MTAZONES_HPP
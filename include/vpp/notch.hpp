@@ -0,0 +1,125 @@
+// $Id$
+
+#ifndef VPP_NOTCH_HPP
+#define VPP_NOTCH_HPP
+
+//! \file notch.hpp
+//! Branch-free notch filtering of echo blocks with per segment counters.
+
+#include <riegl/pointcloud.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace vpp {
+
+//! notch window of one segment
+/*! An echo is notched if range_min <= range <= range_max and
+    amplitude <= amplitude_max.
+ */
+struct notch_window
+{
+    float range_min;            //!< m
+    float range_max;            //!< m
+    float amplitude_max;        //!< dB
+};
+
+//!\brief notch filter over whole echo blocks
+//!\details The windows are indexed by segment (line or frame segment,
+//! or target::segment); segments without a window of their own are never
+//! notched. The test is one table lookup and three comparisons combined
+//! without branches, so evaluate() vectorises over the echoes of a block
+//! (gcc -O3 -mavx2, the windows read by gather); the per segment counters
+//! are summed in a second, scalar pass.
+class notch_table
+{
+public:
+    notch_table();
+
+    //! one window for all segments, as given by the notch_filter packet
+    void assign(const notch_window& w);
+    //! one window per segment
+    void assign(const std::vector<notch_window>& w);
+    void clear();
+
+    bool empty() const { return count == 0; }
+    std::size_t segments() const { return count; }
+
+    //! evaluate the predicate
+    //!\param range m
+    //!\param amplitude dB
+    //!\param segment segment of each echo, null for segment 0
+    //!\param n number of echoes
+    //!\param notched receives 1 for notched echoes, 0 else
+    //!\return number of notched echoes
+    std::size_t evaluate(
+        const float* range
+        , const float* amplitude
+        , const uint32_t* segment
+        , std::size_t n
+        , uint8_t* notched
+    );
+
+    //! remove notched targets, keeping the order of the others
+    //!\return number of targets left
+    std::size_t apply(scanlib::target* t, std::size_t n);
+
+    //! echoes seen and notched per segment by evaluate() and apply();
+    //! the last entry counts the segments without a window
+    std::vector<uint64_t> seen;
+    std::vector<uint64_t> notched;
+
+private:
+    std::size_t count;
+    bool global;
+    std::vector<float> range_min;       // count+1 entries, the last one never notches
+    std::vector<float> range_max;
+    std::vector<float> amplitude_max;
+
+    uint32_t index(uint32_t segment) const {
+        uint32_t s = global ? 0 : segment;
+        return s < count ? s : uint32_t(count);
+    }
+};
+
+//!\brief pointcloud applying a notch_table to each shot
+//!\details The notch window of the stream is taken from its notch_filter
+//! packet unless a table has been assigned to notch beforehand; scanlib's
+//! own single window test is switched off. Notched targets are removed
+//! from targets before on_shot_end() of a derived class runs, which must
+//! call this class's on_shot_end() first. on_echo_transformed() still sees
+//! all echoes.
+//!
+//! Streams with a notch_filter_modification_parameters packet (142.0) are
+//! notched by scanlib itself with windows per line or frame segment it
+//! derives at measurement start; for them the notch_filter packet is not
+//! taken over and only a table assigned beforehand is applied in addition.
+class notch_pointcloud
+    : public scanlib::pointcloud
+{
+public:
+    //! constructor
+    //!\param sync_to_pps use pps synchronized time stamps
+    explicit notch_pointcloud(bool sync_to_pps = false);
+
+    notch_table notch;
+
+    //! the stream is notched per segment by scanlib
+    bool segmented_by_scanlib() const { return segmented; }
+
+protected:
+    void on_shot_end();
+    void on_notch_filter(const scanlib::notch_filter<iterator_type>& arg);
+    void on_notch_filter_modification_parameters(
+        const scanlib::notch_filter_modification_parameters<iterator_type>& arg
+    );
+
+private:
+    bool segmented;
+    bool from_packet;                   // notch holds the notch_filter packet window
+};
+
+} // namespace vpp
+
+#endif // VPP_NOTCH_HPP
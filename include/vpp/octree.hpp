@@ -0,0 +1,203 @@
+// $Id$
+
+#ifndef VPP_OCTREE_HPP
+#define VPP_OCTREE_HPP
+
+//! \file octree.hpp
+//! Out-of-core octree index of the points of a scan, in Morton order.
+
+#include <vpp/transform.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace vpp {
+
+//! deepest level of an octree, 3*21 bits fit a 64 bit Morton key
+const unsigned octree_max_depth = 21;
+
+//!\brief point record of the octree file
+//!\details Coordinates are vertex coordinates of the pointcloud, i.e.
+//! relative to the offset of a project_pointcloud.
+struct octree_point
+{
+    uint64_t key;               //!< Morton key of the leaf cell
+    uint64_t shot;              //!< shot number in the stream
+    float x, y, z;              //!< m
+    float range;                //!< m
+    float amplitude;            //!< dB
+    float reflectance;          //!< dB
+    uint32_t first_of_shot;     //!< bit l set if first echo of the shot in its level l cell
+    uint8_t target_index;       //!< 1 based
+    uint8_t target_count;
+    uint16_t reserved;
+};
+
+//!\brief node of the octree
+//!\details Points of a node are the consecutive records
+//! [first, first + points) of the point table.
+struct octree_node
+{
+    uint64_t key;               //!< Morton key of the cell at its level
+    uint64_t first;             //!< index of the first point
+    uint64_t points;            //!< number of points
+    uint64_t shots;             //!< number of shots with echoes in the cell
+    uint32_t level;             //!< 0 is the root
+    uint32_t reserved;
+};
+
+//! Morton key of integer cell coordinates, 21 bits each
+uint64_t morton_encode(uint32_t ix, uint32_t iy, uint32_t iz);
+//! cell coordinates of a Morton key
+void morton_decode(uint64_t key, uint32_t& ix, uint32_t& iy, uint32_t& iz);
+
+//!\brief memory bounded builder of an octree file
+//!\details Points are buffered up to the memory limit, then sorted by
+//! Morton key and spilled to a run file next to the output. finish()
+//! merges the runs into the point table and accumulates the nodes of all
+//! levels in the same pass, so memory use is independent of the number
+//! of points. Points outside the cube are counted and dropped.
+//!
+//! The shot count of a node is the number of distinct shots with at least
+//! one echo in the cell. Shots passing through a cell without an echo are
+//! not known to the index.
+class octree_builder
+{
+public:
+    //! constructor
+    //!\param path output file
+    //!\param origin lower corner of the indexed cube, vertex coordinates
+    //!\param size edge length of the cube in m
+    //!\param depth leaf level, cell size is size/2^depth
+    //!\param memory bytes of points to buffer before spilling a run
+    //!\throw std::runtime_error if depth exceeds octree_max_depth
+    octree_builder(
+        const std::string& path
+        , const double origin[3]
+        , double size
+        , unsigned depth
+        , std::size_t memory = 256u<<20
+    );
+    ~octree_builder();
+
+    //! record the offset of the vertex coordinates, e.g. project_pointcloud::offset()
+    void set_offset(const double offset[3]);
+
+    //! add the echoes of one shot
+    void add(const scanlib::target* t, unsigned n, uint64_t shot);
+
+    //! merge the runs and write the file
+    void finish();
+
+    uint64_t points() const { return points_; }
+    uint64_t outside;           //!< echoes dropped outside the cube
+    //! sorted runs spilled and not yet merged
+    unsigned runs() const { return static_cast<unsigned>(run_paths.size()); }
+
+private:
+    std::string path;
+    double origin[3];
+    double size;
+    unsigned depth;
+    double offset[3];
+    double scale;
+    std::size_t capacity;
+    std::vector<octree_point> buffer;
+    std::vector<std::string> run_paths;
+    uint64_t points_;
+    bool finished;
+
+    void spill();
+
+    // not copyable
+    octree_builder(const octree_builder&);
+    octree_builder& operator=(const octree_builder&);
+};
+
+//!\brief read access to an octree file
+//!\details The node table is held in memory, points are read on demand.
+//! Box bounds are half open, [lo, hi), in vertex coordinates.
+class octree_index
+{
+public:
+    //!\throw std::runtime_error if the file is not an octree file
+    explicit octree_index(const std::string& path);
+
+    unsigned depth() const { return depth_; }
+    const double* origin() const { return origin_; }
+    double size() const { return size_; }
+    const double* offset() const { return offset_; }
+    uint64_t point_count() const { return point_count_; }
+    double cell_size(unsigned level) const { return size_/(uint64_t(1)<<level); }
+
+    //! nodes of one level in Morton order
+    const octree_node* level_begin(unsigned level) const;
+    const octree_node* level_end(unsigned level) const;
+
+    //! node of a cell, null if the cell is empty
+    const octree_node* find(unsigned level, uint64_t key) const;
+
+    //! bounds of the cell of a node
+    void bounds(const octree_node& n, double lo[3], double hi[3]) const;
+
+    //! append the points of a node
+    void read(const octree_node& n, std::vector<octree_point>& out);
+    //! append the points [first, first + count)
+    void read(uint64_t first, uint64_t count, std::vector<octree_point>& out);
+
+    //! append the points inside a box
+    //!\return number of points appended
+    std::size_t query(const double lo[3], const double hi[3], std::vector<octree_point>& out);
+
+    //! append the points of a vertical column
+    std::size_t column(double x0, double y0, double x1, double y1, std::vector<octree_point>& out);
+
+private:
+    std::ifstream in;
+    std::string path;
+    unsigned depth_;
+    double origin_[3];
+    double size_;
+    double offset_[3];
+    uint64_t point_count_;
+    uint64_t points_offset;
+    std::vector<octree_node> nodes;
+    std::vector<std::size_t> levels;
+
+    struct span {
+        uint64_t first, count;
+        bool filter;
+    };
+    void collect(unsigned level, uint64_t key, const double lo[3], const double hi[3], std::vector<span>& out) const;
+};
+
+//!\brief pointcloud feeding an octree builder
+//!\details Every shot gets a number at on_shot(), counting shots without
+//! echoes too, and its echoes are added in project coordinates once the
+//! shot is complete. The offset is recorded in the builder on the first
+//! shot.
+class octree_pointcloud
+    : public project_pointcloud
+{
+public:
+    //! constructor
+    //!\param builder receives the echoes
+    //!\param sync_to_pps use pps synchronized time stamps
+    explicit octree_pointcloud(octree_builder& builder, bool sync_to_pps = false);
+
+    uint64_t shots;             //!< shots seen
+
+protected:
+    void on_shot();
+    void on_shot_end();
+
+private:
+    octree_builder& builder;
+};
+
+} // namespace vpp
+
+#endif // VPP_OCTREE_HPP
@@ -0,0 +1,134 @@
+// $Id$
+
+#ifndef VPP_PPSMAP_HPP
+#define VPP_PPSMAP_HPP
+
+//! \file ppsmap.hpp
+//! Two pass conversion of internal time stamps to pps time.
+//!
+//! scanlib::pointcloud converts shot times to pps time on the fly, one
+//! shot at a time, and only once it has locked onto the pps pulses;
+//! shots before the lock keep internal time. Here a first pass reads only
+//! the pps_sync packets of a stream into a compact piecewise linear
+//! table, and a second pass converts the internal shot times (time_sorg
+//! of a pointcloud with sync_to_pps off) in bulk. Since the whole table is
+//! known beforehand, shots recorded before the first pulses get pps time
+//! as well.
+
+#include <riegl/ridataspec.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace vpp {
+
+//!\brief piecewise linear mapping from internal time to pps time
+//!\details Knots are added in stream order, one per pps pulse. A knot
+//! whose rate relative to the previous one deviates by more than
+//! max_drift from 1 is rejected, unless the following knot confirms it,
+//! in which case the pps time has jumped and both are taken. The jump is
+//! a step at the first of them: the segment before runs on up to it and
+//! two knots share its internal time, the second one in the new time
+//! base; compact() keeps both. pps time counts on across the day or week
+//! rollover of the sync packets.
+//! Outside the knots the first and last segment are extended by at most
+//! max_extrapolation seconds.
+class pps_map
+{
+public:
+    pps_map();
+
+    double max_drift;                   //!< accepted rate deviation
+    double max_extrapolation;           //!< s, beyond the first and last knot
+    double tolerance;                   //!< s, error allowed by compact()
+
+    void clear();
+
+    //! append a pulse
+    //!\param sys internal time in s
+    //!\param pps pps time in s
+    void add(double sys, double pps);
+
+    //! drop knots that are reproduced within tolerance by their neighbours
+    void compact();
+
+    std::size_t size() const { return sys_.size(); }
+    bool empty() const { return sys_.empty(); }
+
+    //! internal time range covered, without extrapolation
+    double sys_begin() const;
+    double sys_end() const;
+
+    //! convert one time, NaN outside the extrapolation range
+    double operator()(double sys) const;
+
+    //! convert many times
+    /*! Fastest for ascending input, as neighbouring times share their
+        segment lookup.
+        \return number of times converted, the others are set to NaN
+     */
+    std::size_t convert(const double* sys, double* pps, std::size_t n) const;
+
+    uint64_t rejected;                  //!< knots dropped as outliers
+
+private:
+    std::vector<double> sys_;
+    std::vector<double> pps_;
+    std::vector<double> rate_;          // slope of segment k, last entry extrapolates
+    double rollover;                    // added to pps to count on across rollovers
+    bool have_candidate;
+    double candidate_sys;
+    double candidate_pps;
+
+    bool regular(double sys0, double pps0, double sys1, double pps1) const;
+    void append(double sys, double pps);
+    std::size_t segment(double t, std::size_t hint) const;
+};
+
+//!\brief first pass: collect the pps pulses of an rxp stream
+//!\details Only the units and pps_sync packets are decoded. The internal
+//! time of a pulse is unwrapped from its counter in the same way
+//! scanlib::pointcloud unwraps the shot counter, so the knots use the
+//! time base of time_sorg with sync_to_pps off. If the stream carries
+//! high resolution pulses the others are ignored.
+class pps_map_builder
+    : public scanlib::basic_packets
+{
+public:
+    pps_map_builder();
+
+    //! read a whole stream
+    //!\param uri connection uri, e.g. "file:scan.rxp"
+    //!\return the compacted map
+    pps_map build(const std::string& uri);
+
+    pps_map map;                        //!< knots gathered so far
+
+protected:
+    void on_units(const scanlib::units<iterator_type>& arg);
+    void on_units_1(const scanlib::units_1<iterator_type>& arg);
+    void on_units_2(const scanlib::units_2<iterator_type>& arg);
+    void on_units_3(const scanlib::units_3<iterator_type>& arg);
+    void on_units_4(const scanlib::units_4<iterator_type>& arg);
+    void on_pps_sync(const scanlib::pps_sync<iterator_type>& arg);
+    void on_pps_sync_hr(const scanlib::pps_sync_hr<iterator_type>& arg);
+
+private:
+    double time_unit;
+    double time_unit_hr;
+    unsigned time_bits_hr;
+
+    bool have_hr;
+    bool have_sys;
+    uint32_t sys_prev;
+    uint64_t sys_ext;
+    bool have_sys_hr;
+    uint64_t sys_hr_prev;
+    uint64_t sys_hr_ext;
+};
+
+} // namespace vpp
+
+#endif // VPP_PPSMAP_HPP
@@ -0,0 +1,113 @@
+// $Id$
+
+#ifndef VPP_REFLECTANCE_HPP
+#define VPP_REFLECTANCE_HPP
+
+//! \file reflectance.hpp
+//! Batched range correction of reflectance with the tables of the scan.
+
+#include <riegl/pointcloud.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace vpp {
+
+//! loss in dB per m of range and Neper/m of attenuation, as applied by
+//! scanlib::pointcloud
+extern const double attenuation_db;
+
+//!\brief range correction of reflectance as scanlib::pointcloud applies it
+//!\details scanlib::pointcloud derives the reflectance of an echo from the
+//! reflectance field of the echo packet (the base value, in dB) and the
+//! range:
+//!   reflectance = base + correction(range)
+//!   correction(r) = table(|r|) + attenuation_db * attenuation * r
+//! table() is the reflectance table of the scan (reftab_table packet) on
+//! the grid 0, step, 2 step, .. interpolated linearly; beyond its last
+//! entry it continues as last + 20 log10(r/r_last). attenuation is the
+//! atmospheric attenuation in Neper/m (atmosphere packet).
+//!
+//! Since the base value does not depend on range, the reflectance of an
+//! echo at another range, e.g. in another MTA zone, or under another
+//! atmosphere is reflectance - correction(old) + correction(new), see
+//! move().
+//!
+//! The tables are those of the library, taken over by a
+//! reflectance_pointcloud. The block loops evaluate the table by gather
+//! and are vectorised by gcc with -O3 -mavx2 (or -O2 -ftree-vectorize
+//! -mavx2); the few echoes beyond the table get their log10 term in a
+//! second pass.
+class reflectance_table
+{
+public:
+    reflectance_table();
+
+    double attenuation;                 //!< Neper/m
+
+    //! set the table
+    //!\param step grid spacing in m
+    //!\param table correction in dB at 0, step, 2 step, ..; empty for none
+    void assign(double step, const std::vector<float>& table);
+
+    bool empty() const { return table.empty(); }
+    double step() const { return dr; }
+    const std::vector<float>& values() const { return table; }
+
+    //! correction of one echo, dB
+    float correction(double range) const;
+
+    //! reflectance of a block of echoes
+    //!\param range m
+    //!\param base reflectance field of the echo packets, dB
+    //!\param n number of echoes
+    //!\param reflectance receives n values, may equal base
+    void convert(const float* range, const float* base, std::size_t n, float* reflectance) const;
+    void convert(const double* range, const float* base, std::size_t n, float* reflectance) const;
+
+    //! base values of a block of echoes, the inverse of convert()
+    //!\param reflectance receives n values, may equal base
+    void remove(const double* range, const float* reflectance, std::size_t n, float* base) const;
+
+    //! reflectance of echoes moved to another range
+    //!\param from range the reflectance was computed for
+    //!\param to new range
+    //!\param n number of echoes
+    //!\param reflectance converted in place
+    void move(const double* from, const double* to, std::size_t n, float* reflectance) const;
+
+private:
+    double dr;
+    std::vector<float> table;
+    std::vector<float> slope;           // table[i+1] - table[i], 0 for the last
+
+    template<class range_type>
+    void correct(const range_type* range, const float* in, float sign, std::size_t n, float* out) const;
+};
+
+//!\brief pointcloud keeping a reflectance_table equal to its own tables
+//!\details Takes over the reflectance table and the attenuation whenever
+//! the library receives them, so reflectance() converts as this pointcloud
+//! does for the current scan.
+class reflectance_pointcloud
+    : public scanlib::pointcloud
+{
+public:
+    //! constructor
+    //!\param sync_to_pps use pps synchronized time stamps
+    explicit reflectance_pointcloud(bool sync_to_pps = false);
+
+    //! the range correction of the current scan
+    const reflectance_table& reflectance();
+
+protected:
+    void on_reftab_table(const scanlib::reftab_table<iterator_type>& arg);
+
+private:
+    reflectance_table table;
+};
+
+} // namespace vpp
+
+#endif // VPP_REFLECTANCE_HPP
@@ -0,0 +1,109 @@
+// $Id$
+
+#ifndef VPP_RXPCRC_HPP
+#define VPP_RXPCRC_HPP
+
+//! \file rxpcrc.hpp
+//! Verify-once crc checking of rxp files with a stamp in the probe cache.
+
+#include <vpp/rxpprobe.hpp>
+
+#include <riegl/pointcloud.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace vpp {
+
+//! selector of the crc32_header and crc32_check packets
+scanlib::selector_type select_crc();
+
+//!\brief full pass crc verification of an rxp file
+//!\details The crc arithmetic is left to scanlib::pointcloud, this class
+//! only counts the crc packets and collects the errors it reports. The
+//! bytes consumed by the decoder are hashed along the way, see
+//! rxp_content_hash().
+class rxp_crc_verifier
+    : public scanlib::pointcloud
+{
+public:
+    rxp_crc_verifier();
+
+    //! sequence range of a failed crc check
+    struct error_range {
+        uint16_t stream;
+        uint32_t sequence_begin;
+        uint32_t sequence_end;
+    };
+
+    //! read a whole file and check all crc streams
+    //!\param path file system path of the rxp file
+    //!\return crc_absent, crc_passed or crc_failed
+    rxp_meta::crc_status_e verify(const std::string& path);
+
+    uint64_t streams;   //!< crc32_header packets seen
+    uint64_t checks;    //!< crc32_check packets seen
+    std::vector<error_range> errors;
+    std::string content; //!< hash of the whole file
+
+protected:
+    void on_crc32_header(const scanlib::crc32_header<iterator_type>& arg);
+    void on_crc32_check(const scanlib::crc32_check<iterator_type>& arg);
+    void on_crc32_error(uint16_t stream, uint32_t sequence_begin, uint32_t sequence_end);
+};
+
+//! hash of the whole content of a file
+/*! 64 bit FNV-1a over 8 byte words with a fold of the high half per
+    word, rendered as 16 hex digits. Unlike rxp_fingerprint() a change
+    anywhere in the file changes the hash.
+ */
+std::string rxp_content_hash(const std::string& path);
+
+//! whether the crc stamp of the metadata was taken from this very file
+/*! True only if path, device, inode, size and modification time (in ns)
+    match one of the files of the stamp. A matching fingerprint alone is
+    not enough, it covers only the head and the tail of the file. Always
+    false where the file system gives no inode.
+ */
+bool crc_stamp_applies(const rxp_meta& meta, const std::string& path);
+
+//! verify a file unless the cache already holds a crc stamp for it
+/*! The stamp is kept if it was taken from this file (crc_stamp_applies),
+    or if the full content hash of the file equals the one recorded when
+    verifying, which costs a plain read of the file but no decoding. The
+    latter adds this file to those of the stamp, so that copies of a scan
+    each pay the read once, up to 16 files. Otherwise the whole file is
+    verified, hashed in the same pass, and the result is stored with the
+    cached metadata, so that later runs on the same file can skip the
+    check by means of skip_verified_crc().
+    \param cache probe cache, preferably backed by a directory
+    \param path file system path of the rxp file
+    \param force verify even if a stamp exists
+    \return the cached metadata including the crc stamp
+ */
+const rxp_meta& verify_once(
+    rxp_probe_cache& cache
+    , const std::string& path
+    , bool force = false
+);
+
+//! disable crc checking of a packet consumer for already verified content
+/*! Removes the crc packets from the dispatch selector if the metadata
+    carries a passed or absent stamp taken from the file at path, see
+    crc_stamp_applies(). Files that failed, were never verified or merely
+    share the fingerprint of a verified file are left alone.
+    \param consumer consumer about to read the file
+    \param meta metadata returned by verify_once()
+    \param path file system path of the rxp file
+    \return true if checking was disabled
+ */
+bool skip_verified_crc(
+    scanlib::basic_packets& consumer
+    , const rxp_meta& meta
+    , const std::string& path
+);
+
+} // namespace vpp
+
+#endif // VPP_RXPCRC_HPP
@@ -0,0 +1,61 @@
+// $Id$
+
+#ifndef VPP_RXPFILTER_HPP
+#define VPP_RXPFILTER_HPP
+
+//! \file rxpfilter.hpp
+//! Streaming rxp to rxp transcoder that strips packet classes.
+
+#include <riegl/ridataspec.hpp>
+
+#include <cstdint>
+#include <string>
+#include <map>
+
+namespace vpp {
+
+//! selector of all housekeeping (hk_*) packets
+scanlib::selector_type select_housekeeping();
+
+//!\brief rxp to rxp transcoder
+//!\details Copies an rxp stream packet by packet, dropping all packets
+//! whose id is set in the strip selector. The id lookup table of the
+//! header is compacted to the surviving packet ids.
+//!
+//! CRC streams (crc32_header/crc32_check) are passed through unchanged
+//! as long as none of the packets they cover is stripped and the short
+//! ids of the covered packets are not renumbered by the compaction.
+//! Otherwise the crc packets of that stream are dropped, so that readers
+//! see an unchecked stream instead of reporting false crc errors.
+class rxp_filter
+{
+public:
+    rxp_filter();
+
+    //! packets to drop, e.g. select_wave | select_debug
+    scanlib::selector_type strip;
+
+    //! remove stripped ids from the header lookup table
+    bool compact_lookup;
+
+    struct statistics {
+        statistics();
+        uint64_t packets_in;
+        uint64_t packets_out;
+        uint64_t words_in;   //!< payload words read
+        uint64_t words_out;  //!< payload words written
+        unsigned crc_streams;
+        unsigned crc_streams_dropped;
+        std::map<std::string, uint64_t> stripped; //!< packet name -> count
+    };
+
+    //! transcode a stream
+    //!\param in_uri input uri, e.g. file:scan.rxp
+    //!\param out_uri output uri, e.g. file:scan.nowave.rxp
+    //!\return packet and crc stream statistics
+    statistics run(const std::string& in_uri, const std::string& out_uri);
+};
+
+} // namespace vpp
+
+#endif // VPP_RXPFILTER_HPP
@@ -0,0 +1,190 @@
+// $Id$
+
+#ifndef VPP_RXPPROBE_HPP
+#define VPP_RXPPROBE_HPP
+
+//! \file rxpprobe.hpp
+//! Bounded-read probe of the leading configuration packets of rxp files.
+
+#include <riegl/ridataspec.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <ostream>
+#include <istream>
+#include <map>
+#include <vector>
+
+namespace vpp {
+
+//!\brief scan metadata gathered from the head of an rxp stream
+//!\details All fields keep their default value if the corresponding
+//! packet was not found within the probed part of the stream.
+struct rxp_meta
+{
+    rxp_meta();
+
+    std::string fingerprint;  //!< content fingerprint, see rxp_fingerprint
+
+    // instrument descriptors
+    std::string type_id;      //!< scanner type
+    std::string serial;       //!< scanner serial number
+    std::string build;        //!< scanner build id
+
+    // units
+    double range_unit;        //!< length of 1 LSB of range in meter
+    double time_unit;         //!< duration of 1 LSB of time in seconds
+    uint32_t line_circle_count;  //!< LSBs per full rotation about line axis
+    uint32_t frame_circle_count; //!< LSBs per full rotation about frame axis
+    unsigned num_facets;      //!< number of device_geometry facets seen
+
+    // scan pattern (scan_rect_fov), angles in degree
+    bool have_scan_pattern;
+    double theta_min;
+    double theta_max;
+    double theta_incr;
+    double phi_min;
+    double phi_max;
+    double phi_incr;
+    unsigned line_scan_mode;  //!< 0 rotating, 1 oscillating
+
+    // extents
+    bool have_extents;
+    double range_min;
+    double range_max;
+    double amplitude_min;
+    double amplitude_max;
+    double reflectance_min;
+    double reflectance_max;
+    unsigned max_num_echoes;  //!< zero if unknown
+
+    // mta settings
+    bool have_mta;
+    unsigned mta_zone;
+    double gate_low;
+    double gate_high;
+    double zone_width;
+
+    // stream bookkeeping
+    bool meas_start_seen;     //!< the probe reached the measurement start
+    uint64_t file_size;       //!< size of the file in bytes
+    uint64_t bytes_read;      //!< bytes consumed by the probe
+    uint64_t packets_read;    //!< packets consumed by the probe
+
+    // stream integrity, see rxp_crc_verifier
+    enum crc_status_e {
+        crc_unchecked = 0,    //!< never verified
+        crc_absent = 1,       //!< verified, stream carries no crc packets
+        crc_passed = 2,       //!< verified without errors
+        crc_failed = 3        //!< verified with crc errors
+    };
+    crc_status_e crc_status;
+    uint64_t crc_checks;      //!< crc32_check packets seen when verifying
+    uint64_t crc_errors;      //!< crc errors reported when verifying
+    std::string crc_content;  //!< hash of the whole file read when verifying
+
+    //! identity of a file holding the verified content
+    struct crc_file {
+        crc_file();
+        std::string path;
+        uint64_t device;
+        uint64_t inode;
+        uint64_t size;
+        int64_t mtime;        //!< modification time in ns
+        bool operator==(const crc_file& o) const;
+    };
+    //! files the stamp applies to, e.g. an archive and a working copy
+    std::vector<crc_file> crc_files;
+
+    //! nominal number of laser shots implied by the scan pattern
+    //!\return zero if no scan pattern is available
+    uint64_t shot_count_estimate() const;
+
+    //! write the metadata as a JSON object
+    //!\param out stream receiving the JSON text
+    //!\param pretty indent and break lines
+    void write_json(std::ostream& out, bool pretty = false) const;
+};
+
+std::ostream& operator<<(std::ostream& out, const rxp_meta& arg);
+std::istream& operator>>(std::istream& in, rxp_meta& arg);
+
+//! compute a content fingerprint of a file
+/*! The fingerprint is a 64 bit FNV-1a hash over the file size and the
+    leading and trailing 64 KiB of the file, rendered as 16 hex digits.
+    Since rxp files are never modified in place this identifies the
+    content without having to read the whole file.
+    \param path file system path of the file
+    \throw std::runtime_error if the file cannot be read
+ */
+std::string rxp_fingerprint(const std::string& path);
+
+//!\brief header packet probe
+//!\details The probe dispatches only the configuration packets and stops
+//! reading a short while after the measurement start has been seen, or
+//! when the read budget is exhausted, whichever comes first.
+class rxp_probe
+    : public scanlib::basic_packets
+{
+public:
+    //! constructor
+    //!\param max_bytes upper bound of bytes to read from the stream
+    //!\param grace_packets packets to read after meas_start
+    rxp_probe(uint64_t max_bytes = 4u<<20, unsigned grace_packets = 256);
+
+    //! probe a file
+    //!\param path file system path of the rxp file
+    //!\return the gathered metadata (fingerprint left empty)
+    rxp_meta probe(const std::string& path);
+
+protected:
+    void on_header(const scanlib::header<iterator_type>& arg);
+    void on_units(const scanlib::units<iterator_type>& arg);
+    void on_device_geometry(const scanlib::device_geometry<iterator_type>& arg);
+    void on_scan_rect_fov(const scanlib::scan_rect_fov<iterator_type>& arg);
+    void on_scan_rect_fov_1(const scanlib::scan_rect_fov_1<iterator_type>& arg);
+    void on_extents(const scanlib::extents<iterator_type>& arg);
+    void on_extents_1(const scanlib::extents_1<iterator_type>& arg);
+    void on_mta_settings(const scanlib::mta_settings<iterator_type>& arg);
+    void on_meas_start(const scanlib::meas_start<iterator_type>& arg);
+
+private:
+    uint64_t max_bytes;
+    unsigned grace_packets;
+    rxp_meta meta;
+};
+
+//!\brief fingerprint keyed cache of probe results
+//!\details Results are kept in memory and, if a directory is given, also
+//! stored as one file per fingerprint so that later runs skip the probe.
+class rxp_probe_cache
+{
+public:
+    //! constructor
+    //!\param directory cache directory, empty for memory only caching
+    explicit rxp_probe_cache(const std::string& directory = std::string());
+
+    //! return the metadata of a file, probing it only on a cache miss
+    //!\param path file system path of the rxp file
+    const rxp_meta& get(const std::string& path);
+
+    //! store updated metadata, e.g. after adding derived information
+    //!\param meta metadata with a valid fingerprint
+    //!\return the cached copy
+    const rxp_meta& put(const rxp_meta& meta);
+
+    std::size_t hits;   //!< number of cache hits
+    std::size_t misses; //!< number of probes performed
+
+private:
+    std::string entry_path(const std::string& fingerprint) const;
+
+    std::string directory;
+    std::map<std::string, rxp_meta> entries;
+    rxp_probe probe;
+};
+
+} // namespace vpp
+
+#endif // VPP_RXPPROBE_HPP
@@ -0,0 +1,176 @@
+// $Id$
+
+#ifndef VPP_RXPSLAB_HPP
+#define VPP_RXPSLAB_HPP
+
+//! \file rxpslab.hpp
+//! Slab allocated rxp packet storage for packet capture and re-encoding.
+
+#include <riegl/rxpstream.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+
+namespace vpp {
+
+//!\brief bump allocator for packet words
+//!\details Memory is handed out from large chunks and is only given back
+//! in bulk by release(). The chunks are kept for reuse, so that a stream
+//! which is released at every frame boundary reaches a steady state
+//! without any further heap allocation.
+class packet_slab
+{
+public:
+    //! constructor
+    //!\param chunk_words size of a chunk in 32 bit words
+    explicit packet_slab(std::size_t chunk_words = 1u<<16);
+
+    //! allocate n words
+    //!\return pointer valid until the next call to release()
+    uint32_t* allocate(std::size_t n);
+
+    //! return the unused tail of the most recent allocation
+    //!\param p pointer returned by the most recent call to allocate()
+    //!\param used number of words actually used
+    void shrink(uint32_t* p, std::size_t used);
+
+    //! release all allocations at once, keeping the chunks
+    void release();
+
+    std::size_t words_in_use() const;          //!< words currently allocated
+    std::size_t chunk_count() const { return chunks.size(); }
+    std::size_t chunk_allocations;             //!< heap allocations so far
+
+private:
+    struct chunk_t {
+        std::unique_ptr<uint32_t[]> data;
+        std::size_t size;
+    };
+    std::vector<chunk_t> chunks;
+    std::size_t chunk_words;
+    std::size_t current;    // index of chunk in use
+    std::size_t pos;        // next free word in current chunk
+    std::size_t used_before; // words used in chunks before current
+
+    // not copyable
+    packet_slab(const packet_slab&);
+    packet_slab& operator=(const packet_slab&);
+};
+
+//!\brief a packet whose words are borrowed from a packet_slab
+//!\details Same interface as scanlib::rxp_packet for reading, but
+//! trivially copyable. The words are valid until the slab is released.
+struct slab_packet
+{
+    slab_packet()
+        : id_main(0), id_sub(0), begin_(0), end_(0) {}
+
+    unsigned id_main;
+    unsigned id_sub;
+
+    const uint32_t* begin() const { return begin_; }
+    const uint32_t* end() const { return end_; }
+    std::size_t size() const { return end_ - begin_; }
+
+    const uint32_t* begin_;
+    const uint32_t* end_;
+};
+
+//! copy an rxp_packet into slab memory
+slab_packet slab_copy(packet_slab& slab, const scanlib::rxp_packet& p);
+
+//! encode a typed packet directly into slab memory
+/*! Unlike the converting constructor of rxp_packet this does not need a
+    temporary buffer: the packet is encoded in place and the unused part of
+    the worst case allocation is returned to the slab.
+ */
+template<class P>
+slab_packet slab_encode(packet_slab& slab, const P& other)
+{
+    typedef typename P::template rebind<uint32_t*>::type other_t;
+    const std::size_t words = (other_t::max_bit_width + 31)/32 + 1;
+    uint32_t* buf = slab.allocate(words);
+    other_t ob(buf, buf+words, false);
+    ob = other;
+    slab.shrink(buf, ob.end() - buf);
+    slab_packet r;
+    r.id_main = P::id_main;
+    r.id_sub = P::id_sub;
+    r.begin_ = buf;
+    r.end_ = ob.end();
+    return r;
+}
+
+//! decode a slab packet without copying
+template<class P>
+P rxp_cast(const slab_packet& x)
+{
+    P r(typename P::template rebind<const uint32_t*>::type(x.begin(), x.end(), false));
+    return r;
+}
+
+//!\brief rxp input stream reading into slab memory
+//!\details Packets are read through a single reusable rxp_packet and then
+//! copied into the slab, so reading does not allocate once the slab has
+//! grown to the size of the largest frame. Call release() at frame
+//! boundaries (e.g. after frame_stop) to recycle the memory of all packets
+//! read so far.
+class rxp_slab_istream
+{
+public:
+    //! constructor
+    //!\param uri input uri, e.g. file:scan.rxp
+    //!\param chunk_words slab chunk size in 32 bit words
+    explicit rxp_slab_istream(
+        const std::string& uri
+        , std::size_t chunk_words = 1u<<16
+    );
+
+    //! read the next packet
+    //!\param p receives the packet
+    //!\return false at end of input
+    bool read(slab_packet& p);
+
+    //! release the memory of all packets read so far
+    void release() { slab.release(); }
+
+    bool good() const { return in.good(); }
+
+    scanlib::rxp_istream& stream() { return in; }
+    packet_slab& memory() { return slab; }
+
+private:
+    scanlib::rxp_istream in;
+    scanlib::rxp_packet scratch;
+    scanlib::package_id id;
+    packet_slab slab;
+};
+
+//!\brief rxp output stream accepting slab packets
+//!\details The packet words are staged in a reusable rxp_packet since
+//! rxp_ostream only accepts that type.
+class rxp_slab_ostream
+{
+public:
+    //! constructor
+    //!\param uri output uri, e.g. file:subset.rxp
+    explicit rxp_slab_ostream(const std::string& uri);
+
+    rxp_slab_ostream& operator<<(const slab_packet& p);
+
+    bool good() const { return out.good(); }
+    void close() { out.close(); }
+
+    scanlib::rxp_ostream& stream() { return out; }
+
+private:
+    scanlib::rxp_ostream out;
+    scanlib::rxp_packet scratch;
+};
+
+} // namespace vpp
+
+#endif // VPP_RXPSLAB_HPP
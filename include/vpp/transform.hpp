@@ -0,0 +1,90 @@
+// $Id$
+
+#ifndef VPP_TRANSFORM_HPP
+#define VPP_TRANSFORM_HPP
+
+//! \file transform.hpp
+//! Pointcloud in project coordinates, with SOP/POP folded into the beam.
+
+#include <riegl/pointcloud.hpp>
+
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace vpp {
+
+//!\brief homogeneous 4x4 transform, row major
+//!\details Points are column vectors, p' = m * p. The matrix files of
+//! RiSCAN PRO projects (matrix/ScanPosNNN.DAT, the SOP) hold the 16
+//! numbers in this order.
+struct rigid_transform
+{
+    rigid_transform();          //!< identity
+
+    double m[4][4];
+
+    //! read a matrix file
+    //!\throw std::runtime_error if the file cannot be read
+    static rigid_transform load(const std::string& path);
+
+    //! the transform applying b first, then this
+    rigid_transform operator*(const rigid_transform& b) const;
+
+    //! transform a point
+    void point(const double in[3], double out[3]) const;
+    //! transform a direction, translation is not applied
+    void vector(const double in[3], double out[3]) const;
+
+    //! rotation part orthonormal and last row (0 0 0 1), within tol
+    bool is_rigid(double tol = 1e-6) const;
+};
+
+std::ostream& operator<<(std::ostream& out, const rigid_transform& arg);
+std::istream& operator>>(std::istream& in, rigid_transform& arg);
+
+//!\brief pointcloud delivering targets in project coordinates
+//!\details The transform (e.g. SOP, or POP * SOP) is applied once per
+//! shot to beam_origin and beam_direction, and the vertices of the targets
+//! are computed from the transformed beam, so no separate pass over the
+//! points is needed and zenith angles taken from beam_direction are those
+//! of the levelled beam. beam_origin and the vertices are relative to
+//! offset, which should be close to the scan position to keep full
+//! precision in float.
+//!
+//! Derived classes overriding on_shot() or on_echo_transformed() must
+//! call the ones of this class first.
+class project_pointcloud
+    : public scanlib::pointcloud
+{
+public:
+    //! constructor
+    //!\param sync_to_pps use pps synchronized time stamps
+    explicit project_pointcloud(bool sync_to_pps = false);
+
+    //! set the transform
+    //!\throw std::runtime_error if it is not rigid
+    void set_transform(const rigid_transform& t);
+    //! set a chain of transforms, chain[0] is applied first
+    void set_transform(const std::vector<rigid_transform>& chain);
+    const rigid_transform& transform() const { return sop; }
+
+    //! set the origin of vertex coordinates, in project coordinates
+    void set_offset(double x, double y, double z);
+    //! place the origin of vertex coordinates at the scanner position
+    void set_offset_to_scanner();
+    const double* offset() const { return offset_; }
+
+protected:
+    void on_shot();
+    void on_echo_transformed(echo_type echo);
+
+private:
+    rigid_transform sop;
+    double offset_[3];
+};
+
+} // namespace vpp
+
+#endif // VPP_TRANSFORM_HPP
@@ -0,0 +1,211 @@
+// $Id$
+
+#ifndef VPP_VOXELTRACE_HPP
+#define VPP_VOXELTRACE_HPP
+
+//! \file voxeltrace.hpp
+//! Beam traversal of a voxel grid counting entering, hitting and exiting beams.
+
+#include <vpp/transform.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace vpp {
+
+//!\brief beam counts of one voxel
+//!\details Every beam entering the voxel either ends in it, at its last
+//! echo, or exits, so exits/entries is the transmission of the voxel.
+//! Voxels behind the last echo of a beam are not entered, which makes the
+//! counts occlusion aware.
+struct voxel_counts
+{
+    uint32_t entries;           //!< beams entering the voxel
+    uint32_t hits;              //!< echoes in the voxel
+    uint32_t exits;             //!< beams leaving the voxel
+    float hits_weighted;        //!< echoes weighted by 1/target_count
+};
+
+//!\brief shots collected for tracing
+class voxel_batch
+{
+public:
+    //! add a shot
+    //!\param origin beam origin
+    //!\param direction unit beam direction
+    //!\param ranges echo ranges in ascending order, m
+    //!\param n number of echoes, 0 for shots without echo
+    void add(const double origin[3], const double direction[3], const double* ranges, unsigned n);
+
+    std::size_t size() const { return ends.size(); }
+    void clear();
+
+    std::vector<double> beams;          //!< origin and direction, 6 values per shot
+    std::vector<uint32_t> ends;         //!< end of the ranges of each shot
+    std::vector<double> ranges;
+};
+
+//!\brief regular voxel grid with beam counts
+//!\details Voxel (i, j, k) covers [origin + (i, j, k)*voxel, origin +
+//! (i+1, j+1, k+1)*voxel), coordinates are those of the beams, e.g. the
+//! vertex coordinates of a project_pointcloud. Beams are traversed with a
+//! 3D-DDA from the origin up to the last echo, or up to max_range for
+//! shots without echo.
+class voxel_grid
+{
+public:
+    //! constructor
+    //!\param origin lower corner of the grid
+    //!\param voxel edge length of a voxel in m
+    //!\param nx voxels along x
+    //!\param ny voxels along y
+    //!\param nz voxels along z
+    //!\throw std::runtime_error if the grid is empty
+    voxel_grid(const double origin[3], double voxel, uint32_t nx, uint32_t ny, uint32_t nz);
+
+    const double* origin() const { return origin_; }
+    double voxel() const { return voxel_; }
+    const uint32_t* dims() const { return dims_; }
+    std::size_t size() const { return counts.size(); }
+
+    std::size_t index(uint32_t i, uint32_t j, uint32_t k) const {
+        return i + std::size_t(dims_[0])*(j + std::size_t(dims_[1])*k);
+    }
+    const voxel_counts& at(uint32_t i, uint32_t j, uint32_t k) const { return counts[index(i, j, k)]; }
+    const voxel_counts* data() const { return counts.data(); }
+
+    //! trace one shot
+    //!\param origin beam origin
+    //!\param direction unit beam direction
+    //!\param ranges echo ranges in ascending order, m
+    //!\param n number of echoes
+    //!\param max_range extent of beams without echo, m
+    void trace(
+        const double origin[3]
+        , const double direction[3]
+        , const double* ranges
+        , unsigned n
+        , double max_range = std::numeric_limits<double>::infinity()
+    );
+
+    //! trace all shots of a batch
+    void trace(const voxel_batch& b, double max_range = std::numeric_limits<double>::infinity());
+
+    //! add the counts of a grid of the same geometry
+    //!\throw std::runtime_error if the geometry differs
+    void merge(const voxel_grid& g);
+
+    //! add the counts of the voxels [begin, end) of a grid of the same geometry
+    void merge(const voxel_grid& g, std::size_t begin, std::size_t end);
+
+    void clear();
+
+private:
+    double origin_[3];
+    double voxel_;
+    uint32_t dims_[3];
+    std::vector<voxel_counts> counts;
+};
+
+//!\brief multithreaded beam traversal
+//!\details Shots are collected into batches by the calling thread and
+//! traced by the workers, each into a voxel grid of its own, so no voxel
+//! is shared between threads. finish() merges the grids, in parallel over
+//! disjoint voxel ranges. Memory is one grid per worker plus the result.
+//!
+//! add() blocks while all batches are in flight. An error in a worker
+//! stops the others and is rethrown by the next add() or by finish().
+class voxel_tracer
+{
+public:
+    //! constructor
+    //!\param geometry grid to accumulate, its counts are the initial ones
+    //!\param threads workers, 0 for the number of cores
+    //!\param batch_shots shots per batch
+    explicit voxel_tracer(const voxel_grid& geometry, unsigned threads = 0, std::size_t batch_shots = 4096);
+    ~voxel_tracer();
+
+    double max_range;           //!< extent of beams without echo, m
+
+    //! add a shot, see voxel_batch::add
+    void add(const double origin[3], const double direction[3], const double* ranges, unsigned n);
+
+    //! trace the remaining shots, stop the workers and merge their grids
+    const voxel_grid& finish();
+
+    const voxel_grid& result() const { return result_; }
+    uint64_t shots() const { return shots_; }
+    unsigned threads() const { return static_cast<unsigned>(workers.size()); }
+
+private:
+    voxel_grid result_;
+    std::vector<std::unique_ptr<voxel_grid> > grids;
+    std::vector<std::thread> workers;
+    std::size_t batch_shots;
+    uint64_t shots_;
+    bool finished;
+
+    std::mutex mutex;
+    std::condition_variable work_cv;
+    std::condition_variable free_cv;
+    std::vector<std::unique_ptr<voxel_batch> > storage;
+    std::vector<voxel_batch*> free_batches;
+    std::deque<voxel_batch*> queue;
+    voxel_batch* current;
+    bool closing;
+    std::atomic<bool> abort;
+    std::exception_ptr error;
+
+    void work(voxel_grid& grid);
+    void submit();
+    void stop();
+    void fail(std::exception_ptr e);
+
+    // not copyable
+    voxel_tracer(const voxel_tracer&);
+    voxel_tracer& operator=(const voxel_tracer&);
+};
+
+//!\brief pointcloud feeding a voxel tracer
+//!\details The beam of every shot is traced in project coordinates,
+//! shots without echo included. A shot is passed on at on_shot_end(), or
+//! at the next on_shot() if it had no echo data; call flush() after the
+//! last packet.
+class trace_pointcloud
+    : public project_pointcloud
+{
+public:
+    //! constructor
+    //!\param tracer receives the shots
+    //!\param sync_to_pps use pps synchronized time stamps
+    explicit trace_pointcloud(voxel_tracer& tracer, bool sync_to_pps = false);
+
+    //! pass on the last shot
+    void flush();
+
+    uint64_t shots;             //!< shots seen
+
+protected:
+    void on_shot();
+    void on_shot_end();
+
+private:
+    voxel_tracer& tracer;
+    bool pending;
+    double origin[3];
+    double direction[3];
+    std::vector<double> ranges;
+};
+
+} // namespace vpp
+
+#endif // VPP_VOXELTRACE_HPP
@@ -0,0 +1,66 @@
+// $Id$
+
+#ifndef VPP_WAVECONVERT_HPP
+#define VPP_WAVECONVERT_HPP
+
+//! \file waveconvert.hpp
+//! Parallel conversion of rxp waveform packets into .vwf files.
+
+#include <vpp/wavefile.hpp>
+
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace vpp {
+
+//!\brief multi-threaded rxp to .vwf converter
+//!\details The input file is split into one byte range per thread. Each
+//! thread decodes and decompresses its range with its own scanlib::wave
+//! instance and encodes the waveforms, delivered as pooled records (see
+//! pooled_wave), into pooled blocks, which a single writer thread stores
+//! with large sequential writes.
+//!
+//! A thread starting in the middle of the file first replays the
+//! configuration packets from the head of the file, then resynchronizes
+//! on the next packet marker warmup_bytes ahead of its range, so that
+//! scan and clock state are established when it reaches its range. It
+//! owns the shots from the first waveform inside its range on. The cut is
+//! made by time only: the preceding thread fetches the time of that shot
+//! one decoder read ahead before the end of its range and drops every
+//! shot at or after it, so no shot is written twice whatever the read
+//! positions of the two decoders. Shot times are assumed to increase
+//! monotonically, as they do for all instruments.
+class wave_converter
+{
+public:
+    wave_converter();
+
+    unsigned threads;            //!< worker threads, 0 for hardware concurrency
+    uint64_t min_segment_bytes;  //!< do not split the input finer than this
+    uint64_t warmup_bytes;       //!< bytes decoded ahead of a segment
+    std::size_t block_bytes;     //!< target size of a block
+    std::size_t pool_blocks;     //!< blocks in flight, 0 for 4 per thread
+    bool sync_to_pps;            //!< use pps synchronized time stamps
+    std::bitset<16> channels;    //!< channel filter, all channels by default
+
+    struct statistics {
+        statistics();
+        unsigned segments;       //!< number of input segments
+        uint64_t records;        //!< waveforms written
+        uint64_t blocks;         //!< blocks written
+        uint64_t bytes_written;  //!< size of the output file
+        uint64_t allocations;    //!< heap allocations of the record pools
+    };
+
+    //! convert a file
+    //!\param rxp_path file system path of the rxp input
+    //!\param vwf_path file system path of the .vwf output
+    //!\throw std::runtime_error and scanlib exceptions of the workers
+    statistics run(const std::string& rxp_path, const std::string& vwf_path);
+};
+
+} // namespace vpp
+
+#endif // VPP_WAVECONVERT_HPP
@@ -0,0 +1,115 @@
+// $Id$
+
+#ifndef VPP_WAVEDETECT_HPP
+#define VPP_WAVEDETECT_HPP
+
+//! \file wavedetect.hpp
+//! Matched filter echo detection on waveform samples.
+
+#include <vpp/lookup.hpp>
+#include <vpp/wavefile.hpp>
+
+#include <riegl/wave.hpp>
+
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace vpp {
+
+//!\brief software echo detection on wave records
+//!\details For every wavelet of a selected channel the samples are
+//! baseline corrected with the channel statistic of the shot, correlated
+//! with the pulse model of the channel and searched for local maxima of
+//! the filter response above a noise dependent threshold. Peak positions
+//! are refined by parabolic interpolation.
+//!
+//! The pulse model is the exponential sum of the channel,
+//!   p(t) = Re(sum_k expsum_a[k] * exp(expsum_b[k] * t)), t >= 0 in s,
+//! sampled at the channel sampling time. Channels without a model use a
+//! Gaussian pulse of fallback_fwhm samples.
+//!
+//! Echoes are reported as scanlib::target with is_sw set. The range is
+//! measured from the peak in the reference channel; shots without a
+//! reference wavelet are measured from the start of the range gate and
+//! counted in no_reference. The amplitude in dB is looked up from the
+//! peak amplitude in ADC digits through amplitude_high_power (channel 0)
+//! or amplitude_low_power (channel 1), interpolated linearly between the
+//! knots of the table; other channels get NaN.
+//!
+//! The inner loops work on contiguous float arrays of fixed template
+//! length and are written for compiler auto-vectorisation.
+class wave_echo_detector
+{
+public:
+    wave_echo_detector();
+
+    double snr_threshold;       //!< threshold of filter response in noise sigmas
+    double min_separation;      //!< minimum distance of echoes in samples, 0 for pulse width
+    std::size_t max_echoes;     //!< maximum echoes per wavelet
+    double v_group;             //!< group velocity of light in m/s
+    double fallback_fwhm;       //!< Gaussian pulse width in samples
+    std::bitset<16> channels;   //!< channels searched, default 0 and 1
+
+    //! take channel properties and calibration tables from a wave instance
+    /*! To be called once the configuration packets have been dispatched,
+        e.g. on the first call to on_record of a pooled_wave.
+     */
+    void configure(scanlib::wave& w);
+    bool configured() const { return !models.empty(); }
+
+    //! detect echoes in one shot
+    //!\param r shot record
+    //!\param out receives one target per echo (appended)
+    //!\return number of echoes found
+    std::size_t detect(const wave_record& r, std::vector<scanlib::target>& out);
+
+    uint64_t wavelets;          //!< wavelets processed
+    uint64_t echoes;            //!< echoes found
+    uint64_t no_reference;      //!< shots without reference pulse
+
+    //! matched filter of one channel
+    struct pulse_model {
+        pulse_model();
+        std::vector<float> h;   //!< template, peak normalized to 1
+        float energy;           //!< sum of h^2
+        double peak;            //!< template peak position in samples
+        double width;           //!< template FWHM in samples
+        double sampling_time;   //!< s
+        double delay;           //!< channel delay in s
+        bool expsum;            //!< derived from an expsum model
+    };
+    const pulse_model& model(std::size_t channel) const { return models[channel]; }
+
+private:
+    struct peak_t {
+        double position;        // sub-sample position of the echo peak
+        double amplitude;       // peak amplitude in digits above baseline
+    };
+
+    std::size_t find_peaks(
+        const uint16_t* samples
+        , std::size_t count
+        , float mean
+        , float stdev
+        , const pulse_model& m
+        , std::vector<peak_t>& peaks
+    );
+
+    std::vector<pulse_model> models;
+    std::size_t reference;
+    lookup_evaluator ampl_high;
+    lookup_evaluator ampl_low;
+
+    // scratch buffers, kept to avoid allocation per shot
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<peak_t> peaks;
+    std::vector<std::pair<double, double> > candidates;
+};
+
+} // namespace vpp
+
+#endif // VPP_WAVEDETECT_HPP
@@ -0,0 +1,352 @@
+// $Id$
+
+#ifndef VPP_WAVEFILE_HPP
+#define VPP_WAVEFILE_HPP
+
+//! \file wavefile.hpp
+//! Block structured waveform sample file (.vwf).
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <fstream>
+
+namespace vpp {
+
+//!\brief decoded waveform of one laser shot
+//!\details Mirrors scanlib::wave::waveform, but the samples of all
+//! wavelets are kept in one flat buffer. clear() keeps the capacity, so a
+//! record that is reused does not allocate once it has grown to the size
+//! of the largest shot.
+struct wave_record
+{
+    wave_record();
+
+    double time_sorg;           //!< start of range gate in s
+    double time;                //!< shot time in s
+    double origin[3];           //!< beam origin in m (SOCS)
+    double direction[3];        //!< beam direction (SOCS)
+    unsigned facet;             //!< mirror facet
+    double line_angle;          //!< line angle in deg
+    double frame_angle;         //!< frame angle in deg
+    bool pps;                   //!< time is synchronized to pps
+
+    struct wavelet_t {
+        double time;            //!< start of sample block in s
+        uint32_t channel;       //!< channel index
+        uint32_t count;         //!< number of samples
+        uint64_t offset;        //!< first sample in samples
+    };
+    struct statistic_t {
+        float mean;
+        float stdev;
+    };
+
+    std::vector<wavelet_t> wavelets;
+    std::vector<uint16_t> samples;            //!< samples of all wavelets
+    std::vector<statistic_t> channel_statistic;
+
+    //! reset to an empty shot, keeping the buffer capacity
+    void clear();
+
+    //! add a wavelet, copying its samples
+    void add_wavelet(double time, uint32_t channel, const uint16_t* first, std::size_t count);
+
+    //! samples of wavelet k
+    const uint16_t* wavelet_samples(std::size_t k) const {
+        return samples.data() + wavelets[k].offset;
+    }
+};
+
+//!\brief wave record referring to encoded data, e.g. in a mapped file
+//!\details The arrays point into the block they were decoded from and
+//! stay valid as long as the block, for mapped files the wave_file_map.
+struct wave_record_view
+{
+    double time_sorg;
+    double time;
+    double origin[3];
+    double direction[3];
+    unsigned facet;
+    double line_angle;
+    double frame_angle;
+    bool pps;
+
+    const wave_record::wavelet_t* wavelets;
+    std::size_t wavelet_count;
+    const wave_record::statistic_t* channel_statistic;
+    std::size_t statistic_count;
+    const uint16_t* samples;
+    std::size_t sample_count;
+
+    const uint16_t* wavelet_samples(std::size_t k) const {
+        return samples + wavelets[k].offset;
+    }
+
+    //! copy into a record
+    void copy_to(wave_record& r) const;
+};
+
+//!\brief a block of encoded wave records
+//!\details Blocks are the unit of file I/O. Records are encoded into a
+//! byte buffer whose capacity is kept by clear(), so a block can be
+//! recycled without allocation.
+class wave_block
+{
+public:
+    //! constructor
+    //!\param reserve_bytes initial capacity of the payload buffer
+    explicit wave_block(std::size_t reserve_bytes = 0);
+
+    uint32_t segment;           //!< ordering key, e.g. part of the input
+    uint32_t sequence;          //!< ordering key within the segment
+
+    //! encode and append a record
+    void append(const wave_record& r);
+
+    //! remove all records, keeping the buffer capacity
+    void clear();
+
+    const char* data() const { return payload.data(); }
+    std::size_t size() const { return payload.size(); }
+    std::size_t capacity() const { return payload.capacity(); }
+    uint32_t record_count() const { return records; }
+    double time_min() const { return t_min; }
+    double time_max() const { return t_max; }
+    double zenith_min() const { return z_min; }
+    double zenith_max() const { return z_max; }
+    double azimuth_min() const { return a_min; }
+    double azimuth_max() const { return a_max; }
+
+private:
+    std::vector<char> payload;
+    uint32_t records;
+    double t_min;
+    double t_max;
+    double z_min;
+    double z_max;
+    double a_min;
+    double a_max;
+};
+
+//! zenith angle of the beam direction of a record in deg, 0 is up
+double wave_zenith(const wave_record& r);
+
+//! azimuth of the beam direction of a record in deg, [0, 360)
+double wave_azimuth(const wave_record& r);
+
+//!\brief writer of .vwf files
+//!\details A .vwf file is a sequence of blocks followed by a metadata
+//! string and an index of all blocks sorted by (segment, sequence).
+//! Blocks may be written in any order; readers always follow the index.
+//! The file is written as path + ".tmp" and renamed to path by close(),
+//! so path never holds a partial file and replacing a file leaves
+//! existing mappings of it intact.
+//! The index carries a summary of every block (time, zenith and azimuth
+//! range, shot count), so that readers can seek by time and skip blocks
+//! by angle without touching them. All numbers are stored in host byte
+//! order (little endian).
+class wave_file_writer
+{
+public:
+    //! create the temporary file
+    //!\throw std::runtime_error if the file cannot be created
+    explicit wave_file_writer(const std::string& path);
+    ~wave_file_writer();
+
+    //! write a block with a single sequential write
+    //!\throw std::runtime_error on write errors
+    void write(const wave_block& b);
+
+    //! write metadata and index, close the file and move it to path
+    //!\param meta free form metadata, e.g. the wave meta component
+    //!\throw std::runtime_error on write errors
+    void close(const std::string& meta = std::string());
+
+    uint64_t bytes_written() const { return pos; }
+    std::size_t block_count() const { return index.size(); }
+
+    //! index entry of a block
+    struct block_info {
+        uint64_t offset;        //!< file offset of the block header
+        uint32_t segment;
+        uint32_t sequence;
+        uint32_t record_count;
+        uint32_t reserved;
+        uint64_t payload_bytes;
+        double time_min;
+        double time_max;
+        double zenith_min;      //!< deg
+        double zenith_max;      //!< deg
+        double azimuth_min;     //!< deg, covers [0, 360) for blocks crossing north
+        double azimuth_max;     //!< deg
+    };
+
+private:
+    std::string path;
+    std::string temporary;      // path + ".tmp" until close()
+    std::ofstream out;
+    uint64_t pos;
+    std::vector<block_info> index;
+
+    void put(const void* p, std::size_t n);
+
+    // not copyable
+    wave_file_writer(const wave_file_writer&);
+    wave_file_writer& operator=(const wave_file_writer&);
+};
+
+//!\brief selection of shots by time and beam direction
+//!\details Ranges are closed. An azimuth range with azimuth_min greater
+//! than azimuth_max wraps through north, e.g. [350, 10].
+struct wave_window
+{
+    wave_window();
+
+    double time_min;            //!< s
+    double time_max;            //!< s
+    double zenith_min;          //!< deg
+    double zenith_max;          //!< deg
+    double azimuth_min;         //!< deg
+    double azimuth_max;         //!< deg
+
+    //! the block may hold shots inside the window
+    bool overlaps(const wave_file_writer::block_info& b) const;
+
+    //! the shot is inside the window
+    bool contains(const wave_record& r) const;
+    bool contains(const wave_record_view& r) const;
+};
+
+//!\brief reader of .vwf files
+//!\details Blocks are read whole in index order, records are decoded from
+//! the block buffer. With a window set, blocks whose summary does not
+//! overlap the window are skipped without being read, and records
+//! outside the window are not returned.
+class wave_file_reader
+{
+public:
+    typedef wave_file_writer::block_info block_info;
+
+    //! open a file and read its index
+    //!\throw std::runtime_error if the file is not a valid .vwf file or
+    //! its index points outside the file
+    explicit wave_file_reader(const std::string& path);
+
+    //! read the next record
+    //!\return false at end of file
+    bool read(wave_record& r);
+
+    //! position the reader at the first record of block k
+    void seek_block(std::size_t k);
+
+    //! index of the first block holding shots at or after time t
+    /*! Binary search over the index, the blocks need not be in time order.
+        \return blocks().size() if there is none
+     */
+    std::size_t find_time(double t) const;
+
+    //! position the reader at the first record with time >= t
+    //!\return false if there is none
+    bool seek_time(double t);
+
+    //! restrict reading to a window
+    void set_window(const wave_window& w);
+    void clear_window();
+
+    const std::string& meta() const { return meta_; }
+    const std::vector<block_info>& blocks() const { return index; }
+
+private:
+    std::ifstream in;
+    std::string meta_;
+    std::vector<block_info> index;
+    std::vector<double> time_end;
+    std::vector<char> buffer;
+    std::size_t next_block;
+    std::size_t buffer_pos;
+    uint32_t buffer_records;
+    bool windowed;
+    wave_window window;
+
+    bool load_block(std::size_t k);
+    bool decode(wave_record& r);
+};
+
+//!\brief records of one block of a mapped file
+class wave_block_view
+{
+public:
+    wave_block_view() : p(0), end(0), left(0) {}
+    wave_block_view(const char* payload, std::size_t bytes, uint32_t records)
+        : p(payload), end(payload + bytes), left(records) {}
+
+    //! decode the next record
+    //!\return false after the last record
+    //!\throw std::runtime_error if the block is corrupt
+    bool next(wave_record_view& r);
+
+    uint32_t remaining() const { return left; }
+
+private:
+    const char* p;
+    const char* end;
+    uint32_t left;
+};
+
+//!\brief read-only memory mapping of a .vwf file
+//!\details Samples are stored uncompressed, so records are decoded in
+//! place: the sample and wavelet arrays of a wave_record_view point into
+//! the mapping and nothing is copied or allocated per shot.
+//!
+//! open() shares one mapping per file among all readers and threads of
+//! the process, while other processes share the pages through the page
+//! cache. Files are identified by device, inode, size and modification
+//! time in ns. wave_file_writer replaces a file by rename, so a file that
+//! was converted again gets a new mapping while the old one stays valid
+//! for its users. On systems without
+//! mmap the file is read into memory once instead.
+class wave_file_map
+{
+public:
+    typedef wave_file_writer::block_info block_info;
+
+    //! map a file or return the existing mapping
+    //!\throw std::runtime_error if the file is not a valid .vwf file
+    static std::shared_ptr<const wave_file_map> open(const std::string& path);
+
+    ~wave_file_map();
+
+    const std::string& path() const { return path_; }
+    const std::string& meta() const { return meta_; }
+    const std::vector<block_info>& blocks() const { return index; }
+
+    //! index of the first block holding shots at or after time t, see
+    //! wave_file_reader::find_time
+    std::size_t find_time(double t) const;
+
+    //! records of block k
+    //!\throw std::runtime_error if the block header is corrupt
+    wave_block_view block(std::size_t k) const;
+
+private:
+    explicit wave_file_map(const std::string& path);
+
+    std::string path_;
+    const char* data;
+    std::size_t size;
+    std::vector<char> copy;     // used without mmap
+    std::string meta_;
+    std::vector<block_info> index;
+    std::vector<double> time_end;
+
+    // not copyable
+    wave_file_map(const wave_file_map&);
+    wave_file_map& operator=(const wave_file_map&);
+};
+
+} // namespace vpp
+
+#endif // VPP_WAVEFILE_HPP
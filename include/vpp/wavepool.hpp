@@ -0,0 +1,106 @@
+// $Id$
+
+#ifndef VPP_WAVEPOOL_HPP
+#define VPP_WAVEPOOL_HPP
+
+//! \file wavepool.hpp
+//! Recycled wave records and allocation-free waveform delivery.
+
+#include <vpp/wavefile.hpp>
+
+#include <riegl/wave.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace vpp {
+
+//!\brief thread-safe recycling pool of wave records
+//!\details Released records keep the capacity of their buffers. Once the
+//! pool holds as many records as are in flight and each has grown to the
+//! size of the largest shot, acquire() and release() no longer allocate.
+class wave_record_pool
+{
+public:
+    //! constructor
+    //!\param prealloc records created up front
+    //!\param reserve_samples sample capacity of each preallocated record
+    //!\param reserve_wavelets wavelet capacity of each preallocated record
+    explicit wave_record_pool(
+        std::size_t prealloc = 0
+        , std::size_t reserve_samples = 0
+        , std::size_t reserve_wavelets = 0
+    );
+
+    //! take a cleared record from the pool, creating one if it is empty
+    wave_record* acquire();
+
+    //! give a record back
+    void release(wave_record* r);
+
+    //! account for buffer growth observed by a user of the pool
+    void add_growth(uint64_t n) { growths += n; }
+
+    //! heap allocations so far: records created plus buffer growths
+    uint64_t allocations() const { return created + growths; }
+
+    uint64_t records_created() const { return created; }
+    uint64_t buffer_growths() const { return growths; }
+    std::size_t in_use() const;
+
+private:
+    mutable std::mutex mutex;
+    std::vector<std::unique_ptr<wave_record> > storage;
+    std::vector<wave_record*> free_records;
+    std::atomic<uint64_t> created;
+    std::atomic<uint64_t> growths;
+
+    // not copyable
+    wave_record_pool(const wave_record_pool&);
+    wave_record_pool& operator=(const wave_record_pool&);
+};
+
+//!\brief waveform consumer delivering pooled flat records
+//!\details Converts every scanlib::wave::waveform into a wave_record
+//! taken from a pool and passes it to on_record(). After on_record()
+//! returns the record goes back to the pool, unless the handler called
+//! retain(), which transfers it to the handler until it is given back
+//! with pool().release(). Samples are always delivered decompressed.
+//!
+//! The waveform objects built by scanlib::wave itself are not affected;
+//! this removes the allocations of everything downstream of on_wave.
+class pooled_wave
+    : public scanlib::wave
+{
+public:
+    //! constructor
+    //!\param sync_to_pps use pps synchronized time stamps
+    //!\param pool record pool, a private one is used if null
+    explicit pooled_wave(bool sync_to_pps = false, wave_record_pool* pool = 0);
+
+    wave_record_pool& pool() { return *pool_; }
+
+protected:
+    //! called for every waveform
+    //!\param r record valid until on_record returns unless retained
+    virtual void on_record(wave_record& r) = 0;
+
+    //! keep the record passed to on_record beyond the call
+    //!\return the record, to be given back with pool().release()
+    wave_record* retain();
+
+    void on_wave(waveform& wfm);
+
+private:
+    std::unique_ptr<wave_record_pool> own_pool;
+    wave_record_pool* pool_;
+    wave_record* current;
+};
+
+} // namespace vpp
+
+#endif // VPP_WAVEPOOL_HPP
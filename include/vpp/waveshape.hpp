@@ -0,0 +1,136 @@
+// $Id$
+
+#ifndef VPP_WAVESHAPE_HPP
+#define VPP_WAVESHAPE_HPP
+
+//! \file waveshape.hpp
+//! Waveform derived echo shape attributes attached to pointcloud targets.
+
+#include <vpp/wavepool.hpp>
+
+#include <riegl/pointcloud.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+namespace vpp {
+
+//!\brief shape attributes of one echo, measured on its waveform
+//!\details All values are NaN if the echo could not be located in the
+//! waveform of its channel.
+struct echo_shape
+{
+    echo_shape();
+
+    float amplitude;            //!< peak above baseline in ADC digits
+    float pulse_width;          //!< full width at half maximum in ns
+    float rise_time;            //!< 10 % to 90 % of the leading edge in ns
+    float energy;               //!< integral above baseline between the 10 % points in digits*ns
+    float position;             //!< sub-sample peak position in the wavelet
+    uint32_t channel;           //!< channel the shape was measured on
+    uint32_t wavelet;           //!< index of the wavelet in the record
+
+    bool valid() const { return amplitude == amplitude; }
+};
+
+//!\brief measures echo shapes on wave records
+//!\details An echo is located in the waveform of its channel (high power
+//! echoes in channel 0, low power ones in channel 1) at the sample time
+//!   t = t_ref + 2 * echo_range / v_group,
+//! where t_ref is the emission time taken from the peak of the reference
+//! pulse, or the start of the range gate if there is none. The highest
+//! sample within search_radius samples of that position is taken as the
+//! peak, the widths are interpolated linearly between samples. The
+//! baseline is the channel statistic of the shot, or the mean of the
+//! leading samples of the wavelet.
+class echo_shape_estimator
+{
+public:
+    echo_shape_estimator();
+
+    double v_group;             //!< group velocity of light in m/s
+    unsigned search_radius;     //!< peak search radius in samples
+
+    //! take channel properties from a wave instance
+    void configure(const scanlib::wave& w);
+    bool configured() const { return !sampling_time.empty(); }
+
+    //! emission time of a shot, from the reference pulse if present
+    double emission_time(const wave_record& r) const;
+
+    //! measure one echo
+    //!\param r waveform of the shot
+    //!\param t_ref emission time, see emission_time
+    //!\param t the echo
+    //!\return s.valid()
+    bool measure(const wave_record& r, double t_ref, const scanlib::target& t, echo_shape& s) const;
+
+private:
+    std::vector<double> sampling_time;
+    std::vector<double> delay;
+    std::size_t reference;
+};
+
+//!\brief pointcloud with waveform derived echo attributes
+//!\details Decodes targets and waveforms of an rxp stream with interleaved
+//! waveform packets in the same pass. Each shot is delivered through
+//! on_shot_shapes() with one echo_shape per target. Shots and waveforms
+//! are paired by their start of range gate time, within match_tolerance;
+//! shots without a waveform get invalid shapes, waveforms without a shot
+//! are dropped. As the two may be completed in either order, up to
+//! max_pending shots are held back; call flush() after the last packet.
+//!
+//! With shapes disabled, shots are delivered at once with invalid shapes
+//! and waveforms are dropped without analysis.
+class shape_pointcloud
+    : public pooled_wave
+{
+public:
+    //! constructor
+    //!\param sync_to_pps use pps synchronized time stamps
+    //!\param shapes compute echo shapes
+    explicit shape_pointcloud(bool sync_to_pps = false, bool shapes = true);
+
+    bool shapes;                        //!< compute echo shapes
+    double match_tolerance;             //!< s
+    std::size_t max_pending;            //!< shots held back at most
+    echo_shape_estimator estimator;
+
+    //! deliver all shots held back
+    void flush();
+
+    uint64_t shots_matched;             //!< shots delivered with waveform
+    uint64_t shots_unmatched;           //!< shots delivered without
+    uint64_t waves_dropped;             //!< waveforms without shot
+
+protected:
+    //! called for every shot
+    //!\param targets the targets of the shot, as pointcloud::targets
+    //!\param shapes one entry per target
+    virtual void on_shot_shapes(
+        const std::vector<scanlib::target>& targets
+        , const std::vector<echo_shape>& shapes
+    ) = 0;
+
+    void on_shot_end();
+    void on_record(wave_record& r);
+
+private:
+    struct shot_t {
+        double time_sorg;
+        std::vector<scanlib::target> targets;
+    };
+    std::deque<shot_t> shots_pending;
+    std::deque<wave_record*> waves_pending;
+    std::vector<std::vector<scanlib::target> > spare;
+    std::vector<echo_shape> result;
+
+    void match();
+    void deliver(shot_t& s, const wave_record* w);
+};
+
+} // namespace vpp
+
+#endif // VPP_WAVESHAPE_HPP
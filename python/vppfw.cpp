@@ -0,0 +1,815 @@
+// $Id$
+
+//! \file vppfw.cpp
+//! Python extension module vppfw, bulk access to RiWaveLib waveform files.
+//!
+//! Shots are read in blocks through vpp_fwblock_read (see fwblock.hpp)
+//! into column arrays that support the buffer protocol, so that
+//! numpy.asarray(block.sample) and friends are views without copies:
+//!
+//!     import numpy, vppfw
+//!     with vppfw.File("scan.wfm", block=8192) as f:
+//!         for b in f:
+//!             t = numpy.asarray(b.time_sorg)           # (n,)
+//!             d = numpy.asarray(b.direction)           # (n, 3)
+//!             s = numpy.asarray(b.sample)              # all samples
+//!             o = numpy.asarray(b.sbl_offset)          # (m+1,)
+//!         part = f[1000:2000]                          # record range
+//!         crown = f.time_range(t0, t1)                 # time range
+//!
+//! The GIL is released while reading, so several File objects, on one file
+//! or on several, can be read from Python threads in parallel. A File is
+//! used by one thread at a time: a call made while another thread reads
+//! from it, close() included, raises RuntimeError.
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <structmember.h>
+
+#include <vpp/fwblock.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace {
+
+PyObject* error_type = 0;
+
+// shots per call into vpp_fwblock_read
+const uint64_t chunk_shots = 4096;
+
+// upper limit of the sample capacity tried for a single shot
+const uint64_t max_shot_samples = uint64_t(1) << 28;
+
+//-----------------------------------------------------------------------------
+// Array: one column, owns its storage and exports it as a buffer
+
+struct holder_base {
+    virtual ~holder_base() {}
+};
+
+template<class T>
+struct holder : holder_base {
+    std::vector<T> v;
+};
+
+template<class T> struct type_format;
+template<> struct type_format<double> { static char* get() { return const_cast<char*>("d"); } };
+template<> struct type_format<uint16_t> { static char* get() { return const_cast<char*>("H"); } };
+template<> struct type_format<uint32_t> { static char* get() { return const_cast<char*>("I"); } };
+template<> struct type_format<uint64_t> { static char* get() { return const_cast<char*>("Q"); } };
+
+struct array_object {
+    PyObject_HEAD
+    holder_base* owner;
+    void* data;
+    char* format;
+    Py_ssize_t itemsize;
+    int ndim;
+    Py_ssize_t shape[2];
+    Py_ssize_t strides[2];
+};
+
+void
+array_dealloc(array_object* self)
+{
+    delete self->owner;
+    Py_TYPE(self)->tp_free(reinterpret_cast<PyObject*>(self));
+}
+
+int
+array_getbuffer(array_object* self, Py_buffer* view, int flags)
+{
+    if (flags & PyBUF_WRITABLE) {
+        PyErr_SetString(PyExc_BufferError, "vppfw.Array is read-only");
+        view->obj = 0;
+        return -1;
+    }
+    view->buf = self->data;
+    view->obj = reinterpret_cast<PyObject*>(self);
+    Py_INCREF(self);
+    view->len = self->shape[0]*(self->ndim == 2 ? self->shape[1] : 1)*self->itemsize;
+    view->readonly = 1;
+    view->itemsize = self->itemsize;
+    view->format = (flags & PyBUF_FORMAT) ? self->format : 0;
+    view->ndim = self->ndim;
+    view->shape = (flags & PyBUF_ND) ? self->shape : 0;
+    view->strides = ((flags & PyBUF_STRIDES) == PyBUF_STRIDES) ? self->strides : 0;
+    view->suboffsets = 0;
+    view->internal = 0;
+    return 0;
+}
+
+Py_ssize_t
+array_length(array_object* self)
+{
+    return self->shape[0];
+}
+
+PyBufferProcs array_as_buffer = {
+    reinterpret_cast<getbufferproc>(array_getbuffer),
+    0
+};
+
+// the slots of the tables below are set in PyInit_vppfw
+PySequenceMethods array_as_sequence = {};
+PyTypeObject array_type = {};
+
+//! wrap a vector, width > 1 gives a two dimensional array
+template<class T>
+PyObject*
+make_array(std::vector<T>& v, Py_ssize_t width = 1)
+{
+    array_object* a = PyObject_New(array_object, &array_type);
+    if (!a)
+        return 0;
+    holder<T>* h = new holder<T>;
+    h->v.swap(v);
+    a->owner = h;
+    a->data = h->v.data();
+    a->format = type_format<T>::get();
+    a->itemsize = sizeof(T);
+    a->ndim = width > 1 ? 2 : 1;
+    a->shape[0] = static_cast<Py_ssize_t>(h->v.size()/width);
+    a->shape[1] = width;
+    a->strides[0] = width*sizeof(T);
+    a->strides[1] = sizeof(T);
+    return reinterpret_cast<PyObject*>(a);
+}
+
+//-----------------------------------------------------------------------------
+// reading into growing columns, runs without the GIL
+
+struct columns {
+    uint64_t shots;
+    std::vector<double> time_sorg;
+    std::vector<double> time_external;
+    std::vector<double> origin;
+    std::vector<double> direction;
+    std::vector<uint16_t> flags;
+    std::vector<uint16_t> facet;
+    std::vector<uint32_t> sbl_first;
+    std::vector<double> sbl_time;
+    std::vector<uint32_t> sbl_channel;
+    std::vector<uint64_t> sbl_offset;
+    std::vector<uint16_t> sample;
+
+    columns() : shots(0), sbl_first(1, 0), sbl_offset(1, 0) {}
+
+    void resize(uint64_t ns, uint64_t nb, uint64_t nx) {
+        time_sorg.resize(ns);
+        time_external.resize(ns);
+        origin.resize(3*ns);
+        direction.resize(3*ns);
+        flags.resize(ns);
+        facet.resize(ns);
+        sbl_first.resize(ns+1);
+        sbl_time.resize(nb);
+        sbl_channel.resize(nb);
+        sbl_offset.resize(nb+1);
+        sample.resize(nx);
+    }
+
+    // keep the first n shots
+    void truncate(uint64_t n) {
+        uint64_t nb = sbl_first[n];
+        resize(n, nb, sbl_offset[nb]);
+        shots = n;
+    }
+};
+
+//! append up to want shots, stop before the first shot at or after stop
+fwifc_int32_t
+read_columns(vpp_fwblock r, uint64_t want, double stop, columns& c)
+{
+    uint64_t nb = c.sbl_first[c.shots];
+    uint64_t nx = c.sbl_offset[nb];
+    uint64_t sbl_spare = 0, sample_spare = 0;
+    fwifc_int32_t rc = FWIFC_NO_ERROR;
+
+    while (c.shots < want) {
+        uint64_t left = std::min(want - c.shots, chunk_shots);
+        sbl_spare = std::max(sbl_spare, 4*left + 16);
+        sample_spare = std::max(sample_spare, 64*sbl_spare);
+        c.resize(c.shots + left, nb + sbl_spare, nx + sample_spare);
+
+        const uint64_t s0 = c.shots;
+        vpp_fwblock_arrays a;
+        a.max_shots = static_cast<fwifc_uint32_t>(left);
+        a.max_sbls = static_cast<fwifc_uint32_t>(sbl_spare);
+        a.max_samples = sample_spare;
+        a.time_sorg = &c.time_sorg[s0];
+        a.time_external = &c.time_external[s0];
+        a.origin = &c.origin[3*s0];
+        a.direction = &c.direction[3*s0];
+        a.flags = &c.flags[s0];
+        a.facet = &c.facet[s0];
+        a.sbl_first = &c.sbl_first[s0];
+        a.sbl_time = &c.sbl_time[nb];
+        a.sbl_channel = &c.sbl_channel[nb];
+        a.sbl_offset = &c.sbl_offset[nb];
+        a.sample = &c.sample[nx];
+
+        fwifc_uint32_t ns = 0, nbs = 0;
+        uint64_t nxs = 0;
+        rc = vpp_fwblock_read(r, &a, &ns, &nbs, &nxs);
+        if (rc == FWIFC_ERR_BAD_ARG && ns == 0 && sample_spare < max_shot_samples) {
+            // a shot larger than the spare room, grow and retry
+            sbl_spare *= 4;
+            sample_spare *= 4;
+            rc = FWIFC_NO_ERROR;
+            continue;
+        }
+
+        // offsets of the call start at 0, rebase them
+        for (uint64_t k=0; k<=ns; ++k)
+            c.sbl_first[s0+k] += static_cast<uint32_t>(nb);
+        for (uint64_t k=0; k<=nbs; ++k)
+            c.sbl_offset[nb+k] += nx;
+        c.shots += ns;
+        nb += nbs;
+        nx += nxs;
+
+        if (ns && c.time_sorg[c.shots-1] >= stop) {
+            uint64_t k = std::lower_bound(c.time_sorg.begin() + s0
+                , c.time_sorg.begin() + c.shots, stop) - c.time_sorg.begin();
+            c.resize(c.shots, nb, nx);
+            c.truncate(k);
+            return FWIFC_NO_ERROR;
+        }
+        if (rc != FWIFC_NO_ERROR)
+            break;
+    }
+    c.resize(c.shots, nb, nx);
+    return rc == FWIFC_END_OF_FILE ? FWIFC_NO_ERROR : rc;
+}
+
+//-----------------------------------------------------------------------------
+// Block: the columns of a number of shots
+
+struct block_object {
+    PyObject_HEAD
+    Py_ssize_t shots;
+    PyObject* time_sorg;
+    PyObject* time_external;
+    PyObject* origin;
+    PyObject* direction;
+    PyObject* flags;
+    PyObject* facet;
+    PyObject* sbl_first;
+    PyObject* sbl_time;
+    PyObject* sbl_channel;
+    PyObject* sbl_offset;
+    PyObject* sample;
+};
+
+void
+block_dealloc(block_object* self)
+{
+    Py_XDECREF(self->time_sorg);
+    Py_XDECREF(self->time_external);
+    Py_XDECREF(self->origin);
+    Py_XDECREF(self->direction);
+    Py_XDECREF(self->flags);
+    Py_XDECREF(self->facet);
+    Py_XDECREF(self->sbl_first);
+    Py_XDECREF(self->sbl_time);
+    Py_XDECREF(self->sbl_channel);
+    Py_XDECREF(self->sbl_offset);
+    Py_XDECREF(self->sample);
+    Py_TYPE(self)->tp_free(reinterpret_cast<PyObject*>(self));
+}
+
+Py_ssize_t
+block_length(block_object* self)
+{
+    return self->shots;
+}
+
+PyMemberDef block_members[] = {
+    {const_cast<char*>("shots"), T_PYSSIZET, offsetof(block_object, shots), READONLY
+        , const_cast<char*>("number of shots")},
+    {const_cast<char*>("time_sorg"), T_OBJECT_EX, offsetof(block_object, time_sorg), READONLY
+        , const_cast<char*>("start of range gate in s, float64 (n,)")},
+    {const_cast<char*>("time_external"), T_OBJECT_EX, offsetof(block_object, time_external), READONLY
+        , const_cast<char*>("external time in s, float64 (n,)")},
+    {const_cast<char*>("origin"), T_OBJECT_EX, offsetof(block_object, origin), READONLY
+        , const_cast<char*>("beam origin in m, float64 (n,3)")},
+    {const_cast<char*>("direction"), T_OBJECT_EX, offsetof(block_object, direction), READONLY
+        , const_cast<char*>("beam direction, float64 (n,3)")},
+    {const_cast<char*>("flags"), T_OBJECT_EX, offsetof(block_object, flags), READONLY
+        , const_cast<char*>("shot flags, uint16 (n,)")},
+    {const_cast<char*>("facet"), T_OBJECT_EX, offsetof(block_object, facet), READONLY
+        , const_cast<char*>("mirror facet, uint16 (n,)")},
+    {const_cast<char*>("sbl_first"), T_OBJECT_EX, offsetof(block_object, sbl_first), READONLY
+        , const_cast<char*>("first sample block of each shot, uint32 (n+1,)")},
+    {const_cast<char*>("sbl_time"), T_OBJECT_EX, offsetof(block_object, sbl_time), READONLY
+        , const_cast<char*>("start of sample block in s, float64 (m,)")},
+    {const_cast<char*>("sbl_channel"), T_OBJECT_EX, offsetof(block_object, sbl_channel), READONLY
+        , const_cast<char*>("channel of sample block, uint32 (m,)")},
+    {const_cast<char*>("sbl_offset"), T_OBJECT_EX, offsetof(block_object, sbl_offset), READONLY
+        , const_cast<char*>("first sample of each sample block, uint64 (m+1,)")},
+    {const_cast<char*>("sample"), T_OBJECT_EX, offsetof(block_object, sample), READONLY
+        , const_cast<char*>("samples of all sample blocks, uint16")},
+    {0, 0, 0, 0, 0}
+};
+
+PySequenceMethods block_as_sequence = {};
+PyTypeObject block_type = {};
+
+PyObject*
+make_block(columns& c)
+{
+    block_object* b = PyObject_New(block_object, &block_type);
+    if (!b)
+        return 0;
+    b->shots = static_cast<Py_ssize_t>(c.shots);
+    b->time_sorg = make_array(c.time_sorg);
+    b->time_external = make_array(c.time_external);
+    b->origin = make_array(c.origin, 3);
+    b->direction = make_array(c.direction, 3);
+    b->flags = make_array(c.flags);
+    b->facet = make_array(c.facet);
+    b->sbl_first = make_array(c.sbl_first);
+    b->sbl_time = make_array(c.sbl_time);
+    b->sbl_channel = make_array(c.sbl_channel);
+    b->sbl_offset = make_array(c.sbl_offset);
+    b->sample = make_array(c.sample);
+    if (!b->time_sorg || !b->time_external || !b->origin || !b->direction
+        || !b->flags || !b->facet || !b->sbl_first || !b->sbl_time
+        || !b->sbl_channel || !b->sbl_offset || !b->sample) {
+        Py_DECREF(b);
+        return 0;
+    }
+    return reinterpret_cast<PyObject*>(b);
+}
+
+//-----------------------------------------------------------------------------
+// File
+
+struct file_object {
+    PyObject_HEAD
+    vpp_fwblock reader;
+    Py_ssize_t block;
+    bool busy;                  // a thread uses reader without the GIL
+};
+
+PyObject*
+raise_error(vpp_fwblock r, fwifc_int32_t rc)
+{
+    fwifc_csz m = 0;
+    vpp_fwblock_get_last_error(r, &m);
+    PyObject* arg = Py_BuildValue("(is)", int(rc), m ? m : "");
+    if (arg) {
+        PyErr_SetObject(error_type, arg);
+        Py_DECREF(arg);
+    }
+    return 0;
+}
+
+bool
+check_idle(file_object* self)
+{
+    if (!self->busy)
+        return true;
+    PyErr_SetString(PyExc_RuntimeError, "vppfw.File is in use by another thread");
+    return false;
+}
+
+bool
+check_open(file_object* self)
+{
+    if (!check_idle(self))
+        return false;
+    if (self->reader)
+        return true;
+    PyErr_SetString(PyExc_ValueError, "vppfw.File is closed");
+    return false;
+}
+
+//! claim the reader before the GIL is released; busy is only set and
+//! cleared with the GIL held, so no other call can close or move the
+//! reader meanwhile
+bool
+acquire(file_object* self)
+{
+    if (!check_open(self))
+        return false;
+    self->busy = true;
+    return true;
+}
+
+void
+release(file_object* self)
+{
+    self->busy = false;
+}
+
+//! record number from a Python int
+bool
+to_record(PyObject* o, fwifc_uint32_t& record)
+{
+    unsigned long long v = PyLong_AsUnsignedLongLong(o);
+    if (PyErr_Occurred())
+        return false;   // OverflowError for negative values, TypeError else
+    if (v > std::numeric_limits<fwifc_uint32_t>::max()) {
+        PyErr_SetString(PyExc_OverflowError, "record number out of range");
+        return false;
+    }
+    record = static_cast<fwifc_uint32_t>(v);
+    return true;
+}
+
+//! read up to want shots, the caller has acquired the reader
+PyObject*
+read_block(file_object* self, uint64_t want, double stop)
+{
+    columns c;
+    fwifc_int32_t rc;
+    Py_BEGIN_ALLOW_THREADS
+    try {
+        rc = read_columns(self->reader, want, stop, c);
+    }
+    catch (const std::bad_alloc&) {
+        rc = -2;
+    }
+    Py_END_ALLOW_THREADS
+    if (rc == -2)
+        return PyErr_NoMemory();
+    if (rc != FWIFC_NO_ERROR)
+        return raise_error(self->reader, rc);
+    return make_block(c);
+}
+
+int
+file_init(file_object* self, PyObject* args, PyObject* kwds)
+{
+    static const char* kwlist[] = {"path", "first", "count", "block", 0};
+    const char* path = 0;
+    PyObject* first = Py_None;
+    PyObject* count = Py_None;
+    Py_ssize_t block = 4096;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|OOn", const_cast<char**>(kwlist)
+        , &path, &first, &count, &block))
+        return -1;
+    if (block <= 0) {
+        PyErr_SetString(PyExc_ValueError, "block must be positive");
+        return -1;
+    }
+    fwifc_uint32_t f = 0;
+    fwifc_uint32_t n = std::numeric_limits<fwifc_uint32_t>::max();
+    if ((first != Py_None && !to_record(first, f))
+        || (count != Py_None && !to_record(count, n)))
+        return -1;
+    if (!check_idle(self))
+        return -1;
+    if (self->reader) {
+        vpp_fwblock_close(self->reader);
+        self->reader = 0;
+    }
+    self->block = block;
+
+    // opened into a local, the object is claimed until the reader is set
+    const bool range = first != Py_None || count != Py_None;
+    vpp_fwblock reader = 0;
+    fwifc_int32_t rc;
+    self->busy = true;
+    Py_BEGIN_ALLOW_THREADS
+    rc = range ? vpp_fwblock_open_range(path, f, n, &reader)
+        : vpp_fwblock_open(path, &reader);
+    Py_END_ALLOW_THREADS
+    release(self);
+    if (rc != FWIFC_NO_ERROR) {
+        raise_error(0, rc);
+        return -1;
+    }
+    self->reader = reader;
+    return 0;
+}
+
+void
+file_dealloc(file_object* self)
+{
+    if (self->reader)
+        vpp_fwblock_close(self->reader);
+    Py_TYPE(self)->tp_free(reinterpret_cast<PyObject*>(self));
+}
+
+PyObject*
+file_close(file_object* self, PyObject*)
+{
+    if (!check_idle(self))
+        return 0;
+    if (self->reader) {
+        fwifc_int32_t rc = vpp_fwblock_close(self->reader);
+        self->reader = 0;
+        if (rc != FWIFC_NO_ERROR)
+            return raise_error(0, rc);
+    }
+    Py_RETURN_NONE;
+}
+
+PyObject*
+file_enter(file_object* self, PyObject*)
+{
+    Py_INCREF(self);
+    return reinterpret_cast<PyObject*>(self);
+}
+
+PyObject*
+file_exit(file_object* self, PyObject*)
+{
+    return file_close(self, 0);
+}
+
+PyObject*
+file_read(file_object* self, PyObject* args)
+{
+    Py_ssize_t shots = self->block;
+    if (!PyArg_ParseTuple(args, "|n", &shots))
+        return 0;
+    if (shots <= 0) {
+        PyErr_SetString(PyExc_ValueError, "shots must be positive");
+        return 0;
+    }
+    if (!acquire(self))
+        return 0;
+    PyObject* b = read_block(self, shots, std::numeric_limits<double>::infinity());
+    release(self);
+    if (b && reinterpret_cast<block_object*>(b)->shots == 0) {
+        Py_DECREF(b);
+        Py_RETURN_NONE;
+    }
+    return b;
+}
+
+PyObject*
+file_iternext(file_object* self)
+{
+    if (!acquire(self))
+        return 0;
+    PyObject* b = read_block(self, self->block, std::numeric_limits<double>::infinity());
+    release(self);
+    if (b && reinterpret_cast<block_object*>(b)->shots == 0) {
+        Py_DECREF(b);
+        return 0;   // StopIteration
+    }
+    return b;
+}
+
+PyObject*
+file_seek(file_object* self, PyObject* args)
+{
+    PyObject* arg;
+    fwifc_uint32_t record;
+    if (!PyArg_ParseTuple(args, "O", &arg) || !to_record(arg, record) || !acquire(self))
+        return 0;
+    fwifc_int32_t rc;
+    Py_BEGIN_ALLOW_THREADS
+    rc = vpp_fwblock_seek(self->reader, record);
+    Py_END_ALLOW_THREADS
+    release(self);
+    if (rc != FWIFC_NO_ERROR)
+        return raise_error(self->reader, rc);
+    Py_RETURN_NONE;
+}
+
+PyObject*
+file_seek_time(file_object* self, PyObject* args)
+{
+    double t;
+    if (!PyArg_ParseTuple(args, "d", &t) || !acquire(self))
+        return 0;
+    fwifc_int32_t rc;
+    Py_BEGIN_ALLOW_THREADS
+    rc = vpp_fwblock_seek_time(self->reader, t);
+    Py_END_ALLOW_THREADS
+    release(self);
+    if (rc != FWIFC_NO_ERROR)
+        return raise_error(self->reader, rc);
+    Py_RETURN_NONE;
+}
+
+PyObject*
+file_time_range(file_object* self, PyObject* args)
+{
+    double t0, t1;
+    if (!PyArg_ParseTuple(args, "dd", &t0, &t1) || !acquire(self))
+        return 0;
+    fwifc_int32_t rc;
+    columns c;
+    Py_BEGIN_ALLOW_THREADS
+    try {
+        rc = vpp_fwblock_seek_time(self->reader, t0);
+        // the seek may land a little early, skip to t0
+        while (rc == FWIFC_NO_ERROR) {
+            c = columns();
+            rc = read_columns(self->reader, 1, t1, c);
+            if (rc != FWIFC_NO_ERROR || c.shots == 0 || c.time_sorg[0] >= t0)
+                break;
+        }
+        if (rc == FWIFC_NO_ERROR && c.shots)
+            rc = read_columns(self->reader, std::numeric_limits<uint64_t>::max(), t1, c);
+    }
+    catch (const std::bad_alloc&) {
+        rc = -2;
+    }
+    Py_END_ALLOW_THREADS
+    release(self);
+    if (rc == -2)
+        return PyErr_NoMemory();
+    if (rc != FWIFC_NO_ERROR)
+        return raise_error(self->reader, rc);
+    return make_block(c);
+}
+
+PyObject*
+file_subscript(file_object* self, PyObject* key)
+{
+    if (!PySlice_Check(key)) {
+        PyErr_SetString(PyExc_TypeError, "vppfw.File supports record slices only");
+        return 0;
+    }
+    Py_ssize_t start, stop, step;
+    if (PySlice_Unpack(key, &start, &stop, &step) < 0)
+        return 0;
+    if (step != 1 || start < 0 || stop < 0) {
+        PyErr_SetString(PyExc_ValueError, "record slices need non-negative bounds and step 1");
+        return 0;
+    }
+    // open ended slices come as PY_SSIZE_T_MAX, only the start must be a record
+    if (uint64_t(start) > std::numeric_limits<fwifc_uint32_t>::max()) {
+        PyErr_SetString(PyExc_OverflowError, "record number out of range");
+        return 0;
+    }
+    if (!acquire(self))
+        return 0;
+    fwifc_int32_t rc;
+    Py_BEGIN_ALLOW_THREADS
+    rc = vpp_fwblock_seek(self->reader, static_cast<fwifc_uint32_t>(start));
+    Py_END_ALLOW_THREADS
+    PyObject* b = 0;
+    if (rc != FWIFC_NO_ERROR)
+        raise_error(self->reader, rc);
+    else
+        b = read_block(self, stop > start ? stop - start : 0
+            , std::numeric_limits<double>::infinity());
+    release(self);
+    return b;
+}
+
+PyObject*
+file_info(file_object* self, PyObject*)
+{
+    if (!check_open(self))
+        return 0;
+    fwifc_csz instrument = 0, serial = 0, epoch = 0;
+    fwifc_float64_t v_group = 0, sampling_time = 0;
+    fwifc_uint16_t flags = 0, num_facets = 0;
+    fwifc_int32_t rc = vpp_fwblock_get_info(self->reader, &instrument, &serial, &epoch
+        , &v_group, &sampling_time, &flags, &num_facets);
+    if (rc != FWIFC_NO_ERROR)
+        return raise_error(self->reader, rc);
+    return Py_BuildValue("{s:s,s:s,s:s,s:d,s:d,s:i,s:i}"
+        , "instrument", instrument ? instrument : ""
+        , "serial", serial ? serial : ""
+        , "epoch", epoch ? epoch : ""
+        , "v_group", v_group
+        , "sampling_time", sampling_time
+        , "flags", int(flags)
+        , "num_facets", int(num_facets));
+}
+
+PyObject*
+file_calib(file_object* self, PyObject* args)
+{
+    int kind;
+    if (!PyArg_ParseTuple(args, "i", &kind) || !check_open(self))
+        return 0;
+    fwifc_uint32_t count = 0;
+    const fwifc_float64_t* abscissa = 0;
+    const fwifc_float64_t* ordinate = 0;
+    fwifc_int32_t rc = vpp_fwblock_get_calib(self->reader, static_cast<fwifc_uint16_t>(kind)
+        , &count, &abscissa, &ordinate);
+    if (rc != FWIFC_NO_ERROR)
+        return raise_error(self->reader, rc);
+    std::vector<double> x(abscissa, abscissa + count);
+    std::vector<double> y(ordinate, ordinate + count);
+    PyObject* ax = make_array(x);
+    PyObject* ay = make_array(y);
+    if (!ax || !ay) {
+        Py_XDECREF(ax);
+        Py_XDECREF(ay);
+        return 0;
+    }
+    return Py_BuildValue("(NN)", ax, ay);
+}
+
+PyMethodDef file_methods[] = {
+    {"read", reinterpret_cast<PyCFunction>(file_read), METH_VARARGS
+        , "read([shots]) -> Block of up to shots records, None at end of file"},
+    {"seek", reinterpret_cast<PyCFunction>(file_seek), METH_VARARGS
+        , "seek(record), needs the index of the file"},
+    {"seek_time", reinterpret_cast<PyCFunction>(file_seek_time), METH_VARARGS
+        , "seek_time(t), needs the index of the file"},
+    {"time_range", reinterpret_cast<PyCFunction>(file_time_range), METH_VARARGS
+        , "time_range(t0, t1) -> Block of the shots with t0 <= time_sorg < t1"},
+    {"info", reinterpret_cast<PyCFunction>(file_info), METH_NOARGS
+        , "info() -> dict of instrument, serial, epoch, v_group, sampling_time, flags, num_facets"},
+    {"calib", reinterpret_cast<PyCFunction>(file_calib), METH_VARARGS
+        , "calib(kind) -> (abscissa, ordinate), kind one of CALIB_*"},
+    {"close", reinterpret_cast<PyCFunction>(file_close), METH_NOARGS, "close the file"},
+    {"__enter__", reinterpret_cast<PyCFunction>(file_enter), METH_NOARGS, 0},
+    {"__exit__", reinterpret_cast<PyCFunction>(file_exit), METH_VARARGS, 0},
+    {0, 0, 0, 0}
+};
+
+PyMappingMethods file_as_mapping = {
+    0,
+    reinterpret_cast<binaryfunc>(file_subscript),
+    0
+};
+
+PyTypeObject file_type = {};
+
+// object head of the statically allocated types
+const PyVarObject type_head[1] = { PyVarObject_HEAD_INIT(0, 0) };
+
+PyModuleDef module_def = {
+    PyModuleDef_HEAD_INIT,
+    "vppfw",
+    "Bulk access to RiWaveLib waveform files with buffer protocol columns.",
+    -1,
+    0,          // m_methods
+    0,          // m_slots
+    0,          // m_traverse
+    0,          // m_clear
+    0           // m_free
+};
+
+} // anonymous namespace
+
+PyMODINIT_FUNC
+PyInit_vppfw()
+{
+    array_as_sequence.sq_length = reinterpret_cast<lenfunc>(array_length);
+    array_type.ob_base = type_head[0];
+    array_type.tp_name = "vppfw.Array";
+    array_type.tp_basicsize = sizeof(array_object);
+    array_type.tp_flags = Py_TPFLAGS_DEFAULT;
+    array_type.tp_doc = "read-only column supporting the buffer protocol";
+    array_type.tp_dealloc = reinterpret_cast<destructor>(array_dealloc);
+    array_type.tp_as_buffer = &array_as_buffer;
+    array_type.tp_as_sequence = &array_as_sequence;
+
+    block_as_sequence.sq_length = reinterpret_cast<lenfunc>(block_length);
+    block_type.ob_base = type_head[0];
+    block_type.tp_name = "vppfw.Block";
+    block_type.tp_basicsize = sizeof(block_object);
+    block_type.tp_flags = Py_TPFLAGS_DEFAULT;
+    block_type.tp_doc = "columns of a number of shots";
+    block_type.tp_dealloc = reinterpret_cast<destructor>(block_dealloc);
+    block_type.tp_members = block_members;
+    block_type.tp_as_sequence = &block_as_sequence;
+
+    file_type.ob_base = type_head[0];
+    file_type.tp_name = "vppfw.File";
+    file_type.tp_basicsize = sizeof(file_object);
+    file_type.tp_flags = Py_TPFLAGS_DEFAULT;
+    file_type.tp_doc = "File(path, first=None, count=None, block=4096)\n\n"
+        "waveform file, iterates over Blocks of block shots; first and\n"
+        "count limit reading to a record range of an indexed file";
+    file_type.tp_new = PyType_GenericNew;
+    file_type.tp_init = reinterpret_cast<initproc>(file_init);
+    file_type.tp_dealloc = reinterpret_cast<destructor>(file_dealloc);
+    file_type.tp_iter = PyObject_SelfIter;
+    file_type.tp_iternext = reinterpret_cast<iternextfunc>(file_iternext);
+    file_type.tp_methods = file_methods;
+    file_type.tp_as_mapping = &file_as_mapping;
+
+    if (PyType_Ready(&array_type) < 0 || PyType_Ready(&block_type) < 0
+        || PyType_Ready(&file_type) < 0)
+        return 0;
+
+    PyObject* m = PyModule_Create(&module_def);
+    if (!m)
+        return 0;
+    error_type = PyErr_NewException("vppfw.Error", PyExc_RuntimeError, 0);
+    Py_INCREF(error_type);
+    PyModule_AddObject(m, "Error", error_type);
+    Py_INCREF(&array_type);
+    PyModule_AddObject(m, "Array", reinterpret_cast<PyObject*>(&array_type));
+    Py_INCREF(&block_type);
+    PyModule_AddObject(m, "Block", reinterpret_cast<PyObject*>(&block_type));
+    Py_INCREF(&file_type);
+    PyModule_AddObject(m, "File", reinterpret_cast<PyObject*>(&file_type));
+    PyModule_AddIntConstant(m, "CALIB_AMPL_CH0", FWIFC_CALIB_AMPL_CH0);
+    PyModule_AddIntConstant(m, "CALIB_AMPL_CH1", FWIFC_CALIB_AMPL_CH1);
+    PyModule_AddIntConstant(m, "CALIB_RNG_CH0", FWIFC_CALIB_RNG_CH0);
+    PyModule_AddIntConstant(m, "CALIB_RNG_CH1", FWIFC_CALIB_RNG_CH1);
+    return m;
+}
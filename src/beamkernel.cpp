@@ -0,0 +1,306 @@
+// $Id$
+
+#include <vpp/beamkernel.hpp>
+
+#include <cmath>
+#include <stdexcept>
+#include <typeinfo>
+
+using namespace scanlib;
+
+namespace vpp {
+
+namespace {
+
+const double two_pi = 6.283185307179586;
+
+// access to the computed results of the mechanisms needed for decoding
+struct mirrorwheel_access : mirrorwheel {
+    static int32_t modulus(const mirrorwheel& m) {
+        return m.*(&mirrorwheel_access::line_modulus);
+    }
+};
+
+struct deflection_access : mirrorwheel_deflection {
+    static double t0_of(const mirrorwheel_deflection& m) {
+        return m.*(&deflection_access::t0);
+    }
+    static double tmod_of(const mirrorwheel_deflection& m) {
+        return m.*(&deflection_access::tmod);
+    }
+};
+
+// raw angle decoding, the same as compute_beam_raw of the classes
+
+// scanmech: the segment is the facet
+struct generic_decode {
+    double line_unit, frame_unit;
+    explicit generic_decode(const scanmech& m)
+        : line_unit(m.line_unit), frame_unit(m.frame_unit) {}
+    void operator()(uint32_t l, uint32_t f, unsigned s, unsigned& facet, double& line, double& frame) const {
+        facet = s;
+        line = l*line_unit;
+        frame = f*frame_unit;
+    }
+};
+
+struct gimbal_decode {
+    double line_unit, frame_unit;
+    explicit gimbal_decode(const scanmech& m)
+        : line_unit(m.line_unit), frame_unit(m.frame_unit) {}
+    void operator()(uint32_t l, uint32_t f, unsigned, unsigned& facet, double& line, double& frame) const {
+        facet = 0;
+        line = l*line_unit;
+        frame = f*frame_unit;
+    }
+};
+
+// wedge: no frame axis
+struct wedge_decode {
+    double line_unit;
+    explicit wedge_decode(const scanmech& m)
+        : line_unit(m.line_unit) {}
+    void operator()(uint32_t l, uint32_t, unsigned s, unsigned& facet, double& line, double& frame) const {
+        facet = s;
+        line = l*line_unit;
+        frame = 0;
+    }
+};
+
+// mirror wheel: the facet follows from the turns of the line counter
+struct mirrorwheel_decode {
+    double line_unit, frame_unit;
+    uint32_t modulus, angle_0, facets;
+    explicit mirrorwheel_decode(const mirrorwheel& m)
+        : line_unit(m.line_unit), frame_unit(m.frame_unit)
+        , modulus(static_cast<uint32_t>(mirrorwheel_access::modulus(m)))
+        , angle_0(static_cast<uint32_t>(m.line_angle_0))
+        , facets(static_cast<uint32_t>(m.facets.size()))
+    {
+        if (modulus == 0 || facets == 0)
+            throw(std::runtime_error("beam_kernel: mirrorwheel not set up"));
+    }
+    void operator()(uint32_t l, uint32_t f, unsigned, unsigned& facet, double& line, double& frame) const {
+        facet = (l/modulus) % facets;
+        line = uint32_t(l%modulus - angle_0)*line_unit;
+        frame = f*frame_unit;
+    }
+};
+
+// mirror wheel with deflection mirror: the facet follows from the angle
+struct deflection_decode {
+    double line_unit, frame_unit, t0, tmod;
+    explicit deflection_decode(const mirrorwheel_deflection& m)
+        : line_unit(m.line_unit), frame_unit(m.frame_unit)
+        , t0(deflection_access::t0_of(m)), tmod(deflection_access::tmod_of(m)) {}
+    void operator()(uint32_t l, uint32_t f, unsigned, unsigned& facet, double& line, double& frame) const {
+        line = l*line_unit;
+        facet = static_cast<unsigned>(static_cast<long long>(std::fmod(t0 - line, two_pi)*tmod));
+        frame = f*frame_unit;
+    }
+};
+
+inline void
+store(const scanmech& m, std::size_t k, double* origin, double* direction)
+{
+    for (unsigned i=0; i<3; ++i) {
+        origin[3*k+i] = m.beam_origin[i];
+        direction[3*k+i] = m.beam_direction[i];
+    }
+}
+
+template<class T>
+void
+direct_angles(
+    scanmech& sm
+    , const unsigned* facet
+    , const double* line
+    , const double* frame
+    , std::size_t n
+    , double* origin
+    , double* direction
+)
+{
+    T& m = static_cast<T&>(sm);
+    for (std::size_t k=0; k<n; ++k) {
+        m.T::compute_beam(facet ? facet[k] : 0, line[k], frame ? frame[k] : 0);
+        store(m, k, origin, direction);
+    }
+}
+
+template<class T, class D>
+void
+direct_raw(
+    scanmech& sm
+    , const uint32_t* line_raw
+    , const uint32_t* frame_raw
+    , const unsigned* segment
+    , std::size_t n
+    , double* origin
+    , double* direction
+)
+{
+    T& m = static_cast<T&>(sm);
+    const D decode(m);
+    for (std::size_t k=0; k<n; ++k) {
+        unsigned f;
+        double l, a;
+        decode(line_raw[k], frame_raw ? frame_raw[k] : 0, segment ? segment[k] : 0, f, l, a);
+        m.facet = f;
+        m.line_angle = l;
+        m.frame_angle = a;
+        m.T::compute_beam(f, l, a);
+        store(m, k, origin, direction);
+    }
+}
+
+void
+virtual_angles(
+    scanmech& m
+    , const unsigned* facet
+    , const double* line
+    , const double* frame
+    , std::size_t n
+    , double* origin
+    , double* direction
+)
+{
+    for (std::size_t k=0; k<n; ++k) {
+        m.compute_beam(facet ? facet[k] : 0, line[k], frame ? frame[k] : 0);
+        store(m, k, origin, direction);
+    }
+}
+
+void
+virtual_raw(
+    scanmech& m
+    , const uint32_t* line_raw
+    , const uint32_t* frame_raw
+    , const unsigned* segment
+    , std::size_t n
+    , double* origin
+    , double* direction
+)
+{
+    for (std::size_t k=0; k<n; ++k) {
+        m.compute_beam_raw(line_raw[k], frame_raw ? frame_raw[k] : 0, segment ? segment[k] : 0);
+        store(m, k, origin, direction);
+    }
+}
+
+template<class T, class D>
+bool
+select(scanmech& m, beam_kernel::angle_loop& angles, beam_kernel::raw_loop& raw)
+{
+    // kind() could be reported by a class derived from T
+    if (typeid(m) != typeid(T))
+        return false;
+    angles = &direct_angles<T>;
+    raw = &direct_raw<T, D>;
+    return true;
+}
+
+} // anonymous namespace
+
+//-----------------------------------------------------------------------------
+beam_kernel::beam_kernel()
+    : mech(0)
+    , angles(0)
+    , raw(0)
+    , direct_(false)
+{
+}
+
+beam_kernel::beam_kernel(scanmech& m)
+    : mech(0)
+    , angles(0)
+    , raw(0)
+    , direct_(false)
+{
+    bind(m);
+}
+
+void
+beam_kernel::bind(scanmech& m)
+{
+    mech = &m;
+    angles = &virtual_angles;
+    raw = &virtual_raw;
+
+    switch (m.kind()) {
+    case scanmech::mirrorwheel:
+        direct_ = select<mirrorwheel, mirrorwheel_decode>(m, angles, raw);
+        break;
+    case scanmech::mirrorwheel_exitpane:
+        direct_ = select<mirrorwheel_exitpane, mirrorwheel_decode>(m, angles, raw);
+        break;
+    case scanmech::mirrorwheel_biaxial:
+        direct_ = select<mirrorwheel_biaxial, mirrorwheel_decode>(m, angles, raw);
+        break;
+    case scanmech::mirrorwheel_nodding:
+        direct_ = select<mirrorwheel_nodding, mirrorwheel_decode>(m, angles, raw);
+        break;
+    case scanmech::mirrorwheel_windowdistortion:
+        direct_ = select<mirrorwheel_windowdistortion, mirrorwheel_decode>(m, angles, raw);
+        break;
+    case scanmech::mirrorwheel_scanconedistortion:
+        direct_ = select<mirrorwheel_scanconedistortion, mirrorwheel_decode>(m, angles, raw);
+        break;
+    case scanmech::mirrorwheel_deflection:
+        direct_ = select<mirrorwheel_deflection, deflection_decode>(m, angles, raw);
+        break;
+    case scanmech::mirrorwheel_deflection_windowdistortion:
+        direct_ = select<mirrorwheel_deflection_windowdistortion, deflection_decode>(m, angles, raw);
+        break;
+    case scanmech::wedge:
+        direct_ = select<wedge, wedge_decode>(m, angles, raw);
+        break;
+    case scanmech::wedge_scanconedistortion:
+        direct_ = select<wedge_scanconedistortion, wedge_decode>(m, angles, raw);
+        break;
+    case scanmech::gimbalmountmirror:
+        direct_ = select<gimbalmountmirror, gimbal_decode>(m, angles, raw);
+        break;
+    case scanmech::unknown:
+        direct_ = select<scanmech, generic_decode>(m, angles, raw);
+        break;
+    default:
+        direct_ = false;
+    }
+    if (!direct_) {
+        angles = &virtual_angles;
+        raw = &virtual_raw;
+    }
+}
+
+void
+beam_kernel::compute(
+    const unsigned* facet
+    , const double* line_angle
+    , const double* frame_angle
+    , std::size_t n
+    , double* origin
+    , double* direction
+) const
+{
+    if (!mech)
+        throw(std::runtime_error("beam_kernel: not bound"));
+    angles(*mech, facet, line_angle, frame_angle, n, origin, direction);
+}
+
+void
+beam_kernel::compute_raw(
+    const uint32_t* line_angle_raw
+    , const uint32_t* frame_angle_raw
+    , const unsigned* segment
+    , std::size_t n
+    , double* origin
+    , double* direction
+) const
+{
+    if (!mech)
+        throw(std::runtime_error("beam_kernel: not bound"));
+    raw(*mech, line_angle_raw, frame_angle_raw, segment, n, origin, direction);
+}
+
+} // namespace vpp
@@ -0,0 +1,426 @@
+// $Id$
+
+#include <vpp/fwblock.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace {
+
+// RiWaveLib keeps its error message and read buffers per process
+std::mutex library_mutex;
+
+// message of the last failed open of this thread
+thread_local std::string open_error;
+
+// message of the last library error, to be called with the lock held
+std::string
+library_message()
+{
+    fwifc_csz m = 0;
+    if (fwifc_get_last_error(&m) != FWIFC_NO_ERROR || !m)
+        return std::string("unknown RiWaveLib error");
+    return std::string(m);
+}
+
+} // anonymous namespace
+
+struct vpp_fwblock_t
+{
+    vpp_fwblock_t()
+        : file(0)
+        , pending(false)
+        , position(0)
+        , begin(0)
+        , end(std::numeric_limits<uint64_t>::max())
+    {
+    }
+
+    fwifc_file file;
+
+    // shot read from the library but not yet delivered
+    struct shot_t {
+        fwifc_float64_t time_sorg;
+        fwifc_float64_t time_external;
+        fwifc_float64_t origin[3];
+        fwifc_float64_t direction[3];
+        fwifc_uint16_t flags;
+        fwifc_uint16_t facet;
+        std::vector<fwifc_sbl_t> sbl;           // sample pointers into samples
+        std::vector<fwifc_sample_t> samples;
+    };
+    shot_t shot;
+    bool pending;
+
+    uint64_t position;          // record number of the next fetch
+    uint64_t begin;             // record range of the reader
+    uint64_t end;
+
+    std::string message;
+
+    // copies of library buffers handed out by get_info and get_calib
+    std::string instrument;
+    std::string serial;
+    std::string epoch;
+    std::vector<fwifc_float64_t> abscissa;
+    std::vector<fwifc_float64_t> ordinate;
+
+    fwifc_int32_t fail(fwifc_int32_t code, const std::string& what) {
+        message = what;
+        return code;
+    }
+
+    // read the next shot into shot, keeping the samples
+    fwifc_int32_t fetch();
+
+    // position at record, clamped to the record range, with the lock held
+    fwifc_int32_t seek(uint64_t record);
+};
+
+namespace {
+
+uint64_t
+sample_total(const std::vector<fwifc_sbl_t>& sbl)
+{
+    uint64_t n = 0;
+    for (std::size_t k=0; k<sbl.size(); ++k)
+        n += sbl[k].sample_count;
+    return n;
+}
+
+fwifc_int32_t
+open_reader(fwifc_csz path, bool range, fwifc_uint32_t first, fwifc_uint32_t count, vpp_fwblock *reader)
+{
+    if (!path || !reader) {
+        open_error = "vpp_fwblock_open: null argument";
+        return FWIFC_ERR_BAD_ARG;
+    }
+    try {
+        // owned here until handed out, so no path leaks it
+        std::unique_ptr<vpp_fwblock_t> r(new vpp_fwblock_t);
+        std::lock_guard<std::mutex> lock(library_mutex);
+        fwifc_int32_t rc = fwifc_open(path, &r->file);
+        if (rc == FWIFC_NO_ERROR && range) {
+            rc = fwifc_seek(r->file, first);
+            if (rc != FWIFC_NO_ERROR) {
+                open_error = library_message();
+                fwifc_close(r->file);
+                return rc;
+            }
+            r->position = first;
+            r->begin = first;
+            r->end = uint64_t(first) + count;
+        }
+        if (rc != FWIFC_NO_ERROR) {
+            open_error = library_message();
+            return rc;
+        }
+        *reader = r.release();
+        return FWIFC_NO_ERROR;
+    }
+    catch (const std::exception& e) {
+        open_error = e.what();
+        return FWIFC_ERR_UNKNOWN_EXCEPTION;
+    }
+}
+
+} // anonymous namespace
+
+fwifc_int32_t
+vpp_fwblock_t::fetch()
+{
+    if (position >= end)
+        return FWIFC_END_OF_FILE;
+
+    std::lock_guard<std::mutex> lock(library_mutex);
+    fwifc_uint32_t sbl_count = 0, sbl_size = 0;
+    fwifc_sbl_t* sbl = 0;
+    fwifc_int32_t rc = fwifc_read(file, &shot.time_sorg, &shot.time_external
+        , shot.origin, shot.direction, &shot.flags, &shot.facet
+        , &sbl_count, &sbl_size, &sbl);
+    if (rc == FWIFC_END_OF_FILE)
+        return rc;
+    if (rc != FWIFC_NO_ERROR)
+        return fail(rc, library_message());
+
+    // the library buffers are only valid until the next call, copy them
+    // before the lock is released
+    shot.sbl.assign(sbl, sbl + sbl_count);
+    shot.samples.clear();
+    for (std::size_t k=0; k<shot.sbl.size(); ++k)
+        shot.samples.insert(shot.samples.end()
+            , shot.sbl[k].sample, shot.sbl[k].sample + shot.sbl[k].sample_count);
+    fwifc_sample_t* p = shot.samples.data();
+    for (std::size_t k=0; k<shot.sbl.size(); ++k) {
+        shot.sbl[k].sample = p;
+        p += shot.sbl[k].sample_count;
+    }
+    pending = true;
+    ++position;
+    return FWIFC_NO_ERROR;
+}
+
+fwifc_int32_t
+vpp_fwblock_t::seek(uint64_t record)
+{
+    pending = false;
+    if (record >= end) {
+        // nothing of the range is left, the library need not move
+        position = end;
+        return FWIFC_NO_ERROR;
+    }
+    record = std::max(record, begin);
+    fwifc_int32_t rc = fwifc_seek(file, static_cast<fwifc_uint32_t>(record));
+    if (rc != FWIFC_NO_ERROR)
+        return fail(rc, library_message());
+    position = record;
+    return FWIFC_NO_ERROR;
+}
+
+fwifc_int32_t
+vpp_fwblock_open(fwifc_csz path, vpp_fwblock *reader)
+{
+    return open_reader(path, false, 0, 0, reader);
+}
+
+fwifc_int32_t
+vpp_fwblock_open_range(
+    fwifc_csz path
+    , fwifc_uint32_t first
+    , fwifc_uint32_t count
+    , vpp_fwblock *reader
+)
+{
+    return open_reader(path, true, first, count, reader);
+}
+
+fwifc_int32_t
+vpp_fwblock_close(vpp_fwblock reader)
+{
+    if (!reader)
+        return FWIFC_ERR_BAD_ARG;
+    fwifc_int32_t rc;
+    {
+        std::lock_guard<std::mutex> lock(library_mutex);
+        rc = fwifc_close(reader->file);
+    }
+    delete reader;
+    return rc;
+}
+
+fwifc_int32_t
+vpp_fwblock_file(vpp_fwblock reader, fwifc_file *file)
+{
+    if (!reader || !file)
+        return FWIFC_ERR_BAD_ARG;
+    *file = reader->file;
+    return FWIFC_NO_ERROR;
+}
+
+fwifc_int32_t
+vpp_fwblock_get_info(
+    vpp_fwblock reader
+    , fwifc_csz       *instrument
+    , fwifc_csz       *serial
+    , fwifc_csz       *epoch
+    , fwifc_float64_t *v_group
+    , fwifc_float64_t *sampling_time
+    , fwifc_uint16_t  *flags
+    , fwifc_uint16_t  *num_facets
+)
+{
+    if (!reader)
+        return FWIFC_ERR_BAD_ARG;
+    if (!instrument || !serial || !epoch || !v_group || !sampling_time || !flags || !num_facets)
+        return reader->fail(FWIFC_ERR_BAD_ARG, "vpp_fwblock_get_info: null argument");
+    try {
+        std::lock_guard<std::mutex> lock(library_mutex);
+        fwifc_csz i = 0, s = 0, e = 0;
+        fwifc_int32_t rc = fwifc_get_info(reader->file, &i, &s, &e
+            , v_group, sampling_time, flags, num_facets);
+        if (rc != FWIFC_NO_ERROR)
+            return reader->fail(rc, library_message());
+        reader->instrument = i ? i : "";
+        reader->serial = s ? s : "";
+        reader->epoch = e ? e : "";
+        *instrument = reader->instrument.c_str();
+        *serial = reader->serial.c_str();
+        *epoch = reader->epoch.c_str();
+        return FWIFC_NO_ERROR;
+    }
+    catch (const std::exception& e) {
+        return reader->fail(FWIFC_ERR_RUNTIME, e.what());
+    }
+}
+
+fwifc_int32_t
+vpp_fwblock_get_calib(
+    vpp_fwblock reader
+    , fwifc_uint16_t          table_kind
+    , fwifc_uint32_t          *count
+    , const fwifc_float64_t*  *abscissa
+    , const fwifc_float64_t*  *ordinate
+)
+{
+    if (!reader)
+        return FWIFC_ERR_BAD_ARG;
+    if (!count || !abscissa || !ordinate)
+        return reader->fail(FWIFC_ERR_BAD_ARG, "vpp_fwblock_get_calib: null argument");
+    try {
+        std::lock_guard<std::mutex> lock(library_mutex);
+        fwifc_uint32_t n = 0;
+        fwifc_float64_t* x = 0;
+        fwifc_float64_t* y = 0;
+        fwifc_int32_t rc = fwifc_get_calib(reader->file, table_kind, &n, &x, &y);
+        if (rc != FWIFC_NO_ERROR)
+            return reader->fail(rc, library_message());
+        reader->abscissa.assign(x, x + n);
+        reader->ordinate.assign(y, y + n);
+        *count = n;
+        *abscissa = reader->abscissa.data();
+        *ordinate = reader->ordinate.data();
+        return FWIFC_NO_ERROR;
+    }
+    catch (const std::exception& e) {
+        return reader->fail(FWIFC_ERR_RUNTIME, e.what());
+    }
+}
+
+fwifc_int32_t
+vpp_fwblock_seek(vpp_fwblock reader, fwifc_uint32_t record)
+{
+    if (!reader)
+        return FWIFC_ERR_BAD_ARG;
+    std::lock_guard<std::mutex> lock(library_mutex);
+    return reader->seek(record);
+}
+
+fwifc_int32_t
+vpp_fwblock_seek_time(vpp_fwblock reader, fwifc_float64_t time)
+{
+    if (!reader)
+        return FWIFC_ERR_BAD_ARG;
+    std::lock_guard<std::mutex> lock(library_mutex);
+    fwifc_uint32_t record = 0;
+    fwifc_int32_t rc = fwifc_seek_time(reader->file, time);
+    if (rc == FWIFC_NO_ERROR)
+        rc = fwifc_tell(reader->file, &record);
+    if (rc != FWIFC_NO_ERROR)
+        return reader->fail(rc, library_message());
+    reader->pending = false;
+    if (record >= reader->begin && record < reader->end) {
+        reader->position = record;
+        return FWIFC_NO_ERROR;
+    }
+    return reader->seek(record);
+}
+
+fwifc_int32_t
+vpp_fwblock_read(
+    vpp_fwblock reader
+    , const vpp_fwblock_arrays *a
+    , fwifc_uint32_t *shots
+    , fwifc_uint32_t *sbls
+    , uint64_t *samples
+)
+{
+    if (!reader)
+        return FWIFC_ERR_BAD_ARG;
+    if (!a || !shots || !sbls || !samples)
+        return reader->fail(FWIFC_ERR_BAD_ARG, "vpp_fwblock_read: null argument");
+    *shots = 0;
+    *sbls = 0;
+    *samples = 0;
+    if (a->max_shots == 0)
+        return reader->fail(FWIFC_ERR_BAD_ARG, "vpp_fwblock_read: max_shots is 0");
+
+    try {
+        vpp_fwblock_t::shot_t& s = reader->shot;
+        fwifc_uint32_t ns = 0, nb = 0;
+        uint64_t nx = 0;
+        if (a->sbl_first)
+            a->sbl_first[0] = 0;
+        if (a->sbl_offset)
+            a->sbl_offset[0] = 0;
+
+        while (ns < a->max_shots) {
+            if (!reader->pending) {
+                fwifc_int32_t rc = reader->fetch();
+                if (rc == FWIFC_END_OF_FILE)
+                    break;
+                if (rc != FWIFC_NO_ERROR) {
+                    *shots = ns; *sbls = nb; *samples = nx;
+                    return rc;
+                }
+            }
+
+            // keep the shot for the next call if it does not fit
+            uint64_t count = sample_total(s.sbl);
+            bool sbl_fit = !(a->sbl_time || a->sbl_channel || a->sbl_offset || a->sample)
+                || nb + s.sbl.size() <= a->max_sbls;
+            bool sample_fit = !a->sample || nx + count <= a->max_samples;
+            if (!sbl_fit || !sample_fit) {
+                if (ns == 0)
+                    return reader->fail(FWIFC_ERR_BAD_ARG
+                        , "vpp_fwblock_read: shot does not fit into the arrays");
+                break;
+            }
+
+            if (a->time_sorg)
+                a->time_sorg[ns] = s.time_sorg;
+            if (a->time_external)
+                a->time_external[ns] = s.time_external;
+            if (a->origin)
+                std::copy(s.origin, s.origin + 3, a->origin + 3*ns);
+            if (a->direction)
+                std::copy(s.direction, s.direction + 3, a->direction + 3*ns);
+            if (a->flags)
+                a->flags[ns] = s.flags;
+            if (a->facet)
+                a->facet[ns] = s.facet;
+
+            for (std::size_t k=0; k<s.sbl.size(); ++k, ++nb) {
+                const fwifc_sbl_t& b = s.sbl[k];
+                if (a->sbl_time)
+                    a->sbl_time[nb] = b.time_sosbl;
+                if (a->sbl_channel)
+                    a->sbl_channel[nb] = b.channel;
+                if (a->sample && b.sample_count)
+                    std::memcpy(a->sample + nx, b.sample, b.sample_count*sizeof(fwifc_sample_t));
+                nx += b.sample_count;
+                if (a->sbl_offset)
+                    a->sbl_offset[nb+1] = nx;
+            }
+            ++ns;
+            if (a->sbl_first)
+                a->sbl_first[ns] = nb;
+            reader->pending = false;
+        }
+
+        *shots = ns;
+        *sbls = nb;
+        *samples = nx;
+        return ns ? FWIFC_NO_ERROR : FWIFC_END_OF_FILE;
+    }
+    catch (const std::exception& e) {
+        return reader->fail(FWIFC_ERR_RUNTIME, e.what());
+    }
+    catch (...) {
+        return reader->fail(FWIFC_ERR_UNKNOWN_EXCEPTION, "vpp_fwblock_read: unknown exception");
+    }
+}
+
+fwifc_int32_t
+vpp_fwblock_get_last_error(vpp_fwblock reader, fwifc_csz *message)
+{
+    if (!message)
+        return FWIFC_ERR_BAD_ARG;
+    *message = reader ? reader->message.c_str() : open_error.c_str();
+    return FWIFC_NO_ERROR;
+}
@@ -0,0 +1,328 @@
+// $Id$
+
+#include <vpp/gapprofile.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
+using namespace scanlib;
+
+namespace vpp {
+
+namespace {
+
+const double pi = 3.14159265358979323846;
+const double deg = pi/180;
+const double nan = std::numeric_limits<double>::quiet_NaN();
+
+std::size_t
+bins(double lo, double hi, double step)
+{
+    if (!(step > 0) || !(hi > lo))
+        return 0;
+    return static_cast<std::size_t>(std::ceil((hi - lo)/step - 1e-9));
+}
+
+// derivative over equally spaced samples: central differences inside,
+// one sided at the ends
+std::vector<double>
+gradient(const std::vector<double>& y, double h)
+{
+    const std::size_t n = y.size();
+    std::vector<double> d(n, nan);
+    if (n < 2)
+        return d;
+    d[0] = (y[1] - y[0])/h;
+    d[n-1] = (y[n-1] - y[n-2])/h;
+    for (std::size_t k=1; k+1<n; ++k)
+        d[k] = (y[k+1] - y[k-1])/(2*h);
+    return d;
+}
+
+void
+put(std::ostream& out, double v)
+{
+    char s[32];
+    if (std::isnan(v))
+        std::snprintf(s, sizeof(s), "nan");
+    else
+        std::snprintf(s, sizeof(s), "%.4f", v);
+    out << s;
+}
+
+} // anonymous namespace
+
+//-----------------------------------------------------------------------------
+gap_profile::gap_profile(
+    double min_zenith_
+    , double max_zenith
+    , double zenith_bin_
+    , double min_height_
+    , double max_height
+    , double height_bin_
+    , bool weighted
+)
+    : min_zenith(min_zenith_)
+    , zenith_bin(zenith_bin_)
+    , min_height(min_height_)
+    , height_bin(height_bin_)
+    , weighted_(weighted)
+{
+    const std::size_t nz = bins(min_zenith, max_zenith, zenith_bin);
+    const std::size_t nh = bins(min_height, max_height, height_bin);
+    if (nz < 1 || nh < 2)
+        throw(std::runtime_error("gap_profile: need a zenith ring and two height bins"));
+    for (std::size_t i=0; i<nz; ++i)
+        zenith.push_back(min_zenith + (i + 0.5)*zenith_bin);
+    for (std::size_t j=0; j<nh; ++j)
+        height.push_back(min_height + j*height_bin);
+    pulses_.assign(nz, 0);
+    counts.assign(nz*nh, 0);
+}
+
+int
+gap_profile::ring(double zenith_deg) const
+{
+    const double f = (zenith_deg - min_zenith)/zenith_bin;
+    if (!(f >= 0 && f < zenith.size()))
+        return -1;
+    return static_cast<int>(f);
+}
+
+void
+gap_profile::add(int ring, const double* heights, unsigned n)
+{
+    if (ring < 0 || std::size_t(ring) >= zenith.size())
+        return;
+    pulses_[ring] += 1;
+    double* c = &counts[ring*height.size()];
+    const double w = weighted_ ? 1.0/std::max(n, 1u) : 1.0;
+    // unweighted only the first echo counts
+    const unsigned echoes = weighted_ ? n : std::min(n, 1u);
+    for (unsigned k=0; k<echoes; ++k) {
+        const double f = (heights[k] - min_height)/height_bin;
+        if (f >= 0 && f < height.size())
+            c[static_cast<std::size_t>(f)] += w;
+    }
+}
+
+void
+gap_profile::merge(const gap_profile& p)
+{
+    if (p.zenith != zenith || p.height != height || p.weighted_ != weighted_)
+        throw(std::runtime_error("gap_profile: merge of different bins"));
+    for (std::size_t i=0; i<pulses_.size(); ++i)
+        pulses_[i] += p.pulses_[i];
+    for (std::size_t k=0; k<counts.size(); ++k)
+        counts[k] += p.counts[k];
+}
+
+double
+gap_profile::pgap(std::size_t ring, std::size_t h) const
+{
+    if (!(pulses_[ring] > 0))
+        return nan;
+    const double* c = &counts[ring*height.size()];
+    double sum = 0;
+    for (std::size_t j=0; j<=h; ++j)
+        sum += c[j];
+    return 1 - sum/pulses_[ring];
+}
+
+gap_profile::profiles
+gap_profile::compute() const
+{
+    const std::size_t nz = zenith.size(), nh = height.size();
+    std::vector<double> pg(nz*nh);
+    for (std::size_t i=0; i<nz; ++i) {
+        const double* c = &counts[i*nh];
+        double sum = 0;
+        for (std::size_t j=0; j<nh; ++j) {
+            sum += c[j];
+            pg[i*nh + j] = pulses_[i] > 0 ? 1 - sum/pulses_[i] : nan;
+        }
+    }
+
+    profiles p;
+
+    // linear model: -ln pgap = L_h + L_v 2 tan(zenith)/pi at every height
+    std::vector<double> xt(nz);
+    for (std::size_t i=0; i<nz; ++i)
+        xt[i] = 2*std::tan(zenith[i]*deg)/pi;
+    std::vector<double> lv(nh, 0), lh(nh, 0);
+    for (std::size_t j=0; j<nh; ++j) {
+        double sx = 0, sy = 0, sxx = 0, sxy = 0, syx = 0;
+        std::size_t m = 0;
+        for (std::size_t i=0; i<nz; ++i) {
+            const double k = -std::log(pg[i*nh + j]);
+            if (!std::isfinite(k))
+                continue;
+            sx += xt[i];
+            sy += k;
+            sxx += xt[i]*xt[i];
+            sxy += xt[i]*k;
+            syx += k/xt[i];
+            ++m;
+        }
+        if (m <= 2)
+            continue;
+        const double det = m*sxx - sx*sx;
+        if (!(std::fabs(det) > 0))
+            continue;
+        lv[j] = (m*sxy - sx*sy)/det;
+        lh[j] = (sxx*sy - sx*sxy)/det;
+        if (lv[j] < 0) {
+            lh[j] = sy/m;
+            lv[j] = 0;
+        }
+        if (lh[j] < 0) {
+            lv[j] = syx/m;
+            lh[j] = 0;
+        }
+    }
+    p.lpp_pai.resize(nh);
+    p.lpp_mla.resize(nh);
+    for (std::size_t j=0; j<nh; ++j) {
+        p.lpp_pai[j] = lv[j] + lh[j];
+        p.lpp_mla[j] = std::atan2(lv[j], lh[j])/deg;
+    }
+    p.lpp_pavd = gradient(p.lpp_pai, height_bin);
+
+    // hinge angle, where G/cos(zenith) hardly depends on the leaf angles
+    std::size_t hinge = 0;
+    for (std::size_t i=1; i<nz; ++i)
+        if (std::fabs(zenith[i]*deg - std::atan(pi/2)) < std::fabs(zenith[hinge]*deg - std::atan(pi/2)))
+            hinge = i;
+    p.hpp_pai.resize(nh);
+    double total = 0;
+    for (std::size_t j=0; j<nh; ++j) {
+        p.hpp_pai[j] = -1.1*std::log(pg[hinge*nh + j]);
+        if (p.hpp_pai[j] > total)
+            total = p.hpp_pai[j];
+    }
+
+    // solid angle weighted ratio of -ln pgap to its value at the top
+    std::vector<double> wn(nz, 0);
+    double wsum = 0;
+    for (std::size_t i=0; i<nz; ++i)
+        if (pg[i*nh + nh-1] < 1) {
+            wn[i] = 2*pi*std::sin(zenith[i]*deg)*zenith_bin*deg;
+            wsum += wn[i];
+        }
+    std::vector<double> ratio(nh, 0);
+    for (std::size_t i=0; i<nz; ++i) {
+        if (wn[i] == 0)
+            continue;
+        const double top = std::log(pg[i*nh + nh-1]);
+        for (std::size_t j=0; j<nh; ++j)
+            ratio[j] += wn[i]/wsum*std::log(pg[i*nh + j])/top;
+    }
+    p.sapp_pai.resize(nh);
+    for (std::size_t j=0; j<nh; ++j)
+        p.sapp_pai[j] = total*ratio[j];
+    p.sapp_pavd = gradient(p.sapp_pai, height_bin);
+    return p;
+}
+
+void
+gap_profile::write(std::ostream& out) const
+{
+    const profiles p = compute();
+    out << "height";
+    for (std::size_t i=0; i<zenith.size(); ++i) {
+        char s[32];
+        std::snprintf(s, sizeof(s), ",vz%05d", static_cast<int>(std::floor(zenith[i]*100 + 0.5)));
+        out << s;
+    }
+    out << ",lpp_pai,lpp_pavd,lpp_mla,sapp_pai,sapp_pavd\n";
+    for (std::size_t j=0; j<height.size(); ++j) {
+        put(out, height[j]);
+        for (std::size_t i=0; i<zenith.size(); ++i) {
+            out << ',';
+            put(out, pgap(i, j));
+        }
+        const double v[5] = { p.lpp_pai[j], p.lpp_pavd[j], p.lpp_mla[j], p.sapp_pai[j], p.sapp_pavd[j] };
+        for (unsigned k=0; k<5; ++k) {
+            out << ',';
+            put(out, v[k]);
+        }
+        out << '\n';
+    }
+}
+
+void
+gap_profile::write(const std::string& path) const
+{
+    std::ofstream out(path.c_str());
+    write(out);
+    out.close();
+    if (!out)
+        throw(std::runtime_error("gap_profile: cannot write " + path));
+}
+
+//-----------------------------------------------------------------------------
+gap_pointcloud::gap_pointcloud(
+    gap_profile& profile_
+    , const plane_fit& plane_
+    , double min_zenith_
+    , double max_zenith_
+    , bool sync_to_pps
+)
+    : project_pointcloud(sync_to_pps)
+    , shots(0)
+    , profile(profile_)
+    , plane(plane_)
+    , min_zenith(min_zenith_)
+    , max_zenith(max_zenith_)
+    , pending(-1)
+{
+}
+
+void
+gap_pointcloud::flush()
+{
+    if (pending < 0)
+        return;
+    profile.add(pending, 0, 0);
+    pending = -1;
+}
+
+void
+gap_pointcloud::on_shot()
+{
+    flush();
+    project_pointcloud::on_shot();
+    const double z = std::max(-1.0, std::min(1.0, beam_direction[2]));
+    const double zenith = std::acos(z)/deg;
+    if (zenith < min_zenith || zenith >= max_zenith)
+        return;
+    pending = profile.ring(zenith);
+    if (pending >= 0)
+        ++shots;
+}
+
+void
+gap_pointcloud::on_shot_end()
+{
+    project_pointcloud::on_shot_end();
+    if (pending < 0)
+        return;
+    // targets are in echo order, the first one is the first echo
+    heights.resize(target_count);
+    for (unsigned k=0; k<target_count; ++k) {
+        const target& t = targets[k];
+        heights[k] = plane.height(
+            t.vertex[0] + offset()[0]
+            , t.vertex[1] + offset()[1]
+            , t.vertex[2] + offset()[2]
+        );
+    }
+    profile.add(pending, heights.data(), target_count);
+    pending = -1;
+}
+
+} // namespace vpp
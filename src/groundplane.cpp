@@ -0,0 +1,454 @@
+// $Id$
+
+#include <vpp/groundplane.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
+using namespace scanlib;
+
+namespace vpp {
+
+namespace {
+
+const double huber_t = 1.345;
+const double mad_norm = 0.6744897501960817;   // Gaussian quantile at 3/4
+const double z_975 = 1.959963984540054;
+const double tolerance = 1e-8;
+const unsigned max_iterations = 50;
+
+double
+median(std::vector<double>& v)
+{
+    const std::size_t h = v.size()/2;
+    std::nth_element(v.begin(), v.begin() + h, v.end());
+    double m = v[h];
+    if (v.size() % 2 == 0)
+        m = 0.5*(m + *std::max_element(v.begin(), v.begin() + h));
+    return m;
+}
+
+// median absolute deviation around 0
+double
+mad(const std::vector<double>& r)
+{
+    std::vector<double> a(r.size());
+    for (std::size_t k=0; k<r.size(); ++k)
+        a[k] = std::fabs(r[k]);
+    return median(a)/mad_norm;
+}
+
+double
+rho(double z)
+{
+    const double a = std::fabs(z);
+    return a <= huber_t ? 0.5*z*z : huber_t*a - 0.5*huber_t*huber_t;
+}
+
+// criterion of convergence as in statsmodels: the residuals are scaled by
+// the variance of the weighted fit, not by the robust scale
+double
+irls_deviance(const std::vector<double>& r, const std::vector<double>& w)
+{
+    double ss = 0;
+    for (std::size_t k=0; k<r.size(); ++k)
+        ss += w[k]*r[k]*r[k];
+    const double s = ss/(double(r.size()) - 3);
+    double d = 0;
+    for (std::size_t k=0; k<r.size(); ++k)
+        d += rho(r[k]/s);
+    return d;
+}
+
+double
+psi(double z)
+{
+    return std::fabs(z) <= huber_t ? z : (z < 0 ? -huber_t : huber_t);
+}
+
+double
+psi_deriv(double z)
+{
+    return std::fabs(z) <= huber_t ? 1 : 0;
+}
+
+// inverse of a symmetric 3x3 matrix
+bool
+invert(const double a[3][3], double b[3][3])
+{
+    b[0][0] = a[1][1]*a[2][2] - a[1][2]*a[2][1];
+    b[0][1] = a[0][2]*a[2][1] - a[0][1]*a[2][2];
+    b[0][2] = a[0][1]*a[1][2] - a[0][2]*a[1][1];
+    b[1][0] = a[1][2]*a[2][0] - a[1][0]*a[2][2];
+    b[1][1] = a[0][0]*a[2][2] - a[0][2]*a[2][0];
+    b[1][2] = a[0][2]*a[1][0] - a[0][0]*a[1][2];
+    b[2][0] = a[1][0]*a[2][1] - a[1][1]*a[2][0];
+    b[2][1] = a[0][1]*a[2][0] - a[0][0]*a[2][1];
+    b[2][2] = a[0][0]*a[1][1] - a[0][1]*a[1][0];
+    const double det = a[0][0]*b[0][0] + a[0][1]*b[1][0] + a[0][2]*b[2][0];
+    if (!(std::fabs(det) > 0) || !std::isfinite(det))
+        return false;
+    for (unsigned i=0; i<3; ++i)
+        for (unsigned j=0; j<3; ++j)
+            b[i][j] /= det;
+    return true;
+}
+
+// weighted least squares, returns the residuals
+void
+wls(
+    const double* x
+    , const double* y
+    , const double* z
+    , const std::vector<double>& w
+    , double p[3]
+    , std::vector<double>& r
+)
+{
+    double a[3][3] = {{ 0 }}, v[3] = { 0 };
+    for (std::size_t k=0; k<r.size(); ++k) {
+        const double row[3] = { 1, x[k], y[k] };
+        for (unsigned i=0; i<3; ++i) {
+            for (unsigned j=0; j<3; ++j)
+                a[i][j] += w[k]*row[i]*row[j];
+            v[i] += w[k]*row[i]*z[k];
+        }
+    }
+    double b[3][3];
+    if (!invert(a, b))
+        throw(std::runtime_error("plane_fit: singular design"));
+    for (unsigned i=0; i<3; ++i)
+        p[i] = b[i][0]*v[0] + b[i][1]*v[1] + b[i][2]*v[2];
+    for (std::size_t k=0; k<r.size(); ++k)
+        r[k] = z[k] - (p[0] + p[1]*x[k] + p[2]*y[k]);
+}
+
+// number formats of the statsmodels summary tables
+std::string
+forg(double v, unsigned prec)
+{
+    char s[32];
+    const double a = std::fabs(v);
+    if (a >= 1e4 || a < 1e-4)
+        std::snprintf(s, sizeof(s), prec == 4 ? "%10.4g" : "%9.3g", v);
+    else
+        std::snprintf(s, sizeof(s), prec == 4 ? "%10.4f" : "%9.3f", v);
+    return s;
+}
+
+std::string
+pad_left(const std::string& s, std::size_t w)
+{
+    return s.size() < w ? std::string(w - s.size(), ' ') + s : s;
+}
+
+std::string
+pad_right(const std::string& s, std::size_t w)
+{
+    return s.size() < w ? s + std::string(w - s.size(), ' ') : s;
+}
+
+// label and right aligned value filling w characters
+std::string
+field(const std::string& label, const std::string& value, std::size_t w)
+{
+    if (label.empty())
+        return std::string(w, ' ');
+    return label + pad_left(value, w - std::min(w, label.size()));
+}
+
+} // anonymous namespace
+
+//-----------------------------------------------------------------------------
+ground_grid::ground_grid()
+    : points(0)
+    , x0(0)
+    , y0(0)
+    , cell_(1)
+    , nx_(0)
+    , ny_(0)
+{
+}
+
+ground_grid::ground_grid(double x0_, double y0_, double cell, uint32_t nx, uint32_t ny)
+    : points(0)
+    , x0(x0_)
+    , y0(y0_)
+    , cell_(cell)
+    , nx_(nx)
+    , ny_(ny)
+    , zmin(std::size_t(nx)*ny, std::numeric_limits<double>::infinity())
+{
+    if (!(cell > 0))
+        throw(std::runtime_error("ground_grid: cell size must be positive"));
+}
+
+void
+ground_grid::add(double x, double y, double z)
+{
+    const double fi = (x - x0)/cell_;
+    const double fj = (y - y0)/cell_;
+    if (!(fi >= 0 && fi < nx_ && fj >= 0 && fj < ny_))
+        return;
+    double& m = zmin[static_cast<std::size_t>(fi) + std::size_t(nx_)*static_cast<std::size_t>(fj)];
+    m = std::min(m, z);
+    ++points;
+}
+
+std::size_t
+ground_grid::occupied() const
+{
+    std::size_t n = 0;
+    for (std::size_t k=0; k<zmin.size(); ++k)
+        n += std::isfinite(zmin[k]);
+    return n;
+}
+
+void
+ground_grid::cells(std::vector<double>& x, std::vector<double>& y, std::vector<double>& z) const
+{
+    x.clear();
+    y.clear();
+    z.clear();
+    for (uint32_t j=0; j<ny_; ++j)
+        for (uint32_t i=0; i<nx_; ++i) {
+            const double m = zmin[i + std::size_t(nx_)*j];
+            if (!std::isfinite(m))
+                continue;
+            x.push_back(x0 + (i + 0.5)*cell_);
+            y.push_back(y0 + (j + 0.5)*cell_);
+            z.push_back(m);
+        }
+}
+
+//-----------------------------------------------------------------------------
+plane_fit::plane_fit()
+    : scale(0)
+    , deviance(0)
+    , iterations(0)
+    , observations(0)
+{
+    for (unsigned i=0; i<3; ++i)
+        params[i] = bse[i] = 0;
+}
+
+plane_fit
+plane_fit::huber(const double* x, const double* y, const double* z, std::size_t n)
+{
+    if (n < 4)
+        throw(std::runtime_error("plane_fit: too few observations"));
+
+    // centred coordinates keep the normal equations well conditioned for
+    // project coordinates, and centred elevations keep the rounding of the
+    // residuals well below the convergence tolerance; the fit is the same
+    double mx = 0, my = 0, mz = 0;
+    for (std::size_t k=0; k<n; ++k) {
+        mx += x[k];
+        my += y[k];
+        mz += z[k];
+    }
+    mx /= n;
+    my /= n;
+    mz /= n;
+    std::vector<double> xc(n), yc(n), zc(n);
+    for (std::size_t k=0; k<n; ++k) {
+        xc[k] = x[k] - mx;
+        yc[k] = y[k] - my;
+        zc[k] = z[k] - mz;
+    }
+    x = xc.data();
+    y = yc.data();
+    z = zc.data();
+
+    plane_fit f;
+    f.observations = n;
+    std::vector<double> w(n, 1.0), r(n);
+
+    // start from ordinary least squares
+    wls(x, y, z, w, f.params, r);
+    f.scale = mad(r);
+
+    double previous = irls_deviance(r, w);
+    unsigned iteration = 1;
+    for (;;) {
+        if (f.scale == 0)
+            break;
+        for (std::size_t k=0; k<n; ++k) {
+            const double a = std::fabs(r[k]/f.scale);
+            w[k] = a <= huber_t ? 1 : huber_t/a;
+        }
+        wls(x, y, z, w, f.params, r);
+        f.scale = mad(r);
+        const double d = irls_deviance(r, w);
+        ++iteration;
+        const bool converged = !(std::fabs(d - previous) > tolerance && iteration < max_iterations);
+        previous = d;
+        if (converged)
+            break;
+    }
+    f.iterations = iteration;
+    f.deviance = previous;
+
+    // H1 covariance: Huber's correction on the unweighted (X'X)^-1
+    double xtx[3][3] = {{ 0 }}, inv[3][3];
+    double m = 0, m2 = 0, ss_psi = 0;
+    for (std::size_t k=0; k<n; ++k) {
+        const double row[3] = { 1, x[k], y[k] };
+        for (unsigned i=0; i<3; ++i)
+            for (unsigned j=0; j<3; ++j)
+                xtx[i][j] += row[i]*row[j];
+        const double s = f.scale > 0 ? r[k]/f.scale : 0;
+        const double d = psi_deriv(s);
+        m += d;
+        m2 += d*d;
+        ss_psi += psi(s)*psi(s);
+    }
+    if (!invert(xtx, inv))
+        throw(std::runtime_error("plane_fit: singular design"));
+    const double s_psi_deriv = m;
+    m /= n;
+    const double var_psi_deriv = m2/n - m*m;
+    const double df_model = 2, df_resid = double(n) - 3;
+    const double k = m > 0 ? 1 + (df_model + 1)/n*var_psi_deriv/(m*m) : 0;
+    const double h = s_psi_deriv > 0
+        ? k*k*(ss_psi/df_resid*f.scale*f.scale)/((s_psi_deriv/n)*(s_psi_deriv/n))
+        : std::numeric_limits<double>::quiet_NaN();
+    // back to the intercept at the origin: a = a' + mz - b*mx - c*my
+    const double g[3] = { 1, -mx, -my };
+    double var_a = 0;
+    for (unsigned i=0; i<3; ++i)
+        for (unsigned j=0; j<3; ++j)
+            var_a += g[i]*inv[i][j]*g[j];
+    f.params[0] += mz - (f.params[1]*mx + f.params[2]*my);
+    f.bse[0] = std::sqrt(h*var_a);
+    for (unsigned i=1; i<3; ++i)
+        f.bse[i] = std::sqrt(h*inv[i][i]);
+    return f;
+}
+
+void
+plane_fit::report(std::ostream& out) const
+{
+    const std::size_t width = 78;
+    const std::string rule(width, '='), thin(width, '-');
+
+    char date[64], clock[64];
+    const std::time_t now = std::time(0);
+    const std::tm* lt = std::localtime(&now);
+    std::strftime(date, sizeof(date), "%a, %d %b %Y", lt);
+    std::strftime(clock, sizeof(clock), "%H:%M:%S", lt);
+
+    char n[32], df_resid[32], its[32];
+    std::snprintf(n, sizeof(n), "%lu", static_cast<unsigned long>(observations));
+    std::snprintf(df_resid, sizeof(df_resid), "%lu", static_cast<unsigned long>(observations - 3));
+    std::snprintf(its, sizeof(its), "%u", iterations);
+
+    const char* left[][2] = {
+        { "Dep. Variable:", "y" },
+        { "Model:", "RLM" },
+        { "Method:", "IRLS" },
+        { "Norm:", "HuberT" },
+        { "Scale Est.:", "mad" },
+        { "Cov Type:", "H1" },
+        { "Date:", date },
+        { "Time:", clock },
+        { "No. Iterations:", its }
+    };
+    const char* right[][2] = {
+        { "No. Observations:", n },
+        { "Df Residuals:", df_resid },
+        { "Df Model:", "2" }
+    };
+
+    const std::string title = "Robust Linear Model Regression Results";
+    const std::size_t indent = (width - title.size())/2;
+    out << pad_right(std::string(indent, ' ') + title, width) << '\n';
+    out << rule << '\n';
+    for (unsigned k=0; k<9; ++k) {
+        out << field(left[k][0], left[k][1], 37) << "   ";
+        out << (k < 3 ? field(right[k][0], right[k][1], 38) : std::string(38, ' ')) << '\n';
+    }
+    out << rule << '\n';
+    out << pad_left("coef", 21) << pad_left("std err", 11) << pad_left("z", 11)
+        << pad_left("P>|z|", 11) << pad_left("[0.025", 12) << pad_left("0.975]", 12) << '\n';
+    out << thin << '\n';
+    const char* names[3] = { "const", "x1", "x2" };
+    for (unsigned i=0; i<3; ++i) {
+        const double z = params[i]/bse[i];
+        char p[32];
+        std::snprintf(p, sizeof(p), "%#6.3f", std::erfc(std::fabs(z)/std::sqrt(2.0)));
+        out << pad_right(names[i], 10) << pad_left(forg(params[i], 4), 11)
+            << pad_left(forg(bse[i], 3), 11) << pad_left(forg(z, 3), 11)
+            << pad_left(p, 11) << pad_left(forg(params[i] - z_975*bse[i], 3), 12)
+            << pad_left(forg(params[i] + z_975*bse[i], 3), 12) << '\n';
+    }
+    out << rule << '\n';
+    out << "\nIf the model instance has been used for another fit with different fit"
+        " parameters, then the fit options might not be the correct ones anymore .\n";
+}
+
+void
+plane_fit::report(const std::string& path) const
+{
+    std::ofstream out(path.c_str());
+    report(out);
+    out.close();
+    if (!out)
+        throw(std::runtime_error("plane_fit: cannot write " + path));
+}
+
+//-----------------------------------------------------------------------------
+plane_pointcloud::plane_pointcloud(double extent_, double cell_, bool sync_to_pps)
+    : project_pointcloud(sync_to_pps)
+    , extent(extent_)
+    , cell(cell_)
+    , placed(false)
+{
+    if (!(cell > 0) || !(extent >= cell))
+        throw(std::runtime_error("plane_pointcloud: invalid grid size"));
+}
+
+void
+plane_pointcloud::set_grid_centre(double x, double y)
+{
+    const uint32_t n = static_cast<uint32_t>(std::ceil(extent/cell));
+    grid_ = ground_grid(x - 0.5*n*cell, y - 0.5*n*cell, cell, n, n);
+    placed = true;
+}
+
+plane_fit
+plane_pointcloud::fit() const
+{
+    std::vector<double> x, y, z;
+    grid_.cells(x, y, z);
+    return plane_fit::huber(x.data(), y.data(), z.data(), z.size());
+}
+
+void
+plane_pointcloud::on_shot()
+{
+    project_pointcloud::on_shot();
+    if (!placed)
+        set_grid_centre(beam_origin[0] + offset()[0], beam_origin[1] + offset()[1]);
+}
+
+void
+plane_pointcloud::on_echo_transformed(echo_type echo)
+{
+    project_pointcloud::on_echo_transformed(echo);
+    if (echo != single && echo != last)
+        return;
+    const target& t = targets[target_count - 1];
+    grid_.add(
+        t.vertex[0] + offset()[0]
+        , t.vertex[1] + offset()[1]
+        , t.vertex[2] + offset()[2]
+    );
+}
+
+} // namespace vpp
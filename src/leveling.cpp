@@ -0,0 +1,203 @@
+// $Id$
+
+#include <vpp/leveling.hpp>
+
+#include <riegl/connection.hpp>
+#include <riegl/rxpmarker.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+using namespace scanlib;
+
+namespace vpp {
+
+namespace {
+
+const double deg = 3.14159265358979323846/180;
+
+} // anonymous namespace
+
+//-----------------------------------------------------------------------------
+leveling_estimate::leveling_estimate()
+{
+    clear();
+}
+
+void
+leveling_estimate::clear()
+{
+    sum[0] = sum[1] = sum[2] = 0;
+    count = 0;
+}
+
+void
+leveling_estimate::add_vector(const double v[3])
+{
+    double n = std::sqrt(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
+    if (!(n > 0) || !std::isfinite(n))
+        return;
+    if (v[2] < 0)
+        n = -n;
+    for (unsigned i=0; i<3; ++i)
+        sum[i] += v[i]/n;
+    ++count;
+}
+
+void
+leveling_estimate::add_tilt(double x_deg, double y_deg)
+{
+    double v[3];
+    v[0] = std::sin(x_deg*deg);
+    v[1] = std::sin(y_deg*deg);
+    v[2] = std::sqrt(std::max(0.0, 1 - v[0]*v[0] - v[1]*v[1]));
+    add_vector(v);
+}
+
+void
+leveling_estimate::up(double u[3]) const
+{
+    double n = std::sqrt(sum[0]*sum[0] + sum[1]*sum[1] + sum[2]*sum[2]);
+    if (!(n > 0)) {
+        u[0] = u[1] = 0;
+        u[2] = 1;
+        return;
+    }
+    for (unsigned i=0; i<3; ++i)
+        u[i] = sum[i]/n;
+}
+
+double
+leveling_estimate::tilt() const
+{
+    double u[3];
+    up(u);
+    return std::acos(std::min(1.0, u[2]))/deg;
+}
+
+rigid_transform
+leveling_estimate::transform() const
+{
+    double u[3];
+    up(u);
+
+    // rotation about a = u x z by the angle between u and z (Rodrigues)
+    const double a[3] = { u[1], -u[0], 0 };
+    const double s2 = a[0]*a[0] + a[1]*a[1];
+    const double c = u[2];
+    rigid_transform t;
+    if (!(s2 > 0))
+        return t;
+    const double k = (1 - c)/s2;
+    const double K[3][3] = {
+        {     0, -a[2],  a[1] },
+        {  a[2],     0, -a[0] },
+        { -a[1],  a[0],     0 }
+    };
+    for (unsigned i=0; i<3; ++i)
+        for (unsigned j=0; j<3; ++j) {
+            double kk = 0;
+            for (unsigned l=0; l<3; ++l)
+                kk += K[i][l]*K[l][j];
+            t.m[i][j] = (i == j ? 1.0 : 0.0) + K[i][j] + k*kk;
+        }
+    return t;
+}
+
+//-----------------------------------------------------------------------------
+leveling_probe::leveling_probe(std::size_t max_samples_, uint64_t max_bytes_)
+    : max_samples(max_samples_)
+    , max_bytes(max_bytes_)
+{
+    selector = select_protocol;
+    selector.set(package_id::gravity_socs);
+    selector.set(package_id::inclination_static);
+}
+
+leveling_estimate
+leveling_probe::probe(const std::string& uri)
+{
+    estimate.clear();
+
+    std::shared_ptr<basic_rconnection> rc = basic_rconnection::create(uri);
+    rc->open();
+    decoder_rxpmarker dec(rc);
+    buffer buf;
+    for (dec.get(buf); !dec.eoi(); dec.get(buf)) {
+        dispatch(buf.begin(), buf.end());
+        if (estimate.samples() >= max_samples)
+            break;
+        if (uint64_t(rc->tellg()) > max_bytes)
+            break;
+    }
+    rc->close();
+
+    if (estimate.samples() == 0)
+        throw(std::runtime_error("leveling_probe: no inclination data in " + uri));
+    return estimate;
+}
+
+void
+leveling_probe::on_gravity_socs(const gravity_socs<iterator_type>& arg)
+{
+    basic_packets::on_gravity_socs(arg);
+    const double g[3] = { arg.gravity[0], arg.gravity[1], arg.gravity[2] };
+    estimate.add_vector(g);
+}
+
+void
+leveling_probe::on_inclination_static(const inclination_static<iterator_type>& arg)
+{
+    basic_packets::on_inclination_static(arg);
+    estimate.add_tilt(arg.angle_axis_0, arg.angle_axis_1);
+}
+
+//-----------------------------------------------------------------------------
+level_pointcloud::level_pointcloud(bool sync_to_pps, std::size_t min_samples_)
+    : project_pointcloud(sync_to_pps)
+    , shots_unlevelled(0)
+    , min_samples(std::max<std::size_t>(min_samples_, 1))
+    , fixed(false)
+{
+}
+
+void
+level_pointcloud::on_shot()
+{
+    if (!fixed)
+        ++shots_unlevelled;
+    project_pointcloud::on_shot();
+}
+
+void
+level_pointcloud::update()
+{
+    if (fixed || estimate_.samples() < min_samples)
+        return;
+    set_transform(post*estimate_.transform());
+    fixed = true;
+}
+
+void
+level_pointcloud::on_gravity_socs(const gravity_socs<iterator_type>& arg)
+{
+    project_pointcloud::on_gravity_socs(arg);
+    if (fixed)
+        return;
+    const double g[3] = { arg.gravity[0], arg.gravity[1], arg.gravity[2] };
+    estimate_.add_vector(g);
+    update();
+}
+
+void
+level_pointcloud::on_inclination_static(const inclination_static<iterator_type>& arg)
+{
+    project_pointcloud::on_inclination_static(arg);
+    if (fixed)
+        return;
+    estimate_.add_tilt(arg.angle_axis_0, arg.angle_axis_1);
+    update();
+}
+
+} // namespace vpp
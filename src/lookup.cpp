@@ -0,0 +1,199 @@
+// $Id$
+
+#include <vpp/lookup.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+using namespace scanlib;
+
+namespace vpp {
+
+namespace {
+
+#if defined(__GNUC__)
+#define VPP_NOINLINE __attribute__((noinline))
+#else
+#define VPP_NOINLINE
+#endif
+
+// dense table evaluation with gathers from value and slope. gcc needs to
+// know that out never overlaps the tables, which it only keeps as long as
+// the loop is not inlined into evaluate(). The index is clamped as an
+// integer and NaN arguments are blended in at the end, there is no other
+// control flow in the loop.
+template<class in_type, class out_type>
+VPP_NOINLINE void
+dense_evaluate(
+    const in_type* in
+    , out_type* out
+    , std::size_t n
+    , const float* __restrict value
+    , const float* __restrict slope
+    , std::size_t size
+    , float origin
+    , float inv_step
+)
+{
+    const int last = static_cast<int>(size - 1);
+    const float hi = static_cast<float>(last);
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    for (std::size_t k=0; k<n; ++k) {
+        const float a = static_cast<float>(in[k]);
+        // clamped in float first so that the conversion cannot overflow,
+        // std::max(0, NaN) is 0
+        const float u = std::min(std::max(0.0f, (a - origin)*inv_step), hi);
+        const int i = std::min(static_cast<int>(u), last);
+        // NaN added rather than selected, gcc does not if-convert the
+        // select when out_type is double
+        const float r = value[i] + (u - static_cast<float>(i))*slope[i];
+        out[k] = static_cast<out_type>(r + (std::isnan(a) ? nan : 0.0f));
+    }
+}
+
+} // anonymous namespace
+
+//-----------------------------------------------------------------------------
+lookup_evaluator::lookup_evaluator()
+    : origin(0)
+    , inv_step(0)
+    , error(0)
+{
+}
+
+lookup_evaluator::lookup_evaluator(const wave::lookup_table& t, std::size_t dense)
+    : origin(0)
+    , inv_step(0)
+    , error(0)
+{
+    assign(t, dense);
+}
+
+void
+lookup_evaluator::assign(const wave::lookup_table& t, std::size_t dense)
+{
+    std::size_t n = std::min(t.abscissa.size(), t.ordinate.size());
+    std::vector<std::pair<double, double> > knots;
+    knots.reserve(n);
+    for (std::size_t k=0; k<n; ++k) {
+        double a = t.abscissa[k]*t.abscissa_scale + t.abscissa_offset;
+        double o = t.ordinate[k]*t.ordinate_scale + t.ordinate_offset;
+        if (std::isfinite(a) && std::isfinite(o))
+            knots.push_back(std::make_pair(a, o));
+    }
+    std::stable_sort(knots.begin(), knots.end()
+        , [](const std::pair<double, double>& l, const std::pair<double, double>& r) {
+            return l.first < r.first;
+        });
+
+    // repeated abscissa values keep the last ordinate
+    x.clear();
+    y.clear();
+    for (std::size_t k=0; k<knots.size(); ++k) {
+        if (!x.empty() && x.back() == knots[k].first) {
+            y.back() = knots[k].second;
+            continue;
+        }
+        x.push_back(knots[k].first);
+        y.push_back(knots[k].second);
+    }
+
+    value.clear();
+    slope.clear();
+    origin = 0;
+    inv_step = 0;
+    error = 0;
+    if (dense > 0)
+        resample(dense);
+}
+
+void
+lookup_evaluator::resample(std::size_t n)
+{
+    if (n < 2)
+        throw(std::invalid_argument("lookup_evaluator: dense table needs two entries"));
+    if (n > std::size_t(std::numeric_limits<int>::max()))
+        throw(std::invalid_argument("lookup_evaluator: dense table too large"));
+    if (x.empty())
+        throw(std::logic_error("lookup_evaluator: empty curve"));
+
+    double step = (x.back() - x.front())/double(n - 1);
+    origin = static_cast<float>(x.front());
+    inv_step = step > 0 ? static_cast<float>(1/step) : 0.0f;
+
+    value.resize(n);
+    slope.resize(n);
+    for (std::size_t k=0; k<n; ++k)
+        value[k] = static_cast<float>((*this)(x.front() + double(k)*step));
+    for (std::size_t k=0; k+1<n; ++k)
+        slope[k] = value[k+1] - value[k];
+    slope[n-1] = 0;
+
+    std::vector<double> at(x.size());
+    evaluate(x.data(), at.data(), at.size());
+    error = 0;
+    for (std::size_t k=0; k<x.size(); ++k)
+        error = std::max(error, std::fabs(at[k] - y[k]));
+}
+
+double
+lookup_evaluator::operator()(double arg) const
+{
+    if (x.empty() || arg != arg)
+        return std::numeric_limits<double>::quiet_NaN();
+    if (arg <= x.front())
+        return y.front();
+    if (arg >= x.back())
+        return y.back();
+    std::size_t i = std::upper_bound(x.begin(), x.end(), arg) - x.begin();
+    double f = (arg - x[i-1])/(x[i] - x[i-1]);
+    return y[i-1] + f*(y[i] - y[i-1]);
+}
+
+void
+lookup_evaluator::evaluate(const double* in, double* out, std::size_t n) const
+{
+    if (value.empty()) {
+        for (std::size_t k=0; k<n; ++k)
+            out[k] = (*this)(in[k]);
+        return;
+    }
+    dense_evaluate(in, out, n, value.data(), slope.data(), value.size(), origin, inv_step);
+}
+
+void
+lookup_evaluator::evaluate(const float* in, float* out, std::size_t n) const
+{
+    if (value.empty()) {
+        for (std::size_t k=0; k<n; ++k)
+            out[k] = static_cast<float>((*this)(in[k]));
+        return;
+    }
+    dense_evaluate(in, out, n, value.data(), slope.data(), value.size(), origin, inv_step);
+}
+
+void
+lookup_evaluator::evaluate(const uint16_t* in, float* out, std::size_t n) const
+{
+    if (value.empty()) {
+        for (std::size_t k=0; k<n; ++k)
+            out[k] = static_cast<float>((*this)(in[k]));
+        return;
+    }
+    dense_evaluate(in, out, n, value.data(), slope.data(), value.size(), origin, inv_step);
+}
+
+//-----------------------------------------------------------------------------
+void
+wave_calibration::assign(const wave& w, std::size_t dense)
+{
+    amplitude_low_power.assign(w.amplitude_low_power, dense);
+    amplitude_high_power.assign(w.amplitude_high_power, dense);
+    position_diff_low_power.assign(w.position_diff_low_power, dense);
+    position_diff_high_power.assign(w.position_diff_high_power, dense);
+}
+
+} // namespace vpp
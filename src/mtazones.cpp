@@ -0,0 +1,170 @@
+// $Id$
+
+#include <vpp/mtazones.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+using namespace scanlib;
+
+namespace vpp {
+
+double
+near_range::apply(double range) const
+{
+    if (size < 2 || !(range > 0))
+        return range;
+    const double x = range/step;
+    if (!(x < size - 1))
+        return range;
+    const std::size_t i = static_cast<std::size_t>(x);
+    return range + values[i] + (x - i)*(values[i+1] - values[i]);
+}
+
+double
+near_range::remove(double range) const
+{
+    // the correction is small and smooth against the range, a few fixed
+    // point steps of raw = range - table(raw) converge
+    double raw = range;
+    for (unsigned k=0; k<4; ++k)
+        raw = range - (apply(raw) - raw);
+    return raw;
+}
+
+void
+mta_transform(
+    const target* in
+    , std::size_t n
+    , unsigned zone
+    , double zone_width
+    , const double origin[3]
+    , const double direction[3]
+    , target* out
+    , const reflectance_table* reflectance
+    , const near_range* near
+)
+{
+    if (out != in)
+        std::copy(in, in + n, out);
+
+    // in blocks, so the reflectance is moved by one call per block
+    const std::size_t block = 64;
+    double from[block], to[block];
+    float refl[block];
+    for (std::size_t b=0; b<n; b+=block) {
+        const std::size_t m = std::min(block, n - b);
+        for (std::size_t k=0; k<m; ++k) {
+            target& t = out[b + k];
+            from[k] = t.echo_range;
+            double r = near ? near->remove(t.echo_range) : t.echo_range;
+            r += (double(zone) - double(t.zone_index + 1))*zone_width;
+            t.echo_range = near ? near->apply(r) : r;
+            t.zone_index = static_cast<unsigned short>(zone - 1);
+            for (unsigned i=0; i<3; ++i)
+                t.vertex[i] = static_cast<float>(origin[i] + t.echo_range*direction[i]);
+            to[k] = t.echo_range;
+            refl[k] = t.reflectance;
+        }
+        if (reflectance)
+            reflectance->move(from, to, m, refl);
+        for (std::size_t k=0; k<m; ++k)
+            out[b + k].reflectance = reflectance ? refl[k] : std::numeric_limits<float>::quiet_NaN();
+    }
+}
+
+//-----------------------------------------------------------------------------
+mta_pointcloud::mta_pointcloud(const std::vector<unsigned>& zones, bool sync_to_pps)
+    : reflectance_pointcloud(sync_to_pps)
+    , resolve(false)
+    , history(8)
+    , zone_changes(0)
+    , previous(0)
+    , seen(false)
+{
+    if (zones.empty())
+        throw(std::runtime_error("mta_pointcloud: no zones"));
+    for (std::size_t k=0; k<zones.size(); ++k)
+        if (zones[k] == 0)
+            throw(std::runtime_error("mta_pointcloud: zones count from 1"));
+    current.zones = zones;
+    current.offset.assign(zones.size() + 1, 0);
+    current.resolved = 0;
+}
+
+void
+mta_pointcloud::on_shot_end()
+{
+    reflectance_pointcloud::on_shot_end();
+
+    const std::size_t n = target_count;
+    const near_range near(nrange_delta, nrange.data(), nrange.size());
+    const std::size_t m = current.zones.size();
+    current.targets.resize(n*m);
+    for (std::size_t k=0; k<m; ++k) {
+        current.offset[k] = k*n;
+        mta_transform(targets.data(), n, current.zones[k], unambiguous_range
+            , beam_origin, beam_direction, current.targets.data() + k*n
+            , &reflectance(), &near);
+    }
+    current.offset[m] = n*m;
+
+    std::size_t r = choose();
+    if (r != previous && seen)
+        ++zone_changes;
+    seen = seen || n > 0;
+    previous = r;
+    current.resolved = r;
+    on_shot_zones();
+}
+
+std::size_t
+mta_pointcloud::choose()
+{
+    const std::size_t n = target_count;
+    const std::size_t m = current.zones.size();
+
+    // the standard zone, or the first candidate if it is none
+    std::size_t standard = 0;
+    if (n > 0) {
+        const unsigned zone = targets[0].zone_index + 1u;
+        for (std::size_t k=0; k<m; ++k)
+            if (current.zones[k] == zone)
+                standard = k;
+    }
+    if (n == 0)
+        return previous;
+    if (!resolve)
+        return standard;
+
+    std::size_t best = standard;
+    if (history > 0 && ranges.size() >= history) {
+        sorted.assign(ranges.begin(), ranges.end());
+        std::nth_element(sorted.begin(), sorted.begin() + sorted.size()/2, sorted.end());
+        const double median = sorted[sorted.size()/2];
+
+        double best_error = 0;
+        for (std::size_t k=0; k<m; ++k) {
+            double sum = 0;
+            for (const target* t=current.begin(k); t!=current.end(k); ++t)
+                sum += t->echo_range;
+            double error = std::fabs(sum/n - median);
+            if (k == 0 || error < best_error) {
+                best = k;
+                best_error = error;
+            }
+        }
+    }
+
+    double sum = 0;
+    for (const target* t=current.begin(best); t!=current.end(best); ++t)
+        sum += t->echo_range;
+    ranges.push_back(sum/n);
+    while (ranges.size() > history)
+        ranges.pop_front();
+    return best;
+}
+
+} // namespace vpp
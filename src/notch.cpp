@@ -0,0 +1,206 @@
+// $Id$
+
+#include <vpp/notch.hpp>
+
+#include <algorithm>
+#include <limits>
+
+using namespace scanlib;
+
+namespace vpp {
+
+namespace {
+
+#if defined(__GNUC__)
+#define VPP_NOINLINE __attribute__((noinline))
+#else
+#define VPP_NOINLINE
+#endif
+
+// window index of every echo in s, the predicate in out; the windows are
+// read by gather, segments beyond count take the sentinel window. Kept
+// out of line: inlined into evaluate() the tables lose restrict and gcc
+// gives up on the gathers.
+VPP_NOINLINE std::size_t
+notch_segments(
+    const float* range
+    , const float* amplitude
+    , const uint32_t* segment
+    , std::size_t n
+    , uint8_t* out
+    , uint32_t* s
+    , const float* __restrict r0
+    , const float* __restrict r1
+    , const float* __restrict a1
+    , uint32_t count
+)
+{
+    std::size_t total = 0;
+    for (std::size_t i=0; i<n; ++i) {
+        const uint32_t k = std::min(segment[i], count);
+        const uint8_t x = (range[i] >= r0[k]) & (range[i] <= r1[k]) & (amplitude[i] <= a1[k]);
+        out[i] = x;
+        s[i] = k;
+        total += x;
+    }
+    return total;
+}
+
+} // anonymous namespace
+
+//-----------------------------------------------------------------------------
+notch_table::notch_table()
+    : count(0)
+    , global(false)
+{
+    clear();
+}
+
+void
+notch_table::clear()
+{
+    assign(std::vector<notch_window>());
+}
+
+void
+notch_table::assign(const notch_window& w)
+{
+    assign(std::vector<notch_window>(1, w));
+    global = true;
+}
+
+void
+notch_table::assign(const std::vector<notch_window>& w)
+{
+    count = w.size();
+    global = false;
+    range_min.resize(count + 1);
+    range_max.resize(count + 1);
+    amplitude_max.resize(count + 1);
+    for (std::size_t k=0; k<count; ++k) {
+        range_min[k] = w[k].range_min;
+        range_max[k] = w[k].range_max;
+        amplitude_max[k] = w[k].amplitude_max;
+    }
+    // sentinel for segments without a window: an empty range
+    range_min[count] = std::numeric_limits<float>::infinity();
+    range_max[count] = -std::numeric_limits<float>::infinity();
+    amplitude_max[count] = -std::numeric_limits<float>::infinity();
+    seen.assign(count + 1, 0);
+    notched.assign(count + 1, 0);
+}
+
+std::size_t
+notch_table::evaluate(
+    const float* range
+    , const float* amplitude
+    , const uint32_t* segment
+    , std::size_t n
+    , uint8_t* out
+)
+{
+    const float* r0 = range_min.data();
+    const float* r1 = range_max.data();
+    const float* a1 = amplitude_max.data();
+
+    if (!segment || global || count == 0) {
+        // one window for the whole block
+        const uint32_t s = index(0);
+        const float lo = r0[s], hi = r1[s], am = a1[s];
+        std::size_t total = 0;
+        for (std::size_t i=0; i<n; ++i) {
+            uint8_t x = (range[i] >= lo) & (range[i] <= hi) & (amplitude[i] <= am);
+            out[i] = x;
+            total += x;
+        }
+        seen[s] += n;
+        notched[s] += total;
+        return total;
+    }
+
+    // the predicate vectorises, the counters are a histogram and are
+    // summed in a second pass
+    std::size_t total = 0;
+    const std::size_t block = 256;
+    uint32_t s[block];
+    for (std::size_t b=0; b<n; b+=block) {
+        const std::size_t m = std::min(block, n - b);
+        total += notch_segments(range + b, amplitude + b, segment + b, m, out + b, s
+            , r0, r1, a1, static_cast<uint32_t>(count));
+        for (std::size_t i=0; i<m; ++i) {
+            ++seen[s[i]];
+            notched[s[i]] += out[b + i];
+        }
+    }
+    return total;
+}
+
+std::size_t
+notch_table::apply(target* t, std::size_t n)
+{
+    std::size_t j = 0;
+    for (std::size_t i=0; i<n; ++i) {
+        const uint32_t s = index(t[i].segment);
+        const float r = static_cast<float>(t[i].echo_range);
+        const unsigned x = (r >= range_min[s]) & (r <= range_max[s])
+            & (t[i].amplitude <= amplitude_max[s]);
+        ++seen[s];
+        notched[s] += x;
+        // kept targets move down over the notched ones
+        if (j != i)
+            t[j] = t[i];
+        j += 1 - x;
+    }
+    return j;
+}
+
+//-----------------------------------------------------------------------------
+notch_pointcloud::notch_pointcloud(bool sync_to_pps)
+    : pointcloud(sync_to_pps)
+    , segmented(false)
+    , from_packet(false)
+{
+    // an empty window switches the per echo test of scanlib off
+    set_notch_filter(0, 0, 0);
+}
+
+void
+notch_pointcloud::on_notch_filter(const scanlib::notch_filter<iterator_type>& arg)
+{
+    pointcloud::on_notch_filter(arg);
+    if (notch.empty() && !segmented) {
+        notch_window w;
+        w.range_min = arg.range_min;
+        w.range_max = arg.range_max;
+        w.amplitude_max = arg.amplitude_max;
+        notch.assign(w);
+        from_packet = true;
+    }
+}
+
+void
+notch_pointcloud::on_notch_filter_modification_parameters(
+    const scanlib::notch_filter_modification_parameters<iterator_type>& arg
+)
+{
+    pointcloud::on_notch_filter_modification_parameters(arg);
+    // the library derives per line or frame segment windows from these at
+    // measurement start and tests every echo against them, whatever
+    // window was set; the single window of the notch_filter packet must
+    // not be applied on top
+    segmented = true;
+    if (from_packet) {
+        notch.clear();
+        from_packet = false;
+    }
+}
+
+void
+notch_pointcloud::on_shot_end()
+{
+    pointcloud::on_shot_end();
+    if (!notch.empty())
+        target_count = notch.apply(targets.data(), target_count);
+}
+
+} // namespace vpp
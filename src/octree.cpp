@@ -0,0 +1,610 @@
+// $Id$
+
+#include <vpp/octree.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+
+using namespace scanlib;
+
+namespace vpp {
+
+namespace {
+
+const char file_magic[8] = { 'V', 'P', 'P', 'O', 'C', 'T', 'R', '\0' };
+const uint32_t file_version = 1;
+
+struct file_head {
+    char magic[8];
+    uint32_t version;
+    uint32_t depth;
+    double origin[3];
+    double size;
+    double offset[3];
+    uint64_t point_count;
+    uint64_t points_offset;
+    uint64_t node_count;
+    uint64_t nodes_offset;
+};
+
+static_assert(sizeof(file_head) == 104, "file_head layout");
+static_assert(sizeof(octree_point) == 48, "octree_point layout");
+static_assert(sizeof(octree_node) == 40, "octree_node layout");
+
+// spread the low 21 bits of v to every third bit
+uint64_t
+spread(uint64_t v)
+{
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x001f00000000ffffull;
+    v = (v | v << 16) & 0x001f0000ff0000ffull;
+    v = (v | v <<  8) & 0x100f00f00f00f00full;
+    v = (v | v <<  4) & 0x10c30c30c30c30c3ull;
+    v = (v | v <<  2) & 0x1249249249249249ull;
+    return v;
+}
+
+uint32_t
+compact(uint64_t v)
+{
+    v &= 0x1249249249249249ull;
+    v = (v ^ (v >>  2)) & 0x10c30c30c30c30c3ull;
+    v = (v ^ (v >>  4)) & 0x100f00f00f00f00full;
+    v = (v ^ (v >>  8)) & 0x001f0000ff0000ffull;
+    v = (v ^ (v >> 16)) & 0x001f00000000ffffull;
+    v = (v ^ (v >> 32)) & 0x1fffff;
+    return static_cast<uint32_t>(v);
+}
+
+bool
+before(const octree_point& a, const octree_point& b)
+{
+    if (a.key != b.key)
+        return a.key < b.key;
+    if (a.shot != b.shot)
+        return a.shot < b.shot;
+    return a.target_index < b.target_index;
+}
+
+// files removed when going out of scope
+struct temp_files {
+    std::vector<std::string> paths;
+    ~temp_files() {
+        for (std::size_t k=0; k<paths.size(); ++k)
+            std::remove(paths[k].c_str());
+    }
+};
+
+std::string
+numbered(const std::string& path, const char* kind, std::size_t k)
+{
+    std::ostringstream s;
+    s << path << '.' << kind << k;
+    return s.str();
+}
+
+// buffered sequential reader of a sorted run
+class run_reader
+{
+public:
+    explicit run_reader(const std::string& path_)
+        : path(path_)
+        , in(path_.c_str(), std::ios::binary)
+        , pos(0)
+    {
+        if (!in)
+            throw(std::runtime_error("octree_builder: cannot open " + path));
+        fill();
+    }
+
+    bool empty() const { return pos == buffer.size(); }
+    const octree_point& front() const { return buffer[pos]; }
+    void pop() {
+        if (++pos == buffer.size())
+            fill();
+    }
+
+private:
+    std::string path;
+    std::ifstream in;
+    std::vector<octree_point> buffer;
+    std::size_t pos;
+
+    void fill() {
+        buffer.resize(4096);
+        in.read(reinterpret_cast<char*>(buffer.data()), buffer.size()*sizeof(octree_point));
+        std::size_t n = static_cast<std::size_t>(in.gcount())/sizeof(octree_point);
+        if (in.bad())
+            throw(std::runtime_error("octree_builder: cannot read " + path));
+        buffer.resize(n);
+        pos = 0;
+    }
+};
+
+// writes the point table and accumulates the nodes of all levels
+class table_writer
+{
+public:
+    table_writer(std::ofstream& out_, const std::string& path_, unsigned depth_, temp_files& temps)
+        : out(out_)
+        , path(path_)
+        , depth(depth_)
+        , open(depth_ + 1)
+        , level_out(depth_ + 1)
+        , count(0)
+        , nodes(0)
+    {
+        for (unsigned l=0; l<=depth; ++l) {
+            temps.paths.push_back(numbered(path, "level", l));
+            level_out[l].reset(new std::ofstream(temps.paths.back().c_str(), std::ios::binary | std::ios::trunc));
+            if (!*level_out[l])
+                throw(std::runtime_error("octree_builder: cannot create " + temps.paths.back()));
+            open[l].points = 0;
+        }
+    }
+
+    void put(const octree_point& p) {
+        out.write(reinterpret_cast<const char*>(&p), sizeof(p));
+        for (unsigned l=0; l<=depth; ++l) {
+            octree_node& n = open[l];
+            const uint64_t key = p.key >> 3*(depth - l);
+            if (n.points == 0 || n.key != key) {
+                flush(l);
+                n.key = key;
+                n.first = count;
+                n.points = 0;
+                n.shots = 0;
+                n.level = l;
+                n.reserved = 0;
+            }
+            ++n.points;
+            n.shots += (p.first_of_shot >> l) & 1;
+        }
+        ++count;
+    }
+
+    // close all levels, return the number of nodes
+    uint64_t finish() {
+        for (unsigned l=0; l<=depth; ++l) {
+            flush(l);
+            level_out[l]->close();
+            if (!*level_out[l])
+                throw(std::runtime_error("octree_builder: cannot write nodes of " + path));
+        }
+        return nodes;
+    }
+
+private:
+    std::ofstream& out;
+    std::string path;
+    unsigned depth;
+    std::vector<octree_node> open;
+    std::vector<std::unique_ptr<std::ofstream> > level_out;
+    uint64_t count;
+    uint64_t nodes;
+
+    void flush(unsigned l) {
+        if (open[l].points == 0)
+            return;
+        level_out[l]->write(reinterpret_cast<const char*>(&open[l]), sizeof(octree_node));
+        open[l].points = 0;
+        ++nodes;
+    }
+};
+
+void
+append(std::ofstream& out, const std::string& path)
+{
+    std::ifstream in(path.c_str(), std::ios::binary);
+    std::vector<char> chunk(1u<<20);
+    while (in) {
+        in.read(chunk.data(), chunk.size());
+        out.write(chunk.data(), in.gcount());
+    }
+    if (in.bad())
+        throw(std::runtime_error("octree_builder: cannot read " + path));
+}
+
+} // anonymous namespace
+
+uint64_t
+morton_encode(uint32_t ix, uint32_t iy, uint32_t iz)
+{
+    return spread(ix) | spread(iy) << 1 | spread(iz) << 2;
+}
+
+void
+morton_decode(uint64_t key, uint32_t& ix, uint32_t& iy, uint32_t& iz)
+{
+    ix = compact(key);
+    iy = compact(key >> 1);
+    iz = compact(key >> 2);
+}
+
+//-----------------------------------------------------------------------------
+octree_builder::octree_builder(
+    const std::string& path_
+    , const double origin_[3]
+    , double size_
+    , unsigned depth_
+    , std::size_t memory
+)
+    : outside(0)
+    , path(path_)
+    , size(size_)
+    , depth(depth_)
+    , scale(0)
+    , capacity(std::max<std::size_t>(memory/sizeof(octree_point), 256))
+    , points_(0)
+    , finished(false)
+{
+    if (depth > octree_max_depth)
+        throw(std::runtime_error("octree_builder: depth exceeds 21 levels"));
+    if (!(size > 0))
+        throw(std::runtime_error("octree_builder: size must be positive"));
+    for (unsigned i=0; i<3; ++i) {
+        origin[i] = origin_[i];
+        offset[i] = 0;
+    }
+    scale = (uint64_t(1)<<depth)/size;
+    buffer.reserve(capacity);
+}
+
+octree_builder::~octree_builder()
+{
+    for (std::size_t k=0; k<run_paths.size(); ++k)
+        std::remove(run_paths[k].c_str());
+}
+
+void
+octree_builder::set_offset(const double offset_[3])
+{
+    for (unsigned i=0; i<3; ++i)
+        offset[i] = offset_[i];
+}
+
+void
+octree_builder::add(const target* t, unsigned n, uint64_t shot)
+{
+    if (finished)
+        throw(std::runtime_error("octree_builder: already finished"));
+    // the echoes of a shot stay together for the first_of_shot flags
+    if (buffer.size() + n > capacity)
+        spill();
+
+    const double cells = double(uint64_t(1)<<depth);
+    const uint32_t all = (uint32_t(1) << (depth + 1)) - 1;
+    const std::size_t base = buffer.size();
+    for (unsigned k=0; k<n; ++k) {
+        uint32_t ijk[3];
+        bool inside = true;
+        for (unsigned i=0; i<3; ++i) {
+            const double f = (t[k].vertex[i] - origin[i])*scale;
+            if (!(f >= 0 && f < cells)) {
+                inside = false;
+                break;
+            }
+            ijk[i] = static_cast<uint32_t>(f);
+        }
+        if (!inside) {
+            ++outside;
+            continue;
+        }
+
+        octree_point p;
+        p.key = morton_encode(ijk[0], ijk[1], ijk[2]);
+        p.shot = shot;
+        p.x = t[k].vertex[0];
+        p.y = t[k].vertex[1];
+        p.z = t[k].vertex[2];
+        p.range = static_cast<float>(t[k].echo_range);
+        p.amplitude = t[k].amplitude;
+        p.reflectance = t[k].reflectance;
+        p.target_index = static_cast<uint8_t>(k + 1);
+        p.target_count = static_cast<uint8_t>(n);
+        p.reserved = 0;
+
+        // levels shared with an earlier echo of the shot are not first
+        p.first_of_shot = all;
+        for (std::size_t j=base; j<buffer.size(); ++j) {
+            const uint64_t diff = p.key ^ buffer[j].key;
+            if (diff == 0) {
+                p.first_of_shot = 0;
+                break;
+            }
+            unsigned high = 63;
+            while (!(diff >> high))
+                --high;
+            const unsigned shared = depth - high/3;
+            p.first_of_shot &= ~((uint32_t(1) << shared) - 1);
+        }
+        buffer.push_back(p);
+    }
+}
+
+void
+octree_builder::spill()
+{
+    if (buffer.empty())
+        return;
+    std::sort(buffer.begin(), buffer.end(), before);
+    run_paths.push_back(numbered(path, "run", run_paths.size()));
+    std::ofstream out(run_paths.back().c_str(), std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(buffer.data()), buffer.size()*sizeof(octree_point));
+    out.close();
+    if (!out)
+        throw(std::runtime_error("octree_builder: cannot write " + run_paths.back()));
+    points_ += buffer.size();
+    buffer.clear();
+}
+
+void
+octree_builder::finish()
+{
+    if (finished)
+        return;
+    finished = true;
+
+    std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+    if (!out)
+        throw(std::runtime_error("octree_builder: cannot create " + path));
+
+    file_head h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, file_magic, sizeof(h.magic));
+    h.version = file_version;
+    h.depth = depth;
+    for (unsigned i=0; i<3; ++i) {
+        h.origin[i] = origin[i];
+        h.offset[i] = offset[i];
+    }
+    h.size = size;
+    h.points_offset = sizeof(h);
+    out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+
+    temp_files temps;
+    table_writer table(out, path, depth, temps);
+    if (run_paths.empty()) {
+        std::sort(buffer.begin(), buffer.end(), before);
+        for (std::size_t k=0; k<buffer.size(); ++k)
+            table.put(buffer[k]);
+        points_ += buffer.size();
+    }
+    else {
+        spill();
+        std::vector<std::unique_ptr<run_reader> > runs;
+        for (std::size_t k=0; k<run_paths.size(); ++k)
+            runs.push_back(std::unique_ptr<run_reader>(new run_reader(run_paths[k])));
+
+        // k-way merge, the heap holds the runs by their front point
+        std::vector<run_reader*> heap;
+        for (std::size_t k=0; k<runs.size(); ++k)
+            if (!runs[k]->empty())
+                heap.push_back(runs[k].get());
+        struct later {
+            bool operator()(const run_reader* a, const run_reader* b) const {
+                return before(b->front(), a->front());
+            }
+        };
+        std::make_heap(heap.begin(), heap.end(), later());
+        while (!heap.empty()) {
+            std::pop_heap(heap.begin(), heap.end(), later());
+            run_reader* r = heap.back();
+            table.put(r->front());
+            r->pop();
+            if (r->empty())
+                heap.pop_back();
+            else
+                std::push_heap(heap.begin(), heap.end(), later());
+        }
+    }
+    std::vector<octree_point>().swap(buffer);
+
+    h.point_count = points_;
+    h.node_count = table.finish();
+    h.nodes_offset = sizeof(h) + points_*sizeof(octree_point);
+    for (unsigned l=0; l<=depth; ++l)
+        append(out, temps.paths[l]);
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    out.close();
+    if (!out)
+        throw(std::runtime_error("octree_builder: cannot write " + path));
+
+    for (std::size_t k=0; k<run_paths.size(); ++k)
+        std::remove(run_paths[k].c_str());
+    run_paths.clear();
+}
+
+//-----------------------------------------------------------------------------
+octree_index::octree_index(const std::string& path_)
+    : in(path_.c_str(), std::ios::binary)
+    , path(path_)
+{
+    file_head h;
+    if (!in.read(reinterpret_cast<char*>(&h), sizeof(h))
+        || std::memcmp(h.magic, file_magic, sizeof(h.magic)) != 0)
+        throw(std::runtime_error("octree_index: not an octree file " + path));
+    if (h.version != file_version || h.depth > octree_max_depth)
+        throw(std::runtime_error("octree_index: unsupported version " + path));
+
+    depth_ = h.depth;
+    for (unsigned i=0; i<3; ++i) {
+        origin_[i] = h.origin[i];
+        offset_[i] = h.offset[i];
+    }
+    size_ = h.size;
+    point_count_ = h.point_count;
+    points_offset = h.points_offset;
+
+    nodes.resize(h.node_count);
+    in.seekg(h.nodes_offset);
+    if (!nodes.empty()
+        && !in.read(reinterpret_cast<char*>(nodes.data()), nodes.size()*sizeof(octree_node)))
+        throw(std::runtime_error("octree_index: truncated node table " + path));
+
+    // nodes are sorted by level, then key
+    levels.assign(depth_ + 2, nodes.size());
+    for (std::size_t k=nodes.size(); k-- > 0; )
+        levels[nodes[k].level] = k;
+    for (unsigned l=depth_+1; l-- > 0; )
+        levels[l] = std::min(levels[l], levels[l + 1]);
+}
+
+const octree_node*
+octree_index::level_begin(unsigned level) const
+{
+    return nodes.data() + levels[std::min(level, depth_ + 1)];
+}
+
+const octree_node*
+octree_index::level_end(unsigned level) const
+{
+    return nodes.data() + levels[std::min(level + 1, depth_ + 1)];
+}
+
+const octree_node*
+octree_index::find(unsigned level, uint64_t key) const
+{
+    struct less_key {
+        bool operator()(const octree_node& n, uint64_t k) const { return n.key < k; }
+    };
+    const octree_node* end = level_end(level);
+    const octree_node* n = std::lower_bound(level_begin(level), end, key, less_key());
+    return (n != end && n->key == key) ? n : 0;
+}
+
+void
+octree_index::bounds(const octree_node& n, double lo[3], double hi[3]) const
+{
+    uint32_t ijk[3];
+    morton_decode(n.key, ijk[0], ijk[1], ijk[2]);
+    const double cell = cell_size(n.level);
+    for (unsigned i=0; i<3; ++i) {
+        lo[i] = origin_[i] + ijk[i]*cell;
+        hi[i] = lo[i] + cell;
+    }
+}
+
+void
+octree_index::read(const octree_node& n, std::vector<octree_point>& out)
+{
+    read(n.first, n.points, out);
+}
+
+void
+octree_index::read(uint64_t first, uint64_t count, std::vector<octree_point>& out)
+{
+    if (first + count > point_count_)
+        throw(std::runtime_error("octree_index: point range out of bounds"));
+    if (count == 0)
+        return;
+    const std::size_t at = out.size();
+    out.resize(at + count);
+    in.clear();
+    in.seekg(points_offset + first*sizeof(octree_point));
+    if (!in.read(reinterpret_cast<char*>(&out[at]), count*sizeof(octree_point)))
+        throw(std::runtime_error("octree_index: cannot read points of " + path));
+}
+
+void
+octree_index::collect(
+    unsigned level
+    , uint64_t key
+    , const double lo[3]
+    , const double hi[3]
+    , std::vector<span>& out
+) const
+{
+    const octree_node* n = find(level, key);
+    if (!n)
+        return;
+    double c_lo[3], c_hi[3];
+    bounds(*n, c_lo, c_hi);
+    bool inside = true;
+    for (unsigned i=0; i<3; ++i) {
+        if (c_hi[i] <= lo[i] || c_lo[i] >= hi[i])
+            return;
+        if (c_lo[i] < lo[i] || c_hi[i] > hi[i])
+            inside = false;
+    }
+    if (inside || level == depth_) {
+        // nodes in Morton order, so siblings usually join up
+        if (!out.empty() && out.back().filter == !inside
+            && out.back().first + out.back().count == n->first)
+            out.back().count += n->points;
+        else {
+            span s = { n->first, n->points, !inside };
+            out.push_back(s);
+        }
+        return;
+    }
+    for (uint64_t c=0; c<8; ++c)
+        collect(level + 1, key << 3 | c, lo, hi, out);
+}
+
+std::size_t
+octree_index::query(const double lo[3], const double hi[3], std::vector<octree_point>& out)
+{
+    std::vector<span> spans;
+    collect(0, 0, lo, hi, spans);
+
+    const std::size_t at = out.size();
+    for (std::size_t k=0; k<spans.size(); ++k) {
+        const std::size_t from = out.size();
+        read(spans[k].first, spans[k].count, out);
+        if (!spans[k].filter)
+            continue;
+        std::size_t to = from;
+        for (std::size_t j=from; j<out.size(); ++j) {
+            const octree_point& p = out[j];
+            if (p.x >= lo[0] && p.x < hi[0] && p.y >= lo[1] && p.y < hi[1]
+                && p.z >= lo[2] && p.z < hi[2])
+                out[to++] = p;
+        }
+        out.resize(to);
+    }
+    return out.size() - at;
+}
+
+std::size_t
+octree_index::column(double x0, double y0, double x1, double y1, std::vector<octree_point>& out)
+{
+    const double inf = std::numeric_limits<double>::infinity();
+    const double lo[3] = { x0, y0, -inf };
+    const double hi[3] = { x1, y1, inf };
+    return query(lo, hi, out);
+}
+
+//-----------------------------------------------------------------------------
+octree_pointcloud::octree_pointcloud(octree_builder& builder_, bool sync_to_pps)
+    : project_pointcloud(sync_to_pps)
+    , shots(0)
+    , builder(builder_)
+{
+}
+
+void
+octree_pointcloud::on_shot()
+{
+    project_pointcloud::on_shot();
+    if (shots == 0)
+        builder.set_offset(offset());
+    ++shots;
+}
+
+void
+octree_pointcloud::on_shot_end()
+{
+    project_pointcloud::on_shot_end();
+    if (shots > 0 && target_count > 0)
+        builder.add(targets.data(), target_count, shots - 1);
+}
+
+} // namespace vpp
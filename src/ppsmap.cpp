@@ -0,0 +1,342 @@
+// $Id$
+
+#include <vpp/ppsmap.hpp>
+
+#include <riegl/connection.hpp>
+#include <riegl/rxpmarker.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace scanlib;
+
+namespace vpp {
+
+namespace {
+
+const double nan = std::numeric_limits<double>::quiet_NaN();
+
+// a decrease of the pps time by more than this is a day or week rollover
+const double rollover_threshold = 43200.0;
+
+} // anonymous namespace
+
+//-----------------------------------------------------------------------------
+pps_map::pps_map()
+    : max_drift(1e-3)
+    , max_extrapolation(600.0)
+    , tolerance(1e-7)
+    , rejected(0)
+    , rollover(0)
+    , have_candidate(false)
+    , candidate_sys(0)
+    , candidate_pps(0)
+{
+}
+
+void
+pps_map::clear()
+{
+    sys_.clear();
+    pps_.clear();
+    rate_.clear();
+    rejected = 0;
+    rollover = 0;
+    have_candidate = false;
+}
+
+bool
+pps_map::regular(double sys0, double pps0, double sys1, double pps1) const
+{
+    double dt = sys1 - sys0;
+    return dt > 0 && std::fabs((pps1 - pps0) - dt) <= max_drift*dt;
+}
+
+void
+pps_map::append(double sys, double pps)
+{
+    // the empty segment of a step keeps the rate before it, it is never
+    // looked up
+    if (!sys_.empty() && sys != sys_.back()) {
+        std::size_t k = sys_.size() - 1;
+        rate_[k] = (pps - pps_[k])/(sys - sys_[k]);
+    }
+    sys_.push_back(sys);
+    pps_.push_back(pps);
+    rate_.push_back(rate_.empty() ? 1.0 : rate_.back());
+}
+
+void
+pps_map::add(double sys, double pps)
+{
+    if (sys_.empty()) {
+        append(sys, pps);
+        return;
+    }
+
+    const double sys0 = sys_.back();
+    const double pps0 = pps_.back();
+    if (pps + rollover < pps0 - rollover_threshold)
+        rollover = std::floor(pps0 + (sys - sys0) - pps + 0.5);
+    pps += rollover;
+
+    if (regular(sys0, pps0, sys, pps)) {
+        if (have_candidate)
+            ++rejected;
+        have_candidate = false;
+        append(sys, pps);
+    }
+    else if (have_candidate && sys0 < candidate_sys
+        && regular(candidate_sys, candidate_pps, sys, pps)) {
+        // two consistent pulses off the previous ones: the pps time jumped
+        // at the first of them. The old time base runs on up to it, then
+        // a second knot at the same internal time starts the new one.
+        have_candidate = false;
+        append(candidate_sys, pps0 + (candidate_sys - sys0)*rate_.back());
+        append(candidate_sys, candidate_pps);
+        append(sys, pps);
+    }
+    else {
+        if (have_candidate)
+            ++rejected;
+        have_candidate = true;
+        candidate_sys = sys;
+        candidate_pps = pps;
+    }
+}
+
+void
+pps_map::compact()
+{
+    if (have_candidate) {
+        ++rejected;
+        have_candidate = false;
+    }
+    const std::size_t n = sys_.size();
+    if (n < 3)
+        return;
+
+    // greedy: extend the segment from knot a as long as all knots in
+    // between stay within tolerance of the chord. Both knots of a step
+    // are kept and no chord crosses it.
+    std::vector<std::size_t> keep(1, 0);
+    std::size_t a = 0;
+    for (std::size_t j=1; j<n; ++j) {
+        if (sys_[j] == sys_[j-1]) {
+            if (keep.back() != j-1)
+                keep.push_back(j-1);
+            keep.push_back(j);
+            a = j;
+            continue;
+        }
+        if (j < a + 2)
+            continue;
+        const double r = (pps_[j] - pps_[a])/(sys_[j] - sys_[a]);
+        for (std::size_t i=a+1; i<j; ++i) {
+            if (std::fabs(pps_[a] + (sys_[i] - sys_[a])*r - pps_[i]) > tolerance) {
+                a = j - 1;
+                keep.push_back(a);
+                break;
+            }
+        }
+    }
+    if (keep.back() != n - 1)
+        keep.push_back(n - 1);
+
+    std::vector<double> sys, pps;
+    sys.swap(sys_);
+    pps.swap(pps_);
+    rate_.clear();
+    for (std::size_t k=0; k<keep.size(); ++k)
+        append(sys[keep[k]], pps[keep[k]]);
+}
+
+double
+pps_map::sys_begin() const
+{
+    return sys_.empty() ? nan : sys_.front();
+}
+
+double
+pps_map::sys_end() const
+{
+    return sys_.empty() ? nan : sys_.back();
+}
+
+std::size_t
+pps_map::segment(double t, std::size_t hint) const
+{
+    const std::size_t n = sys_.size();
+    if (hint+1 < n && sys_[hint] <= t && t < sys_[hint+1])
+        return hint;
+    if (hint+2 < n && sys_[hint+1] <= t && t < sys_[hint+2])
+        return hint + 1;
+    std::size_t k = std::upper_bound(sys_.begin(), sys_.end(), t) - sys_.begin();
+    return k == 0 ? 0 : k - 1;
+}
+
+double
+pps_map::operator()(double sys) const
+{
+    double pps;
+    convert(&sys, &pps, 1);
+    return pps;
+}
+
+std::size_t
+pps_map::convert(const double* sys, double* pps, std::size_t n) const
+{
+    if (sys_.empty()) {
+        std::fill(pps, pps + n, nan);
+        return 0;
+    }
+
+    const double lo = sys_.front() - max_extrapolation;
+    const double hi = sys_.back() + max_extrapolation;
+    const std::size_t last = sys_.size() - 1;
+    std::size_t done = 0;
+    std::size_t k = 0;
+    std::size_t i = 0;
+    while (i < n) {
+        const double t = sys[i];
+        if (!(t >= lo && t <= hi)) {
+            pps[i++] = nan;
+            continue;
+        }
+        k = segment(t, k);
+
+        // the run of times sharing segment k
+        const double a = k == 0 ? lo : sys_[k];
+        const double b = k == last ? hi : sys_[k+1];
+        std::size_t j = i + 1;
+        while (j < n && sys[j] >= a && (sys[j] < b || (k == last && sys[j] == b)))
+            ++j;
+
+        const double s0 = sys_[k];
+        const double p0 = pps_[k];
+        const double r = rate_[k];
+        for (std::size_t m=i; m<j; ++m)
+            pps[m] = p0 + (sys[m] - s0)*r;
+        done += j - i;
+        i = j;
+    }
+    return done;
+}
+
+//-----------------------------------------------------------------------------
+pps_map_builder::pps_map_builder()
+    : time_unit(0)
+    , time_unit_hr(0)
+    , time_bits_hr(64)
+    , have_hr(false)
+    , have_sys(false)
+    , sys_prev(0)
+    , sys_ext(0)
+    , have_sys_hr(false)
+    , sys_hr_prev(0)
+    , sys_hr_ext(0)
+{
+    selector = select_protocol | select_instrument;
+    selector.set(package_id::pps_sync);
+    selector.set(package_id::pps_sync_hr);
+}
+
+pps_map
+pps_map_builder::build(const std::string& uri)
+{
+    map.clear();
+    have_hr = have_sys = have_sys_hr = false;
+    sys_ext = sys_hr_ext = 0;
+
+    std::shared_ptr<basic_rconnection> rc = basic_rconnection::create(uri);
+    rc->open();
+    decoder_rxpmarker dec(rc);
+    buffer buf;
+    for (dec.get(buf); !dec.eoi(); dec.get(buf))
+        dispatch(buf.begin(), buf.end());
+    rc->close();
+
+    map.compact();
+    return map;
+}
+
+void
+pps_map_builder::on_units(const units<iterator_type>& arg)
+{
+    basic_packets::on_units(arg);
+    time_unit = arg.time_unit;
+}
+
+void
+pps_map_builder::on_units_1(const units_1<iterator_type>& arg)
+{
+    basic_packets::on_units_1(arg);
+    time_unit = arg.time_unit;
+}
+
+void
+pps_map_builder::on_units_2(const units_2<iterator_type>& arg)
+{
+    basic_packets::on_units_2(arg);
+    time_unit = arg.time_unit;
+    time_unit_hr = arg.time_unit_hi_prec;
+}
+
+void
+pps_map_builder::on_units_3(const units_3<iterator_type>& arg)
+{
+    basic_packets::on_units_3(arg);
+    time_unit = arg.time_unit;
+    time_unit_hr = arg.time_unit_hi_prec;
+    time_bits_hr = arg.time_bits_hi_prec;
+}
+
+void
+pps_map_builder::on_units_4(const units_4<iterator_type>& arg)
+{
+    basic_packets::on_units_4(arg);
+    time_unit = arg.time_unit;
+    time_unit_hr = arg.time_unit_hi_prec;
+    time_bits_hr = arg.time_bits_hi_prec;
+}
+
+void
+pps_map_builder::on_pps_sync(const pps_sync<iterator_type>& arg)
+{
+    basic_packets::on_pps_sync(arg);
+    if (have_hr || time_unit <= 0)
+        return;
+
+    const uint32_t sys = arg.systime;
+    if (have_sys && sys < sys_prev)
+        sys_ext += uint64_t(1) << 32;
+    have_sys = true;
+    sys_prev = sys;
+    map.add(double(sys_ext + sys)*time_unit, arg.pps*1e-3);
+}
+
+void
+pps_map_builder::on_pps_sync_hr(const pps_sync_hr<iterator_type>& arg)
+{
+    basic_packets::on_pps_sync_hr(arg);
+    if (time_unit_hr <= 0)
+        return;
+    if (!have_hr) {
+        // high resolution pulses supersede the others
+        map.clear();
+        have_hr = true;
+    }
+
+    uint64_t sys = arg.systime;
+    if (time_bits_hr < 64) {
+        sys &= (uint64_t(1) << time_bits_hr) - 1;
+        if (have_sys_hr && sys < sys_hr_prev)
+            sys_hr_ext += uint64_t(1) << time_bits_hr;
+    }
+    have_sys_hr = true;
+    sys_hr_prev = sys;
+    map.add(double(sys_hr_ext + sys)*time_unit_hr, arg.pps*1e-6);
+}
+
+} // namespace vpp
@@ -0,0 +1,165 @@
+// $Id$
+
+#include <vpp/reflectance.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+using namespace scanlib;
+
+namespace vpp {
+
+// 1 Np = 20/ln(10) dB, the library applies it once per range
+const double attenuation_db = 20/std::log(10.0);
+
+namespace {
+
+// gcc loses the restrict qualifiers when it inlines the loop and then no
+// longer vectorises it
+#if defined(__GNUC__)
+#define VPP_NOINLINE __attribute__((noinline))
+#else
+#define VPP_NOINLINE
+#endif
+
+// out = in + sign*(t(|r|) + loss*r), t linear on the grid of spacing 1/inv
+//
+// No calls and only min/max selects in the loop; t and s are read by
+// gather, which needs them restrict qualified, as out may alias in but
+// never the tables. Index and fraction are clamped to the last entry,
+// which is right up to the end of the table. NaN ranges are clamped to
+// index 0 and come out NaN through the atmospheric term.
+template<class range_type>
+VPP_NOINLINE void
+table_correct(
+    const range_type* range
+    , const float* in
+    , float sign
+    , std::size_t n
+    , float* out
+    , const float* __restrict t
+    , const float* __restrict s
+    , float inv
+    , float last
+    , float loss
+)
+{
+    for (std::size_t k=0; k<n; ++k) {
+        const float r = static_cast<float>(range[k]);
+        float x = std::max(0.0f, std::fabs(r)*inv);
+        x = std::min(x, last);
+        const int i = static_cast<int>(x);
+        const float f = x - static_cast<float>(i);
+        out[k] = in[k] + sign*(t[i] + f*s[i]) + loss*r;
+    }
+}
+
+} // anonymous namespace
+
+//-----------------------------------------------------------------------------
+reflectance_table::reflectance_table()
+    : attenuation(0)
+    , dr(1)
+{
+}
+
+void
+reflectance_table::assign(double step, const std::vector<float>& values)
+{
+    if (!values.empty() && !(step > 0))
+        throw(std::runtime_error("reflectance_table: bad step"));
+    dr = values.empty() ? 1 : step;
+    table = values;
+    slope.assign(table.size(), 0.0f);
+    for (std::size_t k=0; k+1<table.size(); ++k)
+        slope[k] = table[k+1] - table[k];
+}
+
+float
+reflectance_table::correction(double range) const
+{
+    const float zero = 0;
+    float c;
+    correct(&range, &zero, 1.0f, 1, &c);
+    return c;
+}
+
+// out = in + sign*correction(range), echoes beyond the table get their
+// log10 term in a second pass
+template<class range_type>
+void
+reflectance_table::correct(
+    const range_type* range
+    , const float* in
+    , float sign
+    , std::size_t n
+    , float* out
+) const
+{
+    const float loss = static_cast<float>(sign*attenuation_db*attenuation);
+    if (table.empty()) {
+        for (std::size_t k=0; k<n; ++k)
+            out[k] = in[k] + loss*static_cast<float>(range[k]);
+        return;
+    }
+    table_correct(range, in, sign, n, out, table.data(), slope.data()
+        , static_cast<float>(1/dr), static_cast<float>(table.size() - 1), loss);
+
+    const double end = dr*(table.size() - 1);
+    if (!(end > 0))
+        return;
+    for (std::size_t k=0; k<n; ++k) {
+        const double r = std::fabs(static_cast<double>(range[k]));
+        if (r > end)
+            out[k] += static_cast<float>(sign*20*std::log10(r/end));
+    }
+}
+
+void
+reflectance_table::convert(const float* range, const float* base, std::size_t n, float* reflectance) const
+{
+    correct(range, base, 1.0f, n, reflectance);
+}
+
+void
+reflectance_table::convert(const double* range, const float* base, std::size_t n, float* reflectance) const
+{
+    correct(range, base, 1.0f, n, reflectance);
+}
+
+void
+reflectance_table::remove(const double* range, const float* reflectance, std::size_t n, float* base) const
+{
+    correct(range, reflectance, -1.0f, n, base);
+}
+
+void
+reflectance_table::move(const double* from, const double* to, std::size_t n, float* reflectance) const
+{
+    correct(from, reflectance, -1.0f, n, reflectance);
+    correct(to, reflectance, 1.0f, n, reflectance);
+}
+
+//-----------------------------------------------------------------------------
+reflectance_pointcloud::reflectance_pointcloud(bool sync_to_pps)
+    : pointcloud(sync_to_pps)
+{
+}
+
+const reflectance_table&
+reflectance_pointcloud::reflectance()
+{
+    // set by the atmosphere packets and reset at measurement start
+    table.attenuation = attenuation;
+    return table;
+}
+
+void
+reflectance_pointcloud::on_reftab_table(const reftab_table<iterator_type>& arg)
+{
+    pointcloud::on_reftab_table(arg);
+    table.assign(refltab_delta, refltab);
+}
+
+} // namespace vpp
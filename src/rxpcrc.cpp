@@ -0,0 +1,281 @@
+// $Id$
+
+#include <vpp/rxpcrc.hpp>
+
+#include <riegl/connection.hpp>
+#include <riegl/rxpmarker.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/stat.h>
+#define VPP_HAVE_STAT 1
+#endif
+
+using namespace scanlib;
+
+namespace vpp {
+
+namespace {
+
+// files remembered per stamp, the oldest is dropped beyond
+const std::size_t max_crc_files = 16;
+
+const uint64_t fnv_prime = 1099511628211ull;
+
+// incremental hash of a file over 64 bit little endian words, FNV-1a
+// with a fold of the high half per word, following a reader of the same
+// file so that the bytes are hashed while they are still cached. Words
+// are aligned to the file, not to the reads.
+class content_hasher
+{
+public:
+    explicit content_hasher(const std::string& path)
+        : in(path.c_str(), std::ios::binary)
+        , h(14695981039346656037ull)
+        , pos(0)
+        , word(0)
+        , bytes(0)
+        , chunk(1u<<20)
+    {
+        if (!in)
+            throw(std::runtime_error("rxp_content_hash: cannot open " + path));
+    }
+
+    // hash the bytes up to the offset end, or up to the end of the file
+    void advance(uint64_t end) {
+        while (pos < end && in) {
+            std::size_t n = static_cast<std::size_t>(
+                std::min<uint64_t>(end - pos, chunk.size()));
+            in.read(&chunk[0], n);
+            std::size_t got = static_cast<std::size_t>(in.gcount());
+            mix(chunk.data(), got);
+            pos += got;
+        }
+        if (in.bad())
+            throw(std::runtime_error("rxp_content_hash: read error"));
+    }
+
+    std::string str() const {
+        // a partial last word is tagged with its length
+        const uint64_t v = bytes ? step(h, word ^ (uint64_t(bytes) << 56)) : h;
+        std::ostringstream s;
+        s << std::hex << std::setw(16) << std::setfill('0') << v;
+        return s.str();
+    }
+
+private:
+    std::ifstream in;
+    uint64_t h;
+    uint64_t pos;
+    uint64_t word;              // pending bytes of a word split by reads
+    unsigned bytes;
+    std::vector<char> chunk;
+
+    static uint64_t step(uint64_t h, uint64_t v) {
+        h = (h ^ v)*fnv_prime;
+        return h ^ (h >> 32);
+    }
+
+    void put(unsigned char c) {
+        word |= uint64_t(c) << 8*bytes;
+        if (++bytes == 8) {
+            h = step(h, word);
+            word = 0;
+            bytes = 0;
+        }
+    }
+
+    void mix(const char* p, std::size_t n) {
+        std::size_t i = 0;
+        for (; i<n && bytes; ++i)
+            put(static_cast<unsigned char>(p[i]));
+        for (; i+8<=n; i+=8) {
+            uint64_t v;
+            std::memcpy(&v, p + i, 8);
+            h = step(h, v);
+        }
+        for (; i<n; ++i)
+            put(static_cast<unsigned char>(p[i]));
+    }
+};
+
+// path, device, inode, size and modification time of a file
+bool
+file_identity(const std::string& path, rxp_meta::crc_file& f)
+{
+#ifdef VPP_HAVE_STAT
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0)
+        return false;
+#if defined(__APPLE__)
+    const struct timespec& t = st.st_mtimespec;
+#else
+    const struct timespec& t = st.st_mtim;
+#endif
+    f.path = path;
+    f.device = static_cast<uint64_t>(st.st_dev);
+    f.inode = static_cast<uint64_t>(st.st_ino);
+    f.size = static_cast<uint64_t>(st.st_size);
+    f.mtime = static_cast<int64_t>(t.tv_sec)*1000000000 + t.tv_nsec;
+    return f.inode != 0;
+#else
+    (void)path; (void)f;
+    return false;
+#endif
+}
+
+} // anonymous namespace
+
+selector_type
+select_crc()
+{
+    selector_type s;
+    s.set(package_id::crc32_header);
+    s.set(package_id::crc32_check);
+    return s;
+}
+
+//-----------------------------------------------------------------------------
+rxp_crc_verifier::rxp_crc_verifier()
+    : streams(0)
+    , checks(0)
+{
+}
+
+rxp_meta::crc_status_e
+rxp_crc_verifier::verify(const std::string& path)
+{
+    streams = 0;
+    checks = 0;
+    errors.clear();
+    content.clear();
+
+    content_hasher hash(path);
+    std::shared_ptr<basic_rconnection> rc
+        = basic_rconnection::create("file:" + path);
+    rc->open();
+    decoder_rxpmarker dec(rc);
+    buffer buf;
+    for (dec.get(buf); !dec.eoi(); dec.get(buf)) {
+        dispatch(buf.begin(), buf.end());
+        hash.advance(rc->tellg());
+    }
+    rc->close();
+    hash.advance(std::numeric_limits<uint64_t>::max());
+    content = hash.str();
+
+    if (!errors.empty())
+        return rxp_meta::crc_failed;
+    if (checks == 0)
+        return rxp_meta::crc_absent;
+    return rxp_meta::crc_passed;
+}
+
+void
+rxp_crc_verifier::on_crc32_header(const crc32_header<iterator_type>& arg)
+{
+    pointcloud::on_crc32_header(arg);
+    ++streams;
+}
+
+void
+rxp_crc_verifier::on_crc32_check(const crc32_check<iterator_type>& arg)
+{
+    pointcloud::on_crc32_check(arg);
+    ++checks;
+}
+
+void
+rxp_crc_verifier::on_crc32_error(
+    uint16_t stream
+    , uint32_t sequence_begin
+    , uint32_t sequence_end
+)
+{
+    // collected instead of being passed on to the base class
+    error_range e;
+    e.stream = stream;
+    e.sequence_begin = sequence_begin;
+    e.sequence_end = sequence_end;
+    errors.push_back(e);
+}
+
+//-----------------------------------------------------------------------------
+std::string
+rxp_content_hash(const std::string& path)
+{
+    content_hasher hash(path);
+    hash.advance(std::numeric_limits<uint64_t>::max());
+    return hash.str();
+}
+
+bool
+crc_stamp_applies(const rxp_meta& meta, const std::string& path)
+{
+    if (meta.crc_status == rxp_meta::crc_unchecked || meta.crc_content.empty())
+        return false;
+    rxp_meta::crc_file f;
+    if (!file_identity(path, f))
+        return false;
+    return std::find(meta.crc_files.begin(), meta.crc_files.end(), f)
+        != meta.crc_files.end();
+}
+
+const rxp_meta&
+verify_once(rxp_probe_cache& cache, const std::string& path, bool force)
+{
+    const rxp_meta& cached = cache.get(path);
+    if (!force && crc_stamp_applies(cached, path))
+        return cached;
+
+    // identify the file before reading it, a change while verifying then
+    // voids the stamp
+    rxp_meta meta(cached);
+    rxp_meta::crc_file f;
+    const bool known = file_identity(path, f);
+    if (force
+        || cached.crc_status == rxp_meta::crc_unchecked
+        || cached.crc_content.empty()
+        || rxp_content_hash(path) != cached.crc_content) {
+        rxp_crc_verifier v;
+        meta.crc_status = v.verify(path);
+        meta.crc_checks = v.checks;
+        meta.crc_errors = v.errors.size();
+        meta.crc_content = v.content;
+        // other files with this fingerprint hold other content
+        meta.crc_files.clear();
+    }
+    // the stamp now applies to this file as it is, in addition to the
+    // copies seen before
+    std::vector<rxp_meta::crc_file>& files = meta.crc_files;
+    for (std::size_t k=files.size(); k-->0;)
+        if (files[k].path == path)
+            files.erase(files.begin() + k);
+    if (known)
+        files.push_back(f);
+    if (files.size() > max_crc_files)
+        files.erase(files.begin(), files.end() - max_crc_files);
+    return cache.put(meta);
+}
+
+bool
+skip_verified_crc(basic_packets& consumer, const rxp_meta& meta, const std::string& path)
+{
+    if (meta.crc_status != rxp_meta::crc_passed
+        && meta.crc_status != rxp_meta::crc_absent)
+        return false;
+    if (!crc_stamp_applies(meta, path))
+        return false;
+    consumer.selector &= ~select_crc();
+    return true;
+}
+
+} // namespace vpp
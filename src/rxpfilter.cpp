@@ -0,0 +1,142 @@
+// $Id$
+
+#include <vpp/rxpfilter.hpp>
+#include <vpp/rxpslab.hpp>
+
+#include <riegl/rxpstream.hpp>
+
+using namespace scanlib;
+
+namespace vpp {
+
+selector_type
+select_housekeeping()
+{
+    selector_type s;
+    for (std::size_t n=1; n<s.size(); ++n) {
+        package_id id(static_cast<package_id::type>(n));
+        if (id.string().compare(0, 3, "hk_") == 0)
+            s.set(n);
+    }
+    return s;
+}
+
+rxp_filter::statistics::statistics()
+    : packets_in(0)
+    , packets_out(0)
+    , words_in(0)
+    , words_out(0)
+    , crc_streams(0)
+    , crc_streams_dropped(0)
+{
+}
+
+rxp_filter::rxp_filter()
+    : strip(select_wave | select_debug)
+    , compact_lookup(true)
+{
+}
+
+rxp_filter::statistics
+rxp_filter::run(const std::string& in_uri, const std::string& out_uri)
+{
+    statistics st;
+
+    rxp_slab_istream in(in_uri);
+    rxp_slab_ostream out(out_uri);
+
+    // short ids as found in the input and as written to the output
+    lookup_table src_lookup;
+    lookup_table dst_lookup;
+    // crc stream id -> crc packets are passed through
+    std::map<unsigned, bool> crc_keep;
+
+    slab_packet p;
+    while (in.read(p)) {
+        ++st.packets_in;
+        st.words_in += p.size();
+
+        package_id id(p.id_main, p.id_sub);
+        bool stripped = strip.test(static_cast<package_id::type>(id));
+
+        if (id == package_id::header) {
+            header<> h(rxp_cast<header<> >(p));
+            src_lookup = lookup_table();
+            src_lookup.load(h.id_lookup, h.id_lookup_size);
+            if (compact_lookup) {
+                std::size_t n = 0;
+                for (std::size_t k=0; k<h.id_lookup_size; ++k) {
+                    package_id e(h.id_lookup[k].main, h.id_lookup[k].sub);
+                    if (!strip.test(static_cast<package_id::type>(e)))
+                        h.id_lookup[n++] = h.id_lookup[k];
+                }
+                h.id_lookup_size = n;
+                p = slab_encode(in.memory(), h);
+            }
+            dst_lookup = lookup_table();
+            dst_lookup.load(h.id_lookup, h.id_lookup_size);
+        }
+        else if (id == package_id::header_ext) {
+            header_ext<> h(rxp_cast<header_ext<> >(p));
+            std::size_t n = 0;
+            for (std::size_t k=0; k<h.id_size; ++k) {
+                src_lookup.set(0, h.id[k].main, h.id[k].sub);
+                package_id e(h.id[k].main, h.id[k].sub);
+                if (!compact_lookup || !strip.test(static_cast<package_id::type>(e))) {
+                    dst_lookup.set(0, h.id[k].main, h.id[k].sub);
+                    h.id[n++] = h.id[k];
+                }
+            }
+            if (n == 0) {
+                ++st.stripped[id.string()];
+                in.release();
+                continue;
+            }
+            if (n != h.id_size) {
+                h.id_size = n;
+                p = slab_encode(in.memory(), h);
+            }
+        }
+        else if (id == package_id::crc32_header) {
+            crc32_header<> c(rxp_cast<crc32_header<> >(p));
+            bool keep = !stripped;
+            for (std::size_t k=0; keep && k<c.package_ids_size; ++k) {
+                lookup_table::id e(c.package_ids[k].main, c.package_ids[k].sub);
+                if (strip.test(static_cast<package_id::type>(package_id(e.main, e.sub))))
+                    keep = false;
+                else if (src_lookup[e] != dst_lookup[e])
+                    keep = false;
+            }
+            crc_keep[c.stream_id] = keep;
+            ++st.crc_streams;
+            if (!keep) {
+                ++st.crc_streams_dropped;
+                in.release();
+                continue;
+            }
+        }
+        else if (id == package_id::crc32_check) {
+            crc32_check<> c(rxp_cast<crc32_check<> >(p));
+            std::map<unsigned, bool>::const_iterator k = crc_keep.find(c.stream_id);
+            if (stripped || (k != crc_keep.end() && !k->second)) {
+                in.release();
+                continue;
+            }
+        }
+        else if (stripped) {
+            ++st.stripped[id.string()];
+            in.release();
+            continue;
+        }
+
+        out << p;
+        ++st.packets_out;
+        st.words_out += p.size();
+        in.release();
+    }
+
+    out.close();
+    return st;
+}
+
+} // namespace vpp
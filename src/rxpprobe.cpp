@@ -0,0 +1,555 @@
+// $Id$
+
+#include <vpp/rxpprobe.hpp>
+
+#include <riegl/connection.hpp>
+#include <riegl/rxpmarker.hpp>
+
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <stdexcept>
+
+using namespace scanlib;
+
+namespace vpp {
+
+namespace {
+
+const std::size_t fingerprint_span = 65536;
+
+void
+fnv1a(uint64_t& h, const char* p, std::size_t n)
+{
+    for (std::size_t i=0; i<n; ++i) {
+        h ^= static_cast<unsigned char>(p[i]);
+        h *= 1099511628211ull;
+    }
+}
+
+void
+write_json_string(std::ostream& out, const std::string& s)
+{
+    out << '"';
+    for (std::string::const_iterator c=s.begin(); c!=s.end(); ++c) {
+        if (*c == '"' || *c == '\\')
+            out << '\\' << *c;
+        else if (static_cast<unsigned char>(*c) < 0x20)
+            out << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+                << int(*c) << std::dec << std::setfill(' ');
+        else
+            out << *c;
+    }
+    out << '"';
+}
+
+// helper for writing "name": value pairs with optional indentation
+class json_object
+{
+    std::ostream& out;
+    bool pretty;
+    bool first;
+public:
+    json_object(std::ostream& out_, bool pretty_)
+        : out(out_), pretty(pretty_), first(true) {
+        out << '{';
+    }
+    ~json_object() {
+        out << (pretty ? "\n}" : "}");
+    }
+    std::ostream& key(const char* name) {
+        out << (first ? "" : ",") << (pretty ? "\n    " : "");
+        first = false;
+        write_json_string(out, name);
+        out << (pretty ? ": " : ":");
+        return out;
+    }
+    void value(const char* name, const std::string& v) {
+        write_json_string(key(name), v);
+    }
+    void value(const char* name, bool v) {
+        key(name) << (v ? "true" : "false");
+    }
+    template<class T>
+    void value(const char* name, T v) {
+        key(name) << v;
+    }
+    void number(const char* name, double v, bool valid) {
+        if (valid && std::isfinite(v))
+            key(name) << v;
+        else
+            key(name) << "null";
+    }
+};
+
+const char*
+crc_status_string(rxp_meta::crc_status_e s)
+{
+    switch (s) {
+    case rxp_meta::crc_absent: return "absent";
+    case rxp_meta::crc_passed: return "passed";
+    case rxp_meta::crc_failed: return "failed";
+    default: return "unchecked";
+    }
+}
+
+} // anonymous namespace
+
+//-----------------------------------------------------------------------------
+rxp_meta::rxp_meta()
+    : range_unit(0)
+    , time_unit(0)
+    , line_circle_count(0)
+    , frame_circle_count(0)
+    , num_facets(0)
+    , have_scan_pattern(false)
+    , theta_min(0)
+    , theta_max(0)
+    , theta_incr(0)
+    , phi_min(0)
+    , phi_max(0)
+    , phi_incr(0)
+    , line_scan_mode(0)
+    , have_extents(false)
+    , range_min(0)
+    , range_max(0)
+    , amplitude_min(0)
+    , amplitude_max(0)
+    , reflectance_min(0)
+    , reflectance_max(0)
+    , max_num_echoes(0)
+    , have_mta(false)
+    , mta_zone(0)
+    , gate_low(0)
+    , gate_high(0)
+    , zone_width(0)
+    , meas_start_seen(false)
+    , file_size(0)
+    , bytes_read(0)
+    , packets_read(0)
+    , crc_status(crc_unchecked)
+    , crc_checks(0)
+    , crc_errors(0)
+{
+}
+
+rxp_meta::crc_file::crc_file()
+    : device(0)
+    , inode(0)
+    , size(0)
+    , mtime(0)
+{
+}
+
+bool
+rxp_meta::crc_file::operator==(const crc_file& o) const
+{
+    return path == o.path && device == o.device && inode == o.inode
+        && size == o.size && mtime == o.mtime;
+}
+
+uint64_t
+rxp_meta::shot_count_estimate() const
+{
+    if (!have_scan_pattern || theta_incr <= 0)
+        return 0;
+    double lines = 1;
+    if (phi_incr > 0)
+        lines = std::floor(std::fabs(phi_max - phi_min)/phi_incr + 0.5) + 1;
+    double shots_per_line
+        = std::floor(std::fabs(theta_max - theta_min)/theta_incr + 0.5) + 1;
+    return static_cast<uint64_t>(lines*shots_per_line);
+}
+
+void
+rxp_meta::write_json(std::ostream& out, bool pretty) const
+{
+    std::ios::fmtflags flags(out.flags());
+    std::streamsize precision(out.precision(10));
+    {
+        json_object o(out, pretty);
+        o.value("fingerprint", fingerprint);
+        o.value("type_id", type_id);
+        o.value("serial", serial);
+        o.value("build", build);
+        o.value("range_unit", range_unit);
+        o.value("time_unit", time_unit);
+        o.value("line_circle_count", line_circle_count);
+        o.value("frame_circle_count", frame_circle_count);
+        o.value("num_facets", num_facets);
+        o.number("theta_min", theta_min, have_scan_pattern);
+        o.number("theta_max", theta_max, have_scan_pattern);
+        o.number("theta_incr", theta_incr, have_scan_pattern);
+        o.number("phi_min", phi_min, have_scan_pattern);
+        o.number("phi_max", phi_max, have_scan_pattern);
+        o.number("phi_incr", phi_incr, have_scan_pattern);
+        o.value("line_scan_mode", line_scan_mode);
+        o.value("shot_count_estimate", shot_count_estimate());
+        o.number("range_min", range_min, have_extents);
+        o.number("range_max", range_max, have_extents);
+        o.number("amplitude_min", amplitude_min, have_extents);
+        o.number("amplitude_max", amplitude_max, have_extents);
+        o.number("reflectance_min", reflectance_min, have_extents);
+        o.number("reflectance_max", reflectance_max, have_extents);
+        o.value("max_num_echoes", max_num_echoes);
+        o.number("mta_zone", mta_zone, have_mta);
+        o.number("gate_low", gate_low, have_mta);
+        o.number("gate_high", gate_high, have_mta);
+        o.number("zone_width", zone_width, have_mta);
+        o.value("meas_start_seen", meas_start_seen);
+        o.value("file_size", file_size);
+        o.value("bytes_read", bytes_read);
+        o.value("packets_read", packets_read);
+        o.value("crc_status", std::string(crc_status_string(crc_status)));
+        o.value("crc_checks", crc_checks);
+        o.value("crc_errors", crc_errors);
+        o.value("crc_content", crc_content);
+    }
+    out.precision(precision);
+    out.flags(flags);
+}
+
+//-----------------------------------------------------------------------------
+// The cache file format is one "name=value" pair per line, terminated by an
+// empty line. Unknown names are skipped to keep older cache files readable.
+
+std::ostream&
+operator<<(std::ostream& out, const rxp_meta& arg)
+{
+    std::streamsize precision(out.precision(17));
+    out << "fingerprint=" << arg.fingerprint << '\n'
+        << "type_id=" << arg.type_id << '\n'
+        << "serial=" << arg.serial << '\n'
+        << "build=" << arg.build << '\n'
+        << "range_unit=" << arg.range_unit << '\n'
+        << "time_unit=" << arg.time_unit << '\n'
+        << "line_circle_count=" << arg.line_circle_count << '\n'
+        << "frame_circle_count=" << arg.frame_circle_count << '\n'
+        << "num_facets=" << arg.num_facets << '\n'
+        << "have_scan_pattern=" << arg.have_scan_pattern << '\n'
+        << "theta_min=" << arg.theta_min << '\n'
+        << "theta_max=" << arg.theta_max << '\n'
+        << "theta_incr=" << arg.theta_incr << '\n'
+        << "phi_min=" << arg.phi_min << '\n'
+        << "phi_max=" << arg.phi_max << '\n'
+        << "phi_incr=" << arg.phi_incr << '\n'
+        << "line_scan_mode=" << arg.line_scan_mode << '\n'
+        << "have_extents=" << arg.have_extents << '\n'
+        << "range_min=" << arg.range_min << '\n'
+        << "range_max=" << arg.range_max << '\n'
+        << "amplitude_min=" << arg.amplitude_min << '\n'
+        << "amplitude_max=" << arg.amplitude_max << '\n'
+        << "reflectance_min=" << arg.reflectance_min << '\n'
+        << "reflectance_max=" << arg.reflectance_max << '\n'
+        << "max_num_echoes=" << arg.max_num_echoes << '\n'
+        << "have_mta=" << arg.have_mta << '\n'
+        << "mta_zone=" << arg.mta_zone << '\n'
+        << "gate_low=" << arg.gate_low << '\n'
+        << "gate_high=" << arg.gate_high << '\n'
+        << "zone_width=" << arg.zone_width << '\n'
+        << "meas_start_seen=" << arg.meas_start_seen << '\n'
+        << "file_size=" << arg.file_size << '\n'
+        << "bytes_read=" << arg.bytes_read << '\n'
+        << "packets_read=" << arg.packets_read << '\n'
+        << "crc_status=" << int(arg.crc_status) << '\n'
+        << "crc_checks=" << arg.crc_checks << '\n'
+        << "crc_errors=" << arg.crc_errors << '\n'
+        << "crc_content=" << arg.crc_content << '\n';
+    // one line per file, the path last as it may hold blanks
+    for (std::size_t k=0; k<arg.crc_files.size(); ++k) {
+        const rxp_meta::crc_file& f = arg.crc_files[k];
+        out << "crc_file=" << f.device << ' ' << f.inode << ' ' << f.size
+            << ' ' << f.mtime << ' ' << f.path << '\n';
+    }
+    out << '\n';
+    out.precision(precision);
+    return out;
+}
+
+std::istream&
+operator>>(std::istream& in, rxp_meta& arg)
+{
+    rxp_meta r;
+    std::string line;
+    bool any = false;
+    while (std::getline(in, line) && !line.empty()) {
+        std::string::size_type eq = line.find('=');
+        if (eq == std::string::npos) {
+            in.setstate(std::ios::failbit);
+            return in;
+        }
+        any = true;
+        std::string name(line, 0, eq);
+        std::istringstream v(line.substr(eq+1));
+        if      (name == "fingerprint") r.fingerprint = v.str();
+        else if (name == "type_id") r.type_id = v.str();
+        else if (name == "serial") r.serial = v.str();
+        else if (name == "build") r.build = v.str();
+        else if (name == "range_unit") v >> r.range_unit;
+        else if (name == "time_unit") v >> r.time_unit;
+        else if (name == "line_circle_count") v >> r.line_circle_count;
+        else if (name == "frame_circle_count") v >> r.frame_circle_count;
+        else if (name == "num_facets") v >> r.num_facets;
+        else if (name == "have_scan_pattern") v >> r.have_scan_pattern;
+        else if (name == "theta_min") v >> r.theta_min;
+        else if (name == "theta_max") v >> r.theta_max;
+        else if (name == "theta_incr") v >> r.theta_incr;
+        else if (name == "phi_min") v >> r.phi_min;
+        else if (name == "phi_max") v >> r.phi_max;
+        else if (name == "phi_incr") v >> r.phi_incr;
+        else if (name == "line_scan_mode") v >> r.line_scan_mode;
+        else if (name == "have_extents") v >> r.have_extents;
+        else if (name == "range_min") v >> r.range_min;
+        else if (name == "range_max") v >> r.range_max;
+        else if (name == "amplitude_min") v >> r.amplitude_min;
+        else if (name == "amplitude_max") v >> r.amplitude_max;
+        else if (name == "reflectance_min") v >> r.reflectance_min;
+        else if (name == "reflectance_max") v >> r.reflectance_max;
+        else if (name == "max_num_echoes") v >> r.max_num_echoes;
+        else if (name == "have_mta") v >> r.have_mta;
+        else if (name == "mta_zone") v >> r.mta_zone;
+        else if (name == "gate_low") v >> r.gate_low;
+        else if (name == "gate_high") v >> r.gate_high;
+        else if (name == "zone_width") v >> r.zone_width;
+        else if (name == "meas_start_seen") v >> r.meas_start_seen;
+        else if (name == "file_size") v >> r.file_size;
+        else if (name == "bytes_read") v >> r.bytes_read;
+        else if (name == "packets_read") v >> r.packets_read;
+        else if (name == "crc_status") {
+            int c = 0;
+            if (v >> c && c >= rxp_meta::crc_unchecked && c <= rxp_meta::crc_failed)
+                r.crc_status = static_cast<rxp_meta::crc_status_e>(c);
+        }
+        else if (name == "crc_checks") v >> r.crc_checks;
+        else if (name == "crc_errors") v >> r.crc_errors;
+        else if (name == "crc_content") r.crc_content = v.str();
+        else if (name == "crc_file") {
+            rxp_meta::crc_file f;
+            if (v >> f.device >> f.inode >> f.size >> f.mtime && v.get() == ' '
+                && std::getline(v, f.path) && !f.path.empty())
+                r.crc_files.push_back(f);
+        }
+    }
+    if (any) {
+        arg = r;
+        in.clear(in.rdstate() & ~std::ios::failbit);
+    }
+    else
+        in.setstate(std::ios::failbit);
+    return in;
+}
+
+//-----------------------------------------------------------------------------
+std::string
+rxp_fingerprint(const std::string& path)
+{
+    std::ifstream in(path.c_str(), std::ios::binary);
+    if (!in)
+        throw(std::runtime_error("rxp_fingerprint: cannot open " + path));
+
+    in.seekg(0, std::ios::end);
+    uint64_t size = static_cast<uint64_t>(in.tellg());
+    in.seekg(0, std::ios::beg);
+
+    uint64_t h = 14695981039346656037ull;
+    fnv1a(h, reinterpret_cast<const char*>(&size), sizeof(size));
+
+    std::vector<char> span(fingerprint_span);
+    in.read(&span[0], span.size());
+    fnv1a(h, &span[0], static_cast<std::size_t>(in.gcount()));
+    if (size > 2*fingerprint_span) {
+        in.clear();
+        in.seekg(size - fingerprint_span, std::ios::beg);
+        in.read(&span[0], span.size());
+        fnv1a(h, &span[0], static_cast<std::size_t>(in.gcount()));
+    }
+    if (in.bad())
+        throw(std::runtime_error("rxp_fingerprint: cannot read " + path));
+
+    std::ostringstream s;
+    s << std::hex << std::setw(16) << std::setfill('0') << h;
+    return s.str();
+}
+
+//-----------------------------------------------------------------------------
+rxp_probe::rxp_probe(uint64_t max_bytes_, unsigned grace_packets_)
+    : max_bytes(max_bytes_)
+    , grace_packets(grace_packets_)
+{
+    // only the configuration packets are of interest, everything else is
+    // segmented by the decoder but never decoded
+    selector = select_protocol | select_attribute | select_instrument;
+    selector.set(package_id::device_geometry);
+}
+
+rxp_meta
+rxp_probe::probe(const std::string& path)
+{
+    meta = rxp_meta();
+
+    std::shared_ptr<basic_rconnection> rc
+        = basic_rconnection::create("file:" + path);
+    rc->open();
+    decoder_rxpmarker dec(rc);
+    buffer buf;
+
+    unsigned grace = 0;
+    for (dec.get(buf); !dec.eoi(); dec.get(buf)) {
+        dispatch(buf.begin(), buf.end());
+        ++meta.packets_read;
+        if (meta.meas_start_seen && ++grace > grace_packets)
+            break;
+        if (rc->tellg() > max_bytes)
+            break;
+    }
+
+    meta.bytes_read = rc->tellg();
+    meta.file_size = rc->size();
+    rc->close();
+    return meta;
+}
+
+void
+rxp_probe::on_header(const header<iterator_type>& arg)
+{
+    basic_packets::on_header(arg);
+    meta.type_id = arg.type_id;
+    meta.serial = arg.serial;
+    meta.build = arg.build;
+    meta.type_id = meta.type_id.c_str(); // strip trailing NUL padding
+    meta.serial = meta.serial.c_str();
+    meta.build = meta.build.c_str();
+}
+
+void
+rxp_probe::on_units(const units<iterator_type>& arg)
+{
+    basic_packets::on_units(arg);
+    meta.range_unit = arg.range_unit;
+    meta.time_unit = arg.time_unit;
+    meta.line_circle_count = arg.line_circle_count;
+    meta.frame_circle_count = arg.frame_circle_count;
+}
+
+void
+rxp_probe::on_device_geometry(const device_geometry<iterator_type>& arg)
+{
+    basic_packets::on_device_geometry(arg);
+    ++meta.num_facets;
+}
+
+void
+rxp_probe::on_scan_rect_fov(const scan_rect_fov<iterator_type>& arg)
+{
+    basic_packets::on_scan_rect_fov(arg);
+    meta.have_scan_pattern = true;
+    meta.theta_min = arg.theta_min;
+    meta.theta_max = arg.theta_max;
+    meta.theta_incr = arg.theta_incr;
+    meta.phi_min = arg.phi_min;
+    meta.phi_max = arg.phi_max;
+    meta.phi_incr = arg.phi_incr;
+}
+
+void
+rxp_probe::on_scan_rect_fov_1(const scan_rect_fov_1<iterator_type>& arg)
+{
+    basic_packets::on_scan_rect_fov_1(arg);
+    meta.line_scan_mode = arg.line_scan_mode;
+}
+
+void
+rxp_probe::on_extents(const extents<iterator_type>& arg)
+{
+    basic_packets::on_extents(arg);
+    meta.have_extents = true;
+    meta.range_min = arg.range_min;
+    meta.range_max = arg.range_max;
+    meta.amplitude_min = arg.amplitude_min;
+    meta.amplitude_max = arg.amplitude_max;
+    meta.reflectance_min = arg.reflectance_min;
+    meta.reflectance_max = arg.reflectance_max;
+}
+
+void
+rxp_probe::on_extents_1(const extents_1<iterator_type>& arg)
+{
+    basic_packets::on_extents_1(arg);
+    meta.max_num_echoes = arg.max_num_echoes;
+}
+
+void
+rxp_probe::on_mta_settings(const mta_settings<iterator_type>& arg)
+{
+    basic_packets::on_mta_settings(arg);
+    meta.have_mta = true;
+    meta.mta_zone = arg.zone;
+    meta.gate_low = arg.gate_low;
+    meta.gate_high = arg.gate_high;
+    meta.zone_width = arg.zone_width;
+}
+
+void
+rxp_probe::on_meas_start(const meas_start<iterator_type>& arg)
+{
+    basic_packets::on_meas_start(arg);
+    meta.meas_start_seen = true;
+}
+
+//-----------------------------------------------------------------------------
+rxp_probe_cache::rxp_probe_cache(const std::string& directory_)
+    : hits(0)
+    , misses(0)
+    , directory(directory_)
+{
+}
+
+std::string
+rxp_probe_cache::entry_path(const std::string& fingerprint) const
+{
+    return directory + "/" + fingerprint + ".meta";
+}
+
+const rxp_meta&
+rxp_probe_cache::get(const std::string& path)
+{
+    std::string fp = rxp_fingerprint(path);
+
+    std::map<std::string, rxp_meta>::iterator e = entries.find(fp);
+    if (e != entries.end()) {
+        ++hits;
+        return e->second;
+    }
+
+    rxp_meta meta;
+    if (!directory.empty()) {
+        std::ifstream in(entry_path(fp).c_str());
+        if (in >> meta && meta.fingerprint == fp) {
+            ++hits;
+            return entries[fp] = meta;
+        }
+    }
+
+    ++misses;
+    meta = probe.probe(path);
+    meta.fingerprint = fp;
+    return put(meta);
+}
+
+const rxp_meta&
+rxp_probe_cache::put(const rxp_meta& meta)
+{
+    if (meta.fingerprint.empty())
+        throw(std::invalid_argument("rxp_probe_cache: missing fingerprint"));
+    rxp_meta& e = entries[meta.fingerprint] = meta;
+    if (!directory.empty()) {
+        // a failing cache write only costs a probe on the next run
+        std::ofstream out(entry_path(meta.fingerprint).c_str());
+        out << meta;
+    }
+    return e;
+}
+
+} // namespace vpp
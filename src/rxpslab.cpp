@@ -0,0 +1,131 @@
+// $Id$
+
+#include <vpp/rxpslab.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace scanlib;
+
+namespace vpp {
+
+//-----------------------------------------------------------------------------
+packet_slab::packet_slab(std::size_t chunk_words_)
+    : chunk_allocations(0)
+    , chunk_words(chunk_words_ ? chunk_words_ : 1)
+    , current(0)
+    , pos(0)
+    , used_before(0)
+{
+}
+
+uint32_t*
+packet_slab::allocate(std::size_t n)
+{
+    if (current < chunks.size() && pos + n <= chunks[current].size) {
+        uint32_t* p = chunks[current].data.get() + pos;
+        pos += n;
+        return p;
+    }
+
+    // advance to the next chunk, the first allocation also lands here
+    if (current < chunks.size()) {
+        used_before += pos;
+        ++current;
+    }
+    if (current == chunks.size() || chunks[current].size < n) {
+        chunk_t c;
+        c.size = std::max(n, chunk_words);
+        c.data.reset(new uint32_t[c.size]);
+        ++chunk_allocations;
+        chunks.insert(chunks.begin() + current, std::move(c));
+    }
+    pos = n;
+    return chunks[current].data.get();
+}
+
+void
+packet_slab::shrink(uint32_t* p, std::size_t used)
+{
+    if (current >= chunks.size())
+        throw(std::logic_error("packet_slab::shrink: nothing allocated"));
+    std::size_t offset = p - chunks[current].data.get();
+    if (offset > pos || offset + used > pos)
+        throw(std::logic_error("packet_slab::shrink: not the last allocation"));
+    pos = offset + used;
+}
+
+void
+packet_slab::release()
+{
+    current = 0;
+    pos = 0;
+    used_before = 0;
+}
+
+std::size_t
+packet_slab::words_in_use() const
+{
+    return used_before + pos;
+}
+
+//-----------------------------------------------------------------------------
+slab_packet
+slab_copy(packet_slab& slab, const rxp_packet& p)
+{
+    slab_packet r;
+    r.id_main = p.id_main;
+    r.id_sub = p.id_sub;
+    std::size_t n = p.end() - p.begin();
+    if (n) {
+        uint32_t* buf = slab.allocate(n);
+        std::copy(p.begin(), p.end(), buf);
+        r.begin_ = buf;
+        r.end_ = buf + n;
+    }
+    return r;
+}
+
+//-----------------------------------------------------------------------------
+rxp_slab_istream::rxp_slab_istream(
+    const std::string& uri
+    , std::size_t chunk_words
+)
+    : in(uri)
+    , id(0, 0)
+    , slab(chunk_words)
+{
+}
+
+bool
+rxp_slab_istream::read(slab_packet& p)
+{
+    if (!in.good())
+        return false;
+    in >> id;
+    if (!in.good())
+        return false;
+    in >> scratch;
+    p = slab_copy(slab, scratch);
+    p.id_main = id.main;
+    p.id_sub = id.sub;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+rxp_slab_ostream::rxp_slab_ostream(const std::string& uri)
+    : out(uri)
+{
+}
+
+rxp_slab_ostream&
+rxp_slab_ostream::operator<<(const slab_packet& p)
+{
+    scratch.assign(p.begin(), p.end());
+    scratch.id_main = p.id_main;
+    scratch.id_sub = p.id_sub;
+    out << scratch;
+    return *this;
+}
+
+} // namespace vpp
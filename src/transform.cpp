@@ -0,0 +1,163 @@
+// $Id$
+
+#include <vpp/transform.hpp>
+
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+
+using namespace scanlib;
+
+namespace vpp {
+
+//-----------------------------------------------------------------------------
+rigid_transform::rigid_transform()
+{
+    for (unsigned i=0; i<4; ++i)
+        for (unsigned j=0; j<4; ++j)
+            m[i][j] = (i == j) ? 1.0 : 0.0;
+}
+
+rigid_transform
+rigid_transform::load(const std::string& path)
+{
+    std::ifstream in(path.c_str());
+    rigid_transform t;
+    if (!(in >> t))
+        throw(std::runtime_error("rigid_transform: cannot read " + path));
+    return t;
+}
+
+rigid_transform
+rigid_transform::operator*(const rigid_transform& b) const
+{
+    rigid_transform r;
+    for (unsigned i=0; i<4; ++i)
+        for (unsigned j=0; j<4; ++j) {
+            double s = 0;
+            for (unsigned k=0; k<4; ++k)
+                s += m[i][k]*b.m[k][j];
+            r.m[i][j] = s;
+        }
+    return r;
+}
+
+void
+rigid_transform::point(const double in[3], double out[3]) const
+{
+    double p[3];
+    for (unsigned i=0; i<3; ++i)
+        p[i] = m[i][0]*in[0] + m[i][1]*in[1] + m[i][2]*in[2] + m[i][3];
+    out[0] = p[0];
+    out[1] = p[1];
+    out[2] = p[2];
+}
+
+void
+rigid_transform::vector(const double in[3], double out[3]) const
+{
+    double p[3];
+    for (unsigned i=0; i<3; ++i)
+        p[i] = m[i][0]*in[0] + m[i][1]*in[1] + m[i][2]*in[2];
+    out[0] = p[0];
+    out[1] = p[1];
+    out[2] = p[2];
+}
+
+bool
+rigid_transform::is_rigid(double tol) const
+{
+    for (unsigned i=0; i<3; ++i)
+        for (unsigned j=0; j<3; ++j) {
+            double s = 0;
+            for (unsigned k=0; k<3; ++k)
+                s += m[k][i]*m[k][j];
+            if (std::fabs(s - (i == j ? 1.0 : 0.0)) > tol)
+                return false;
+        }
+    return std::fabs(m[3][0]) <= tol && std::fabs(m[3][1]) <= tol
+        && std::fabs(m[3][2]) <= tol && std::fabs(m[3][3] - 1) <= tol;
+}
+
+std::ostream&
+operator<<(std::ostream& out, const rigid_transform& arg)
+{
+    std::streamsize precision = out.precision(15);
+    for (unsigned i=0; i<4; ++i)
+        out << arg.m[i][0] << ' ' << arg.m[i][1] << ' '
+            << arg.m[i][2] << ' ' << arg.m[i][3] << '\n';
+    out.precision(precision);
+    return out;
+}
+
+std::istream&
+operator>>(std::istream& in, rigid_transform& arg)
+{
+    rigid_transform t;
+    for (unsigned i=0; i<4; ++i)
+        for (unsigned j=0; j<4; ++j)
+            in >> t.m[i][j];
+    if (in)
+        arg = t;
+    return in;
+}
+
+//-----------------------------------------------------------------------------
+project_pointcloud::project_pointcloud(bool sync_to_pps)
+    : pointcloud(sync_to_pps)
+{
+    offset_[0] = offset_[1] = offset_[2] = 0;
+}
+
+void
+project_pointcloud::set_transform(const rigid_transform& t)
+{
+    if (!t.is_rigid())
+        throw(std::runtime_error("project_pointcloud: transform is not rigid"));
+    sop = t;
+}
+
+void
+project_pointcloud::set_transform(const std::vector<rigid_transform>& chain)
+{
+    rigid_transform t;
+    for (std::size_t k=0; k<chain.size(); ++k)
+        t = chain[k]*t;
+    set_transform(t);
+}
+
+void
+project_pointcloud::set_offset(double x, double y, double z)
+{
+    offset_[0] = x;
+    offset_[1] = y;
+    offset_[2] = z;
+}
+
+void
+project_pointcloud::set_offset_to_scanner()
+{
+    set_offset(sop.m[0][3], sop.m[1][3], sop.m[2][3]);
+}
+
+void
+project_pointcloud::on_shot()
+{
+    sop.point(beam_origin, beam_origin);
+    sop.vector(beam_direction, beam_direction);
+    for (unsigned i=0; i<3; ++i)
+        beam_origin[i] -= offset_[i];
+    pointcloud::on_shot();
+}
+
+void
+project_pointcloud::on_echo_transformed(echo_type echo)
+{
+    // the vertex stage: echo_range along the transformed beam
+    target& t = targets[target_count - 1];
+    for (unsigned i=0; i<3; ++i)
+        t.vertex[i] = static_cast<float>(beam_origin[i] + t.echo_range*beam_direction[i]);
+    pointcloud::on_echo_transformed(echo);
+}
+
+} // namespace vpp
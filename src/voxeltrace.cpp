@@ -0,0 +1,369 @@
+// $Id$
+
+#include <vpp/voxeltrace.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+using namespace scanlib;
+
+namespace vpp {
+
+//-----------------------------------------------------------------------------
+void
+voxel_batch::add(const double origin[3], const double direction[3], const double* r, unsigned n)
+{
+    beams.insert(beams.end(), origin, origin + 3);
+    beams.insert(beams.end(), direction, direction + 3);
+    ranges.insert(ranges.end(), r, r + n);
+    ends.push_back(static_cast<uint32_t>(ranges.size()));
+}
+
+void
+voxel_batch::clear()
+{
+    beams.clear();
+    ends.clear();
+    ranges.clear();
+}
+
+//-----------------------------------------------------------------------------
+voxel_grid::voxel_grid(const double origin[3], double voxel, uint32_t nx, uint32_t ny, uint32_t nz)
+    : voxel_(voxel)
+{
+    if (!(voxel > 0) || nx == 0 || ny == 0 || nz == 0)
+        throw(std::runtime_error("voxel_grid: empty grid"));
+    for (unsigned i=0; i<3; ++i)
+        origin_[i] = origin[i];
+    dims_[0] = nx;
+    dims_[1] = ny;
+    dims_[2] = nz;
+    counts.resize(std::size_t(nx)*ny*nz);
+    clear();
+}
+
+void
+voxel_grid::clear()
+{
+    const voxel_counts zero = { 0, 0, 0, 0 };
+    std::fill(counts.begin(), counts.end(), zero);
+}
+
+void
+voxel_grid::trace(
+    const double o[3]
+    , const double d[3]
+    , const double* r
+    , unsigned n
+    , double max_range
+)
+{
+    const double t_end = n ? r[n-1] : max_range;
+
+    // clip the beam to the grid
+    double t0 = 0, t1 = t_end;
+    for (unsigned i=0; i<3; ++i) {
+        const double lo = origin_[i];
+        const double hi = origin_[i] + voxel_*dims_[i];
+        if (d[i] == 0) {
+            if (o[i] < lo || o[i] >= hi)
+                return;
+            continue;
+        }
+        double ta = (lo - o[i])/d[i];
+        double tb = (hi - o[i])/d[i];
+        if (ta > tb)
+            std::swap(ta, tb);
+        t0 = std::max(t0, ta);
+        t1 = std::min(t1, tb);
+    }
+    if (!(t0 < t1) && !(n && t0 == t1))
+        return;
+
+    // Amanatides and Woo
+    int64_t c[3], step[3], last[3];
+    double t_max[3], t_delta[3];
+    const double inf = std::numeric_limits<double>::infinity();
+    for (unsigned i=0; i<3; ++i) {
+        const double p = (o[i] + t0*d[i] - origin_[i])/voxel_;
+        c[i] = std::min<int64_t>(std::max<int64_t>(static_cast<int64_t>(std::floor(p)), 0), dims_[i] - 1);
+        if (d[i] > 0) {
+            step[i] = 1;
+            last[i] = dims_[i];
+            t_max[i] = (origin_[i] + (c[i] + 1)*voxel_ - o[i])/d[i];
+            t_delta[i] = voxel_/d[i];
+        }
+        else if (d[i] < 0) {
+            step[i] = -1;
+            last[i] = -1;
+            t_max[i] = (origin_[i] + c[i]*voxel_ - o[i])/d[i];
+            t_delta[i] = -voxel_/d[i];
+        }
+        else {
+            step[i] = 0;
+            last[i] = -1;
+            t_max[i] = inf;
+            t_delta[i] = inf;
+        }
+    }
+
+    // echoes in front of the grid are not counted
+    unsigned e = 0;
+    while (e < n && r[e] < t0)
+        ++e;
+    const float w = n ? 1.0f/n : 0.0f;
+
+    for (;;) {
+        const unsigned a = t_max[0] < t_max[1]
+            ? (t_max[0] < t_max[2] ? 0 : 2)
+            : (t_max[1] < t_max[2] ? 1 : 2);
+        voxel_counts& v = counts[index(
+            static_cast<uint32_t>(c[0]), static_cast<uint32_t>(c[1]), static_cast<uint32_t>(c[2]))];
+        ++v.entries;
+
+        if (t_max[a] >= t1) {
+            // the beam ends in this voxel or leaves the grid
+            for (; e < n && r[e] <= t1; ++e) {
+                ++v.hits;
+                v.hits_weighted += w;
+            }
+            if (t1 < t_end)
+                ++v.exits;
+            return;
+        }
+        for (; e < n && r[e] < t_max[a]; ++e) {
+            ++v.hits;
+            v.hits_weighted += w;
+        }
+        ++v.exits;
+        c[a] += step[a];
+        if (c[a] == last[a])
+            return;
+        t_max[a] += t_delta[a];
+    }
+}
+
+void
+voxel_grid::trace(const voxel_batch& b, double max_range)
+{
+    uint32_t begin = 0;
+    for (std::size_t k=0; k<b.size(); ++k) {
+        const double* beam = &b.beams[6*k];
+        const uint32_t end = b.ends[k];
+        trace(beam, beam + 3, b.ranges.data() + begin, end - begin, max_range);
+        begin = end;
+    }
+}
+
+void
+voxel_grid::merge(const voxel_grid& g)
+{
+    merge(g, 0, counts.size());
+}
+
+void
+voxel_grid::merge(const voxel_grid& g, std::size_t begin, std::size_t end)
+{
+    if (voxel_ != g.voxel_
+        || !std::equal(dims_, dims_ + 3, g.dims_)
+        || !std::equal(origin_, origin_ + 3, g.origin_))
+        throw(std::runtime_error("voxel_grid: merge of different geometry"));
+    end = std::min(end, counts.size());
+    for (std::size_t k=begin; k<end; ++k) {
+        voxel_counts& v = counts[k];
+        const voxel_counts& x = g.counts[k];
+        v.entries += x.entries;
+        v.hits += x.hits;
+        v.exits += x.exits;
+        v.hits_weighted += x.hits_weighted;
+    }
+}
+
+//-----------------------------------------------------------------------------
+voxel_tracer::voxel_tracer(const voxel_grid& geometry, unsigned threads, std::size_t batch_shots_)
+    : max_range(std::numeric_limits<double>::infinity())
+    , result_(geometry)
+    , batch_shots(std::max<std::size_t>(batch_shots_, 1))
+    , shots_(0)
+    , finished(false)
+    , current(0)
+    , closing(false)
+    , abort(false)
+{
+    const unsigned n = threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned k=0; k<2*n; ++k) {
+        storage.emplace_back(new voxel_batch);
+        free_batches.push_back(storage.back().get());
+    }
+    for (unsigned k=0; k<n; ++k) {
+        grids.emplace_back(new voxel_grid(geometry));
+        grids.back()->clear();
+    }
+    for (unsigned k=0; k<n; ++k) {
+        voxel_grid& g = *grids[k];
+        workers.emplace_back([this, &g]() { work(g); });
+    }
+}
+
+voxel_tracer::~voxel_tracer()
+{
+    if (!finished) {
+        abort = true;
+        stop();
+    }
+}
+
+void
+voxel_tracer::work(voxel_grid& grid)
+{
+    for (;;) {
+        voxel_batch* b = 0;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            work_cv.wait(lock, [this]{ return abort || closing || !queue.empty(); });
+            if (abort || queue.empty())
+                return;
+            b = queue.front();
+            queue.pop_front();
+        }
+        try {
+            grid.trace(*b, max_range);
+        }
+        catch (...) {
+            fail(std::current_exception());
+        }
+        b->clear();
+        std::lock_guard<std::mutex> lock(mutex);
+        free_batches.push_back(b);
+        free_cv.notify_one();
+    }
+}
+
+void
+voxel_tracer::fail(std::exception_ptr e)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!error)
+        error = e;
+    abort = true;
+    work_cv.notify_all();
+    free_cv.notify_all();
+}
+
+void
+voxel_tracer::add(const double origin[3], const double direction[3], const double* ranges, unsigned n)
+{
+    if (finished)
+        throw(std::runtime_error("voxel_tracer: already finished"));
+    if (!current) {
+        std::unique_lock<std::mutex> lock(mutex);
+        free_cv.wait(lock, [this]{ return abort || !free_batches.empty(); });
+        if (abort)
+            std::rethrow_exception(error);
+        current = free_batches.back();
+        free_batches.pop_back();
+    }
+    current->add(origin, direction, ranges, n);
+    ++shots_;
+    if (current->size() >= batch_shots)
+        submit();
+}
+
+void
+voxel_tracer::submit()
+{
+    if (!current)
+        return;
+    std::lock_guard<std::mutex> lock(mutex);
+    queue.push_back(current);
+    current = 0;
+    work_cv.notify_one();
+}
+
+void
+voxel_tracer::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closing = true;
+        work_cv.notify_all();
+    }
+    for (std::size_t k=0; k<workers.size(); ++k)
+        if (workers[k].joinable())
+            workers[k].join();
+}
+
+const voxel_grid&
+voxel_tracer::finish()
+{
+    if (finished)
+        return result_;
+    finished = true;
+    submit();
+    stop();
+    if (error)
+        std::rethrow_exception(error);
+
+    // every thread adds all grids over its own range of voxels
+    const std::size_t n = result_.size();
+    const std::size_t parts = workers.size();
+    std::vector<std::thread> mergers;
+    for (std::size_t p=0; p<parts; ++p) {
+        mergers.emplace_back([this, p, parts, n]() {
+            const std::size_t begin = n*p/parts;
+            const std::size_t end = n*(p + 1)/parts;
+            for (std::size_t k=0; k<grids.size(); ++k)
+                result_.merge(*grids[k], begin, end);
+        });
+    }
+    for (std::size_t p=0; p<mergers.size(); ++p)
+        mergers[p].join();
+    grids.clear();
+    return result_;
+}
+
+//-----------------------------------------------------------------------------
+trace_pointcloud::trace_pointcloud(voxel_tracer& tracer_, bool sync_to_pps)
+    : project_pointcloud(sync_to_pps)
+    , shots(0)
+    , tracer(tracer_)
+    , pending(false)
+{
+}
+
+void
+trace_pointcloud::flush()
+{
+    if (!pending)
+        return;
+    tracer.add(origin, direction, 0, 0);
+    pending = false;
+}
+
+void
+trace_pointcloud::on_shot()
+{
+    flush();
+    project_pointcloud::on_shot();
+    std::copy(beam_origin, beam_origin + 3, origin);
+    std::copy(beam_direction, beam_direction + 3, direction);
+    pending = true;
+    ++shots;
+}
+
+void
+trace_pointcloud::on_shot_end()
+{
+    project_pointcloud::on_shot_end();
+    if (!pending)
+        return;
+    ranges.resize(target_count);
+    for (unsigned k=0; k<target_count; ++k)
+        ranges[k] = targets[k].echo_range;
+    std::sort(ranges.begin(), ranges.end());
+    tracer.add(origin, direction, ranges.data(), static_cast<unsigned>(ranges.size()));
+    pending = false;
+}
+
+} // namespace vpp
@@ -0,0 +1,448 @@
+// $Id$
+
+#include <vpp/waveconvert.hpp>
+#include <vpp/wavepool.hpp>
+
+#include <riegl/connection.hpp>
+#include <riegl/rxpmarker.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace scanlib;
+
+namespace vpp {
+
+namespace {
+
+// every packet starts with this word, payload occurrences are escaped
+const uint32_t packet_marker = 0xffffffffu;
+
+// attempts to find a decodable packet after resynchronization
+const unsigned max_resync = 16;
+
+// packet fifo of the decoders in words; the connection position runs
+// ahead of the packet being dispatched by at most its size in bytes
+const std::size_t decoder_words = 1024;
+const uint64_t read_ahead = decoder_words*sizeof(uint32_t);
+
+// file offset of the first packet marker at or after pos, size if none
+uint64_t
+find_marker(const std::string& path, uint64_t pos, uint64_t size)
+{
+    std::ifstream in(path.c_str(), std::ios::binary);
+    pos = (pos + 3) & ~uint64_t(3);
+    in.seekg(pos);
+    std::vector<uint32_t> chunk(16384);
+    while (pos < size && in) {
+        in.read(reinterpret_cast<char*>(chunk.data()), chunk.size()*sizeof(uint32_t));
+        std::size_t n = static_cast<std::size_t>(in.gcount())/sizeof(uint32_t);
+        for (std::size_t k=0; k<n; ++k, pos+=sizeof(uint32_t))
+            if (chunk[k] == packet_marker)
+                return pos;
+    }
+    return size;
+}
+
+// thrown into workers when another thread has failed
+struct aborted {};
+
+// state shared by the workers and the writer
+class shared_state
+{
+public:
+    shared_state(std::size_t blocks, std::size_t block_bytes, unsigned segments)
+        : abort(false)
+        , producers(segments)
+        , start_time(segments+1, 0)
+        , start_known(segments+1, false)
+    {
+        for (std::size_t k=0; k<blocks; ++k) {
+            storage.emplace_back(new wave_block(block_bytes + block_bytes/4));
+            free_blocks.push_back(storage.back().get());
+        }
+        start_time[0] = -std::numeric_limits<double>::infinity();
+        start_known[0] = true;
+        start_time[segments] = std::numeric_limits<double>::infinity();
+        start_known[segments] = true;
+    }
+
+    std::atomic<bool> abort;
+
+    // block pool, blocks until a block is returned by the writer
+    wave_block* acquire() {
+        std::unique_lock<std::mutex> lock(pool_mutex);
+        pool_cv.wait(lock, [this]{ return abort || !free_blocks.empty(); });
+        if (abort)
+            throw(aborted());
+        wave_block* b = free_blocks.back();
+        free_blocks.pop_back();
+        return b;
+    }
+    void release(wave_block* b) {
+        b->clear();
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        free_blocks.push_back(b);
+        pool_cv.notify_one();
+    }
+
+    // writer queue
+    void submit(wave_block* b) {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        queue.push_back(b);
+        queue_cv.notify_one();
+    }
+    void producer_done() {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        --producers;
+        queue_cv.notify_one();
+    }
+    //!\return next block to write, null when all producers are done
+    wave_block* next() {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        queue_cv.wait(lock, [this]{ return abort || !queue.empty() || producers == 0; });
+        if (abort || queue.empty())
+            return 0;
+        wave_block* b = queue.front();
+        queue.pop_front();
+        return b;
+    }
+
+    // time of the first shot owned by a segment
+    void publish(unsigned segment, double time) {
+        std::lock_guard<std::mutex> lock(start_mutex);
+        start_time[segment] = time;
+        start_known[segment] = true;
+        start_cv.notify_all();
+    }
+    double wait_start(unsigned segment) {
+        std::unique_lock<std::mutex> lock(start_mutex);
+        start_cv.wait(lock, [this, segment]{ return abort || start_known[segment]; });
+        if (abort)
+            throw(aborted());
+        return start_time[segment];
+    }
+
+    // record the first error and wake up everybody
+    void fail(std::exception_ptr e) {
+        {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!error)
+                error = e;
+        }
+        abort = true;
+        { std::lock_guard<std::mutex> lock(pool_mutex); pool_cv.notify_all(); }
+        { std::lock_guard<std::mutex> lock(queue_mutex); queue_cv.notify_all(); }
+        { std::lock_guard<std::mutex> lock(start_mutex); start_cv.notify_all(); }
+    }
+    std::exception_ptr first_error() {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        return error;
+    }
+
+private:
+    std::mutex pool_mutex;
+    std::condition_variable pool_cv;
+    std::vector<std::unique_ptr<wave_block> > storage;
+    std::vector<wave_block*> free_blocks;
+
+    std::mutex queue_mutex;
+    std::condition_variable queue_cv;
+    std::deque<wave_block*> queue;
+    unsigned producers;
+
+    std::mutex start_mutex;
+    std::condition_variable start_cv;
+    std::vector<double> start_time;
+    std::vector<char> start_known;
+
+    std::mutex error_mutex;
+    std::exception_ptr error;
+};
+
+// decoder of one segment of the input
+class segment_decoder
+    : public pooled_wave
+{
+public:
+    segment_decoder(
+        shared_state& state_
+        , unsigned segment_
+        , unsigned segments
+        , uint64_t own_begin_
+        , uint64_t own_end_
+        , const wave_converter& cfg
+    )
+        : pooled_wave(cfg.sync_to_pps)
+        , done(false)
+        , state(state_)
+        , rc(0)
+        , segment(segment_)
+        , last(segment_ + 1 == segments)
+        , own_begin(own_begin_)
+        , own_end(own_end_)
+        , block_bytes(cfg.block_bytes)
+        , owning(segment_ == 0)
+        , have_next(false)
+        , next_start(0)
+        , meas_started(false)
+        , block(0)
+        , sequence(0)
+    {
+        channel_filter = cfg.channels;
+    }
+
+    void attach(basic_rconnection* rc_) { rc = rc_; }
+    bool started() const { return meas_started; }
+    bool owns() const { return owning; }
+
+    // hand over the last block, tell the predecessor if nothing was owned
+    void finish() {
+        if (block) {
+            if (block->record_count())
+                state.submit(block);
+            else
+                state.release(block);
+            block = 0;
+        }
+        if (!owning)
+            state.publish(segment, std::numeric_limits<double>::infinity());
+    }
+
+    std::string meta() {
+        std::ostringstream out;
+        write_meta_component(out);
+        return out.str();
+    }
+
+    bool done;
+
+protected:
+    void on_meas_start(const meas_start<iterator_type>& arg) {
+        pooled_wave::on_meas_start(arg);
+        meas_started = true;
+    }
+
+    void on_wave(waveform& w) {
+        if (done)
+            return;
+        if (state.abort)
+            throw(aborted());
+
+        if (!owning) {
+            if (rc->tellg() < own_begin)
+                return; // still warming up
+            owning = true;
+            state.publish(segment, w.time);
+        }
+        // the successor owns the shots from its start time on; its start
+        // shot may lie up to one read ahead before own_end, so the time
+        // is known before any wave at or after it is reached here
+        if (!have_next && !last && rc->tellg() + read_ahead >= own_end) {
+            next_start = state.wait_start(segment + 1);
+            have_next = true;
+        }
+        if (have_next && w.time >= next_start) {
+            if (rc->tellg() >= own_end)
+                done = true;
+            return;
+        }
+
+        pooled_wave::on_wave(w);
+    }
+
+    void on_record(wave_record& r) {
+        if (!block) {
+            block = state.acquire();
+            block->segment = segment;
+            block->sequence = sequence++;
+        }
+        block->append(r);
+        if (block->size() >= block_bytes) {
+            state.submit(block);
+            block = 0;
+        }
+    }
+
+private:
+    shared_state& state;
+    basic_rconnection* rc;
+    unsigned segment;
+    bool last;
+    uint64_t own_begin;
+    uint64_t own_end;
+    std::size_t block_bytes;
+    bool owning;
+    bool have_next;
+    double next_start;
+    bool meas_started;
+    wave_block* block;
+    uint32_t sequence;
+};
+
+void
+run_segment(
+    shared_state& state
+    , segment_decoder& d
+    , const std::string& path
+    , uint64_t size
+    , uint64_t warmup_begin
+)
+{
+    std::shared_ptr<basic_rconnection> rc
+        = basic_rconnection::create("file:" + path);
+    rc->open();
+    d.attach(rc.get());
+    std::unique_ptr<decoder_rxpmarker> dec(new decoder_rxpmarker(rc, decoder_words));
+    buffer buf;
+
+    uint64_t resync = 0;
+    if (warmup_begin > 0) {
+        // replay the configuration at the head of the file
+        for (dec->get(buf); !dec->eoi(); dec->get(buf)) {
+            d.dispatch(buf.begin(), buf.end());
+            if (d.started() || rc->tellg() >= warmup_begin)
+                break;
+        }
+        if (rc->tellg() < warmup_begin) {
+            resync = find_marker(path, warmup_begin, size);
+            dec.reset();
+            rc->seekg(resync);
+            dec.reset(new decoder_rxpmarker(rc, decoder_words, 340, false));
+        }
+    }
+
+    for (unsigned attempt=0;; ++attempt) {
+        try {
+            for (dec->get(buf); !dec->eoi() && !d.done; dec->get(buf)) {
+                if (state.abort)
+                    throw(aborted());
+                d.dispatch(buf.begin(), buf.end());
+            }
+            break;
+        }
+        catch (const aborted&) {
+            throw;
+        }
+        catch (...) {
+            // a marker found by scanning may belong to a damaged packet,
+            // try the next one as long as we are in the warmup range
+            if (resync == 0 || d.owns() || attempt >= max_resync)
+                throw;
+            resync = find_marker(path, resync + sizeof(uint32_t), size);
+            dec.reset();
+            rc->seekg(resync);
+            dec.reset(new decoder_rxpmarker(rc, decoder_words, 340, false));
+        }
+    }
+    rc->close();
+}
+
+} // anonymous namespace
+
+//-----------------------------------------------------------------------------
+wave_converter::statistics::statistics()
+    : segments(0)
+    , records(0)
+    , blocks(0)
+    , bytes_written(0)
+    , allocations(0)
+{
+}
+
+wave_converter::wave_converter()
+    : threads(0)
+    , min_segment_bytes(64u<<20)
+    , warmup_bytes(16u<<20)
+    , block_bytes(4u<<20)
+    , pool_blocks(0)
+    , sync_to_pps(false)
+{
+    channels.set();
+}
+
+wave_converter::statistics
+wave_converter::run(const std::string& rxp_path, const std::string& vwf_path)
+{
+    statistics st;
+
+    uint64_t size = 0;
+    {
+        std::ifstream in(rxp_path.c_str(), std::ios::binary | std::ios::ate);
+        if (!in)
+            throw(std::runtime_error("wave_converter: cannot open " + rxp_path));
+        size = static_cast<uint64_t>(in.tellg());
+    }
+
+    unsigned n = threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+    uint64_t segments = std::max<uint64_t>(1, size/std::max<uint64_t>(1, min_segment_bytes));
+    st.segments = static_cast<unsigned>(std::min<uint64_t>(n, segments));
+
+    shared_state state(pool_blocks ? pool_blocks : 4*st.segments, block_bytes, st.segments);
+
+    std::vector<std::unique_ptr<segment_decoder> > decoders;
+    std::vector<uint64_t> warmup;
+    for (unsigned k=0; k<st.segments; ++k) {
+        uint64_t begin = size*k/st.segments;
+        uint64_t end = (k+1 == st.segments)
+            ? std::numeric_limits<uint64_t>::max()
+            : size*(k+1)/st.segments;
+        decoders.emplace_back(new segment_decoder(state, k, st.segments, begin, end, *this));
+        warmup.push_back(begin > warmup_bytes ? begin - warmup_bytes : 0);
+    }
+
+    wave_file_writer out(vwf_path);
+
+    std::thread writer([&]() {
+        try {
+            while (wave_block* b = state.next()) {
+                out.write(*b);
+                ++st.blocks;
+                st.records += b->record_count();
+                state.release(b);
+            }
+        }
+        catch (...) {
+            state.fail(std::current_exception());
+        }
+    });
+
+    std::vector<std::thread> workers;
+    for (unsigned k=0; k<st.segments; ++k) {
+        workers.emplace_back([&, k]() {
+            try {
+                run_segment(state, *decoders[k], rxp_path, size, warmup[k]);
+                decoders[k]->finish();
+            }
+            catch (...) {
+                state.fail(std::current_exception());
+            }
+            state.producer_done();
+        });
+    }
+    for (std::size_t k=0; k<workers.size(); ++k)
+        workers[k].join();
+    writer.join();
+
+    if (std::exception_ptr e = state.first_error())
+        std::rethrow_exception(e);
+
+    for (std::size_t k=0; k<decoders.size(); ++k)
+        st.allocations += decoders[k]->pool().allocations();
+    out.close(decoders[0]->meta());
+    st.bytes_written = out.bytes_written();
+    return st;
+}
+
+} // namespace vpp
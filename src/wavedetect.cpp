@@ -0,0 +1,326 @@
+// $Id$
+
+#include <vpp/wavedetect.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <limits>
+#include <stdexcept>
+
+using namespace scanlib;
+
+namespace vpp {
+
+namespace {
+
+// longest pulse template in samples
+const std::size_t max_template = 128;
+
+// relative level below which the pulse model is truncated
+const double template_floor = 1e-3;
+
+// samples used to estimate the baseline if no channel statistic is present
+const std::size_t baseline_samples = 16;
+
+// vertex of the parabola through (-1,a), (0,b), (1,c), offset from 0
+double
+parabola_offset(double a, double b, double c)
+{
+    double d = a - 2*b + c;
+    if (d >= 0)
+        return 0;
+    double o = 0.5*(a - c)/d;
+    return std::max(-0.5, std::min(0.5, o));
+}
+
+// full width at half maximum of a peak normalized template
+double
+template_width(const std::vector<float>& h, std::size_t top)
+{
+    std::size_t l = top;
+    while (l > 0 && h[l-1] >= 0.5f)
+        --l;
+    std::size_t r = top;
+    while (r+1 < h.size() && h[r+1] >= 0.5f)
+        ++r;
+    double left = double(l);
+    if (l > 0)
+        left -= (h[l] - 0.5)/(h[l] - h[l-1]);
+    double right = double(r);
+    if (r+1 < h.size())
+        right += (h[r] - 0.5)/(h[r] - h[r+1]);
+    return right - left;
+}
+
+bool
+expsum_template(const wave::channel_t& ch, wave_echo_detector::pulse_model& m)
+{
+    if (ch.expsum_a.empty() || ch.expsum_a.size() != ch.expsum_b.size())
+        return false;
+    if (!(ch.sampling_time > 0))
+        return false;
+
+    std::vector<double> p(max_template);
+    for (std::size_t n=0; n<p.size(); ++n) {
+        std::complex<double> s(0);
+        double t = n*ch.sampling_time;
+        for (std::size_t k=0; k<ch.expsum_a.size(); ++k)
+            s += ch.expsum_a[k]*std::exp(ch.expsum_b[k]*t);
+        p[n] = s.real();
+    }
+
+    std::size_t top = std::max_element(p.begin(), p.end()) - p.begin();
+    double pmax = p[top];
+    if (!(pmax > 0) || !std::isfinite(pmax))
+        return false;
+
+    // truncate, but keep the neighbours of the peak for interpolation
+    std::size_t first = top;
+    while (first > 0 && (first == top || std::fabs(p[first-1]) >= template_floor*pmax))
+        --first;
+    std::size_t last = top;
+    while (last+1 < p.size() && (last == top || std::fabs(p[last+1]) >= template_floor*pmax))
+        ++last;
+
+    m.h.resize(last - first + 1);
+    for (std::size_t n=first; n<=last; ++n)
+        m.h[n-first] = static_cast<float>(p[n]/pmax);
+    top -= first;
+    m.peak = double(top);
+    if (top > 0 && top+1 < m.h.size())
+        m.peak += parabola_offset(m.h[top-1], m.h[top], m.h[top+1]);
+    m.width = template_width(m.h, top);
+    m.expsum = true;
+    return true;
+}
+
+void
+gaussian_template(double fwhm, wave_echo_detector::pulse_model& m)
+{
+    double sigma = std::max(fwhm, 1.0)/2.3548200450309493;
+    std::size_t half = static_cast<std::size_t>(std::ceil(3*sigma));
+    m.h.resize(2*half + 1);
+    for (std::size_t n=0; n<m.h.size(); ++n) {
+        double u = (double(n) - double(half))/sigma;
+        m.h[n] = static_cast<float>(std::exp(-0.5*u*u));
+    }
+    m.peak = double(half);
+    m.width = template_width(m.h, half);
+    m.expsum = false;
+}
+
+bool
+by_amplitude(const std::pair<double, double>& a, const std::pair<double, double>& b)
+{
+    return a.second > b.second;
+}
+
+} // anonymous namespace
+
+//-----------------------------------------------------------------------------
+wave_echo_detector::pulse_model::pulse_model()
+    : energy(0)
+    , peak(0)
+    , width(0)
+    , sampling_time(0)
+    , delay(0)
+    , expsum(false)
+{
+}
+
+wave_echo_detector::wave_echo_detector()
+    : snr_threshold(4)
+    , min_separation(0)
+    , max_echoes(16)
+    , v_group(299792458.0/1.00027)
+    , fallback_fwhm(4)
+    , wavelets(0)
+    , echoes(0)
+    , no_reference(0)
+    , reference(std::numeric_limits<std::size_t>::max())
+{
+    channels.set(0);
+    channels.set(1);
+}
+
+void
+wave_echo_detector::configure(wave& w)
+{
+    models.clear();
+    models.resize(std::max<std::size_t>(w.channel_properties.size(), 1));
+    for (std::size_t k=0; k<w.channel_properties.size(); ++k) {
+        const wave::channel_t& ch = w.channel_properties[k];
+        pulse_model& m = models[k];
+        if (!expsum_template(ch, m))
+            gaussian_template(fallback_fwhm, m);
+        m.sampling_time = ch.sampling_time;
+        m.delay = ch.delay;
+    }
+    for (std::size_t k=0; k<models.size(); ++k) {
+        pulse_model& m = models[k];
+        if (m.h.empty())
+            gaussian_template(fallback_fwhm, m);
+        m.energy = 0;
+        for (std::size_t n=0; n<m.h.size(); ++n)
+            m.energy += m.h[n]*m.h[n];
+    }
+    reference = w.reference_channel_index;
+    ampl_high.assign(w.amplitude_high_power);
+    ampl_low.assign(w.amplitude_low_power);
+}
+
+std::size_t
+wave_echo_detector::find_peaks(
+    const uint16_t* samples
+    , std::size_t count
+    , float mean
+    , float stdev
+    , const pulse_model& m
+    , std::vector<peak_t>& result
+)
+{
+    result.clear();
+    if (count == 0)
+        return 0;
+
+    if (!std::isfinite(mean) || !(stdev > 0)) {
+        // no channel statistic, estimate from the leading samples
+        std::size_t n = std::min(count, baseline_samples);
+        double s = 0, s2 = 0;
+        for (std::size_t k=0; k<n; ++k) {
+            s += samples[k];
+            s2 += double(samples[k])*samples[k];
+        }
+        mean = static_cast<float>(s/n);
+        stdev = static_cast<float>(std::sqrt(std::max(s2/n - (s/n)*(s/n), 0.0)));
+        stdev = std::max(stdev, 1.0f);
+    }
+
+    // baseline corrected samples, zero padded by the template length on
+    // both sides so that echoes at the wavelet borders are found as well
+    const std::size_t L = m.h.size();
+    const std::size_t nx = count + 2*(L-1);
+    const std::size_t ny = count + L - 1;
+    x.assign(nx, 0.0f);
+    for (std::size_t k=0; k<count; ++k)
+        x[L-1+k] = samples[k] - mean;
+
+    // correlation, y[j] = sum_n x[j+n]*h[n], as one axpy per template
+    // sample so that the inner loop has no reduction
+    y.assign(ny, 0.0f);
+    float* yp = y.data();
+    const float* xp = x.data();
+    for (std::size_t n=0; n<L; ++n) {
+        const float hn = m.h[n];
+        const float* xn = xp + n;
+        for (std::size_t j=0; j<ny; ++j)
+            yp[j] += hn*xn[j];
+    }
+
+    const double threshold = snr_threshold*stdev*std::sqrt(double(m.energy));
+    const double separation = min_separation > 0 ? min_separation : std::max(m.width, 1.0);
+
+    std::vector<std::pair<double, double> >& cand = candidates;
+    cand.clear();
+    for (std::size_t j=1; j+1<ny; ++j) {
+        if (yp[j] > threshold && yp[j] >= yp[j-1] && yp[j] > yp[j+1]) {
+            double o = parabola_offset(yp[j-1], yp[j], yp[j+1]);
+            double top = yp[j] - 0.25*(yp[j-1] - yp[j+1])*o;
+            // lag j corresponds to a pulse starting at sample j-(L-1)
+            double position = double(j) + o - double(L-1) + m.peak;
+            cand.push_back(std::make_pair(position, top/m.energy));
+        }
+    }
+
+    // keep the strongest echoes at least one separation apart
+    std::sort(cand.begin(), cand.end(), by_amplitude);
+    for (std::size_t k=0; k<cand.size() && result.size()<max_echoes; ++k) {
+        bool close = false;
+        for (std::size_t i=0; i<result.size() && !close; ++i)
+            close = std::fabs(result[i].position - cand[k].first) < separation;
+        if (!close) {
+            peak_t p;
+            p.position = cand[k].first;
+            p.amplitude = cand[k].second;
+            result.push_back(p);
+        }
+    }
+    return result.size();
+}
+
+std::size_t
+wave_echo_detector::detect(const wave_record& r, std::vector<target>& out)
+{
+    if (!configured())
+        throw(std::logic_error("wave_echo_detector: not configured"));
+
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+
+    // emission time from the reference pulse
+    double t_ref = r.time_sorg;
+    bool have_ref = false;
+    for (std::size_t k=0; k<r.wavelets.size() && !have_ref; ++k) {
+        const wave_record::wavelet_t& w = r.wavelets[k];
+        if (w.channel != reference || w.channel >= models.size())
+            continue;
+        const pulse_model& m = models[w.channel];
+        float mean = nan, stdev = nan;
+        if (w.channel < r.channel_statistic.size()) {
+            mean = r.channel_statistic[w.channel].mean;
+            stdev = r.channel_statistic[w.channel].stdev;
+        }
+        if (find_peaks(r.wavelet_samples(k), w.count, mean, stdev, m, peaks)) {
+            t_ref = w.time + peaks[0].position*m.sampling_time - m.delay;
+            have_ref = true;
+        }
+    }
+    if (!have_ref)
+        ++no_reference;
+
+    std::size_t found = 0;
+    for (std::size_t k=0; k<r.wavelets.size(); ++k) {
+        const wave_record::wavelet_t& w = r.wavelets[k];
+        if (w.channel >= models.size() || w.channel >= channels.size()
+            || !channels.test(w.channel) || w.channel == reference)
+            continue;
+        ++wavelets;
+        const pulse_model& m = models[w.channel];
+        float mean = nan, stdev = nan;
+        if (w.channel < r.channel_statistic.size()) {
+            mean = r.channel_statistic[w.channel].mean;
+            stdev = r.channel_statistic[w.channel].stdev;
+        }
+        find_peaks(r.wavelet_samples(k), w.count, mean, stdev, m, peaks);
+        std::sort(peaks.begin(), peaks.end()
+            , [](const peak_t& a, const peak_t& b) { return a.position < b.position; });
+
+        for (std::size_t i=0; i<peaks.size(); ++i) {
+            double t = w.time + peaks[i].position*m.sampling_time - m.delay;
+            target e;
+            e.echo_range = 0.5*v_group*(t - t_ref);
+            for (int c=0; c<3; ++c)
+                e.vertex[c] = static_cast<float>(r.origin[c] + e.echo_range*r.direction[c]);
+            e.zone_index = 0;
+            e.time = r.time;
+            e.time_sorg = r.time_sorg;
+            if (w.channel == 0 && !ampl_high.empty())
+                e.amplitude = static_cast<float>(ampl_high(peaks[i].amplitude));
+            else if (w.channel == 1 && !ampl_low.empty())
+                e.amplitude = static_cast<float>(ampl_low(peaks[i].amplitude));
+            else
+                e.amplitude = nan;
+            e.reflectance = nan;
+            e.is_sw = true;
+            e.is_high_power = (w.channel == 0);
+            e.is_pps_locked = r.pps;
+            e.facet = r.facet;
+            out.push_back(e);
+        }
+        found += peaks.size();
+    }
+    echoes += found;
+    return found;
+}
+
+} // namespace vpp
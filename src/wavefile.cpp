@@ -0,0 +1,836 @@
+// $Id$
+
+#include <vpp/wavefile.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define VPP_HAVE_MMAP 1
+#endif
+
+namespace vpp {
+
+namespace {
+
+// On disk layout, all structures are multiples of 8 bytes:
+//
+//   file_head
+//   { block_head payload }*
+//   meta string (footer.meta_bytes)
+//   wave_file_writer::block_info * footer.index_count
+//   file_foot
+//
+// A payload is a sequence of records:
+//
+//   record_head
+//   wave_record::wavelet_t * wavelet_count
+//   wave_record::statistic_t * statistic_count
+//   uint16_t * sample_count, padded to 8 bytes
+
+const char file_magic[8] = { 'V', 'P', 'P', 'W', 'A', 'V', 'E', '\0' };
+const uint32_t file_version = 2;
+const uint32_t block_magic = 0x314b4c42; // "BLK1"
+const uint32_t index_magic = 0x49465756; // "VWFI"
+
+struct file_head {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+};
+
+struct block_head {
+    uint32_t magic;
+    uint32_t segment;
+    uint32_t sequence;
+    uint32_t record_count;
+    uint64_t payload_bytes;
+    double time_min;
+    double time_max;
+};
+
+struct record_head {
+    double time_sorg;
+    double time;
+    double origin[3];
+    double direction[3];
+    double line_angle;
+    double frame_angle;
+    uint32_t facet;
+    uint16_t flags;
+    uint16_t wavelet_count;
+    uint32_t statistic_count;
+    uint32_t sample_count;
+};
+
+struct file_foot {
+    uint64_t meta_offset;
+    uint64_t meta_bytes;
+    uint64_t index_offset;
+    uint32_t index_count;
+    uint32_t magic;
+};
+
+const uint16_t flag_pps = 1;
+
+const double rad_to_deg = 57.295779513082320876798;
+
+static_assert(sizeof(file_head) == 16, "file_head layout");
+static_assert(sizeof(block_head) == 40, "block_head layout");
+static_assert(sizeof(record_head) == 96, "record_head layout");
+static_assert(sizeof(file_foot) == 32, "file_foot layout");
+static_assert(sizeof(wave_record::wavelet_t) == 24, "wavelet_t layout");
+static_assert(sizeof(wave_record::statistic_t) == 8, "statistic_t layout");
+static_assert(sizeof(wave_file_writer::block_info) == 80, "block_info layout");
+
+std::size_t
+padded(std::size_t n)
+{
+    return (n + 7) & ~std::size_t(7);
+}
+
+double
+zenith_of(const double* d)
+{
+    return std::atan2(std::sqrt(d[0]*d[0] + d[1]*d[1]), d[2])*rad_to_deg;
+}
+
+double
+azimuth_of(const double* d)
+{
+    double a = std::atan2(d[1], d[0])*rad_to_deg;
+    return a < 0 ? a + 360 : a;
+}
+
+// latest shot time up to each block, non-decreasing in any file
+void
+time_ends(const std::vector<wave_file_writer::block_info>& index, std::vector<double>& ends)
+{
+    ends.resize(index.size());
+    double last = -std::numeric_limits<double>::infinity();
+    for (std::size_t k=0; k<index.size(); ++k) {
+        if (index[k].record_count)
+            last = std::max(last, index[k].time_max);
+        ends[k] = last;
+    }
+}
+
+void
+append_bytes(std::vector<char>& v, const void* p, std::size_t n)
+{
+    const char* c = static_cast<const char*>(p);
+    v.insert(v.end(), c, c + n);
+}
+
+} // anonymous namespace
+
+//-----------------------------------------------------------------------------
+wave_record::wave_record()
+    : time_sorg(0)
+    , time(0)
+    , facet(0)
+    , line_angle(0)
+    , frame_angle(0)
+    , pps(false)
+{
+    origin[0] = origin[1] = origin[2] = 0;
+    direction[0] = direction[1] = direction[2] = 0;
+}
+
+void
+wave_record::clear()
+{
+    time_sorg = 0;
+    time = 0;
+    facet = 0;
+    line_angle = 0;
+    frame_angle = 0;
+    pps = false;
+    origin[0] = origin[1] = origin[2] = 0;
+    direction[0] = direction[1] = direction[2] = 0;
+    wavelets.clear();
+    samples.clear();
+    channel_statistic.clear();
+}
+
+void
+wave_record::add_wavelet(
+    double time_
+    , uint32_t channel
+    , const uint16_t* first
+    , std::size_t count
+)
+{
+    wavelet_t w;
+    w.time = time_;
+    w.channel = channel;
+    w.offset = samples.size();
+    w.count = static_cast<uint32_t>(count);
+    wavelets.push_back(w);
+    samples.insert(samples.end(), first, first + count);
+}
+
+double
+wave_zenith(const wave_record& r)
+{
+    return zenith_of(r.direction);
+}
+
+double
+wave_azimuth(const wave_record& r)
+{
+    return azimuth_of(r.direction);
+}
+
+//-----------------------------------------------------------------------------
+wave_block::wave_block(std::size_t reserve_bytes)
+    : segment(0)
+    , sequence(0)
+{
+    payload.reserve(reserve_bytes);
+    clear();
+}
+
+void
+wave_block::append(const wave_record& r)
+{
+    if (r.wavelets.size() > std::numeric_limits<uint16_t>::max())
+        throw(std::length_error("wave_block: too many wavelets"));
+
+    record_head h;
+    h.time_sorg = r.time_sorg;
+    h.time = r.time;
+    std::copy(r.origin, r.origin+3, h.origin);
+    std::copy(r.direction, r.direction+3, h.direction);
+    h.line_angle = r.line_angle;
+    h.frame_angle = r.frame_angle;
+    h.facet = r.facet;
+    h.flags = r.pps ? flag_pps : 0;
+    h.wavelet_count = static_cast<uint16_t>(r.wavelets.size());
+    h.statistic_count = static_cast<uint32_t>(r.channel_statistic.size());
+    h.sample_count = static_cast<uint32_t>(r.samples.size());
+
+    const std::size_t sample_bytes = r.samples.size()*sizeof(uint16_t);
+    std::size_t n = sizeof(h)
+        + r.wavelets.size()*sizeof(wave_record::wavelet_t)
+        + r.channel_statistic.size()*sizeof(wave_record::statistic_t)
+        + padded(sample_bytes);
+    if (payload.size() + n > payload.capacity())
+        payload.reserve(std::max(payload.size() + n, 2*payload.capacity()));
+
+    append_bytes(payload, &h, sizeof(h));
+    if (!r.wavelets.empty())
+        append_bytes(payload, r.wavelets.data()
+            , r.wavelets.size()*sizeof(wave_record::wavelet_t));
+    if (!r.channel_statistic.empty())
+        append_bytes(payload, r.channel_statistic.data()
+            , r.channel_statistic.size()*sizeof(wave_record::statistic_t));
+    if (sample_bytes)
+        append_bytes(payload, r.samples.data(), sample_bytes);
+    payload.resize(payload.size() + padded(sample_bytes) - sample_bytes, 0);
+
+    ++records;
+    t_min = std::min(t_min, r.time);
+    t_max = std::max(t_max, r.time);
+    double z = zenith_of(r.direction);
+    double a = azimuth_of(r.direction);
+    z_min = std::min(z_min, z);
+    z_max = std::max(z_max, z);
+    a_min = std::min(a_min, a);
+    a_max = std::max(a_max, a);
+}
+
+void
+wave_block::clear()
+{
+    const double inf = std::numeric_limits<double>::infinity();
+    payload.clear();
+    records = 0;
+    t_min = z_min = a_min = inf;
+    t_max = z_max = a_max = -inf;
+}
+
+//-----------------------------------------------------------------------------
+wave_file_writer::wave_file_writer(const std::string& path_)
+    : path(path_)
+    , temporary(path_ + ".tmp")
+    , out(temporary.c_str(), std::ios::binary | std::ios::trunc)
+    , pos(0)
+{
+    if (!out)
+        throw(std::runtime_error("wave_file_writer: cannot create " + temporary));
+    file_head h;
+    std::memcpy(h.magic, file_magic, sizeof(h.magic));
+    h.version = file_version;
+    h.reserved = 0;
+    put(&h, sizeof(h));
+}
+
+wave_file_writer::~wave_file_writer()
+{
+    // an unclosed file has no index, nothing ever gets to path
+    if (out.is_open()) {
+        out.close();
+        std::remove(temporary.c_str());
+    }
+}
+
+void
+wave_file_writer::put(const void* p, std::size_t n)
+{
+    out.write(static_cast<const char*>(p), n);
+    if (!out)
+        throw(std::runtime_error("wave_file_writer: cannot write " + path));
+    pos += n;
+}
+
+void
+wave_file_writer::write(const wave_block& b)
+{
+    block_head h;
+    h.magic = block_magic;
+    h.segment = b.segment;
+    h.sequence = b.sequence;
+    h.record_count = b.record_count();
+    h.payload_bytes = b.size();
+    h.time_min = b.time_min();
+    h.time_max = b.time_max();
+
+    block_info e;
+    e.offset = pos;
+    e.segment = h.segment;
+    e.sequence = h.sequence;
+    e.record_count = h.record_count;
+    e.reserved = 0;
+    e.payload_bytes = h.payload_bytes;
+    e.time_min = h.time_min;
+    e.time_max = h.time_max;
+    e.zenith_min = b.zenith_min();
+    e.zenith_max = b.zenith_max();
+    e.azimuth_min = b.azimuth_min();
+    e.azimuth_max = b.azimuth_max();
+
+    put(&h, sizeof(h));
+    put(b.data(), b.size());
+    index.push_back(e);
+}
+
+namespace {
+bool
+block_order(
+    const wave_file_writer::block_info& a
+    , const wave_file_writer::block_info& b
+)
+{
+    if (a.segment != b.segment)
+        return a.segment < b.segment;
+    return a.sequence < b.sequence;
+}
+} // anonymous namespace
+
+void
+wave_file_writer::close(const std::string& meta)
+{
+    std::stable_sort(index.begin(), index.end(), block_order);
+
+    file_foot f;
+    f.meta_offset = pos;
+    f.meta_bytes = meta.size();
+    put(meta.data(), meta.size());
+    std::vector<char> pad(padded(meta.size()) - meta.size(), 0);
+    if (!pad.empty())
+        put(pad.data(), pad.size());
+    f.index_offset = pos;
+    f.index_count = static_cast<uint32_t>(index.size());
+    f.magic = index_magic;
+    if (!index.empty())
+        put(index.data(), index.size()*sizeof(block_info));
+    put(&f, sizeof(f));
+    out.close();
+    if (!out) {
+        std::remove(temporary.c_str());
+        throw(std::runtime_error("wave_file_writer: cannot close " + temporary));
+    }
+    // a new inode: mappings of the old file stay valid
+    if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        throw(std::runtime_error("wave_file_writer: cannot rename " + temporary + " to " + path));
+    }
+}
+
+//-----------------------------------------------------------------------------
+wave_window::wave_window()
+    : time_min(-std::numeric_limits<double>::infinity())
+    , time_max(std::numeric_limits<double>::infinity())
+    , zenith_min(0)
+    , zenith_max(180)
+    , azimuth_min(0)
+    , azimuth_max(360)
+{
+}
+
+bool
+wave_window::overlaps(const wave_file_writer::block_info& b) const
+{
+    if (b.time_max < time_min || b.time_min > time_max)
+        return false;
+    if (b.zenith_max < zenith_min || b.zenith_min > zenith_max)
+        return false;
+    if (azimuth_min <= azimuth_max)
+        return b.azimuth_max >= azimuth_min && b.azimuth_min <= azimuth_max;
+    return b.azimuth_max >= azimuth_min || b.azimuth_min <= azimuth_max;
+}
+
+namespace {
+bool
+inside(const wave_window& w, double time, const double* direction)
+{
+    if (time < w.time_min || time > w.time_max)
+        return false;
+    double z = zenith_of(direction);
+    if (z < w.zenith_min || z > w.zenith_max)
+        return false;
+    double a = azimuth_of(direction);
+    if (w.azimuth_min <= w.azimuth_max)
+        return a >= w.azimuth_min && a <= w.azimuth_max;
+    return a >= w.azimuth_min || a <= w.azimuth_max;
+}
+} // anonymous namespace
+
+bool
+wave_window::contains(const wave_record& r) const
+{
+    return inside(*this, r.time, r.direction);
+}
+
+bool
+wave_window::contains(const wave_record_view& r) const
+{
+    return inside(*this, r.time, r.direction);
+}
+
+//-----------------------------------------------------------------------------
+wave_file_reader::wave_file_reader(const std::string& path)
+    : in(path.c_str(), std::ios::binary)
+    , next_block(0)
+    , buffer_pos(0)
+    , buffer_records(0)
+    , windowed(false)
+{
+    file_head h;
+    if (!in.read(reinterpret_cast<char*>(&h), sizeof(h))
+        || std::memcmp(h.magic, file_magic, sizeof(h.magic)) != 0)
+        throw(std::runtime_error("wave_file_reader: not a vwf file " + path));
+    if (h.version != file_version)
+        throw(std::runtime_error("wave_file_reader: unsupported version " + path));
+
+    file_foot f;
+    in.seekg(0, std::ios::end);
+    const uint64_t size = static_cast<uint64_t>(in.tellg());
+    if (!in || size < sizeof(h) + sizeof(f))
+        throw(std::runtime_error("wave_file_reader: missing index " + path));
+    in.seekg(size - sizeof(f));
+    if (!in.read(reinterpret_cast<char*>(&f), sizeof(f)) || f.magic != index_magic)
+        throw(std::runtime_error("wave_file_reader: missing index " + path));
+
+    // as wave_file_map, nothing is allocated for what the file cannot hold
+    if (f.meta_offset > size || f.meta_bytes > size - f.meta_offset
+        || f.index_offset > size || f.index_count > (size - f.index_offset)/sizeof(block_info))
+        throw(std::runtime_error("wave_file_reader: corrupt index " + path));
+    meta_.resize(f.meta_bytes);
+    index.resize(f.index_count);
+    in.seekg(f.meta_offset);
+    if (!meta_.empty())
+        in.read(&meta_[0], meta_.size());
+    in.seekg(f.index_offset);
+    if (!index.empty())
+        in.read(reinterpret_cast<char*>(index.data()), index.size()*sizeof(block_info));
+    if (!in)
+        throw(std::runtime_error("wave_file_reader: cannot read index " + path));
+    for (std::size_t k=0; k<index.size(); ++k) {
+        const block_info& b = index[k];
+        if (b.offset > size || size - b.offset < sizeof(block_head)
+            || b.payload_bytes > size - b.offset - sizeof(block_head))
+            throw(std::runtime_error("wave_file_reader: corrupt index " + path));
+    }
+
+    time_ends(index, time_end);
+}
+
+bool
+wave_file_reader::load_block(std::size_t k)
+{
+    if (k >= index.size())
+        return false;
+    block_head h;
+    in.seekg(index[k].offset);
+    in.read(reinterpret_cast<char*>(&h), sizeof(h));
+    if (!in || h.magic != block_magic || h.payload_bytes != index[k].payload_bytes)
+        throw(std::runtime_error("wave_file_reader: corrupt block"));
+    buffer.resize(h.payload_bytes);
+    if (!buffer.empty())
+        in.read(buffer.data(), buffer.size());
+    if (!in)
+        throw(std::runtime_error("wave_file_reader: truncated block"));
+    buffer_pos = 0;
+    buffer_records = h.record_count;
+    next_block = k + 1;
+    return true;
+}
+
+void
+wave_file_reader::seek_block(std::size_t k)
+{
+    buffer_records = 0;
+    next_block = k;
+}
+
+std::size_t
+wave_file_reader::find_time(double t) const
+{
+    return std::lower_bound(time_end.begin(), time_end.end(), t) - time_end.begin();
+}
+
+bool
+wave_file_reader::seek_time(double t)
+{
+    for (std::size_t k=find_time(t); k<index.size(); ++k) {
+        if (index[k].record_count == 0 || index[k].time_max < t)
+            continue;
+        load_block(k);
+        while (buffer_records) {
+            record_head h;
+            if (buffer.size() - buffer_pos < sizeof(h))
+                throw(std::runtime_error("wave_file_reader: corrupt record"));
+            std::memcpy(&h, buffer.data() + buffer_pos, sizeof(h));
+            if (h.time >= t)
+                return true;
+            buffer_pos += sizeof(h)
+                + h.wavelet_count*sizeof(wave_record::wavelet_t)
+                + h.statistic_count*sizeof(wave_record::statistic_t)
+                + padded(h.sample_count*sizeof(uint16_t));
+            if (buffer_pos > buffer.size())
+                throw(std::runtime_error("wave_file_reader: corrupt record"));
+            --buffer_records;
+        }
+    }
+    seek_block(index.size());
+    return false;
+}
+
+void
+wave_file_reader::set_window(const wave_window& w)
+{
+    window = w;
+    windowed = true;
+}
+
+void
+wave_file_reader::clear_window()
+{
+    window = wave_window();
+    windowed = false;
+}
+
+bool
+wave_file_reader::read(wave_record& r)
+{
+    for (;;) {
+        while (buffer_records == 0) {
+            if (next_block >= index.size())
+                return false;
+            if (windowed && !window.overlaps(index[next_block]))
+                ++next_block;
+            else
+                load_block(next_block);
+        }
+        if (decode(r))
+            return true;
+    }
+}
+
+bool
+wave_file_reader::decode(wave_record& r)
+{
+    const char* p = buffer.data() + buffer_pos;
+    const char* end = buffer.data() + buffer.size();
+    record_head h;
+    if (end - p < static_cast<std::ptrdiff_t>(sizeof(h)))
+        throw(std::runtime_error("wave_file_reader: corrupt record"));
+    std::memcpy(&h, p, sizeof(h));
+    p += sizeof(h);
+
+    const std::size_t wavelet_bytes = h.wavelet_count*sizeof(wave_record::wavelet_t);
+    const std::size_t statistic_bytes = h.statistic_count*sizeof(wave_record::statistic_t);
+    const std::size_t sample_bytes = h.sample_count*sizeof(uint16_t);
+    if (static_cast<std::size_t>(end - p) < wavelet_bytes + statistic_bytes + padded(sample_bytes))
+        throw(std::runtime_error("wave_file_reader: corrupt record"));
+
+    --buffer_records;
+    if (windowed && !inside(window, h.time, h.direction)) {
+        buffer_pos = (p - buffer.data()) + wavelet_bytes + statistic_bytes + padded(sample_bytes);
+        return false;
+    }
+
+    r.time_sorg = h.time_sorg;
+    r.time = h.time;
+    std::copy(h.origin, h.origin+3, r.origin);
+    std::copy(h.direction, h.direction+3, r.direction);
+    r.line_angle = h.line_angle;
+    r.frame_angle = h.frame_angle;
+    r.facet = h.facet;
+    r.pps = (h.flags & flag_pps) != 0;
+
+    r.wavelets.resize(h.wavelet_count);
+    if (wavelet_bytes)
+        std::memcpy(r.wavelets.data(), p, wavelet_bytes);
+    p += wavelet_bytes;
+    r.channel_statistic.resize(h.statistic_count);
+    if (statistic_bytes)
+        std::memcpy(r.channel_statistic.data(), p, statistic_bytes);
+    p += statistic_bytes;
+    r.samples.resize(h.sample_count);
+    if (sample_bytes)
+        std::memcpy(r.samples.data(), p, sample_bytes);
+    p += padded(sample_bytes);
+
+    buffer_pos = p - buffer.data();
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+void
+wave_record_view::copy_to(wave_record& r) const
+{
+    r.time_sorg = time_sorg;
+    r.time = time;
+    std::copy(origin, origin+3, r.origin);
+    std::copy(direction, direction+3, r.direction);
+    r.facet = facet;
+    r.line_angle = line_angle;
+    r.frame_angle = frame_angle;
+    r.pps = pps;
+    r.wavelets.assign(wavelets, wavelets + wavelet_count);
+    r.channel_statistic.assign(channel_statistic, channel_statistic + statistic_count);
+    r.samples.assign(samples, samples + sample_count);
+}
+
+bool
+wave_block_view::next(wave_record_view& r)
+{
+    if (left == 0)
+        return false;
+    record_head h;
+    if (end - p < static_cast<std::ptrdiff_t>(sizeof(h)))
+        throw(std::runtime_error("wave_block_view: corrupt record"));
+    std::memcpy(&h, p, sizeof(h));
+    const char* q = p + sizeof(h);
+
+    const std::size_t wavelet_bytes = h.wavelet_count*sizeof(wave_record::wavelet_t);
+    const std::size_t statistic_bytes = h.statistic_count*sizeof(wave_record::statistic_t);
+    const std::size_t sample_bytes = h.sample_count*sizeof(uint16_t);
+    if (static_cast<std::size_t>(end - q) < wavelet_bytes + statistic_bytes + padded(sample_bytes))
+        throw(std::runtime_error("wave_block_view: corrupt record"));
+
+    r.time_sorg = h.time_sorg;
+    r.time = h.time;
+    std::copy(h.origin, h.origin+3, r.origin);
+    std::copy(h.direction, h.direction+3, r.direction);
+    r.line_angle = h.line_angle;
+    r.frame_angle = h.frame_angle;
+    r.facet = h.facet;
+    r.pps = (h.flags & flag_pps) != 0;
+
+    // records are multiples of 8 bytes and blocks start 8 byte aligned,
+    // so the arrays are suitably aligned in place
+    r.wavelets = reinterpret_cast<const wave_record::wavelet_t*>(q);
+    r.wavelet_count = h.wavelet_count;
+    q += wavelet_bytes;
+    r.channel_statistic = reinterpret_cast<const wave_record::statistic_t*>(q);
+    r.statistic_count = h.statistic_count;
+    q += statistic_bytes;
+    r.samples = reinterpret_cast<const uint16_t*>(q);
+    r.sample_count = h.sample_count;
+    q += padded(sample_bytes);
+
+    p = q;
+    --left;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+namespace {
+
+// open mappings, shared by all users in the process
+struct map_key {
+    uint64_t device;
+    uint64_t inode;
+    uint64_t size;
+    int64_t mtime;              // ns
+    std::string path;           // identifies the file without stat
+    bool operator<(const map_key& o) const {
+        if (device != o.device) return device < o.device;
+        if (inode != o.inode) return inode < o.inode;
+        if (size != o.size) return size < o.size;
+        if (mtime != o.mtime) return mtime < o.mtime;
+        return path < o.path;
+    }
+};
+
+std::mutex map_mutex;
+std::map<map_key, std::weak_ptr<const wave_file_map> > map_registry;
+
+map_key
+file_key(const std::string& path)
+{
+    map_key k;
+    k.device = k.inode = k.size = 0;
+    k.mtime = 0;
+#ifdef VPP_HAVE_MMAP
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0)
+        throw(std::runtime_error("wave_file_map: cannot open " + path));
+    k.device = static_cast<uint64_t>(st.st_dev);
+    k.inode = static_cast<uint64_t>(st.st_ino);
+    k.size = static_cast<uint64_t>(st.st_size);
+#if defined(__APPLE__)
+    const struct timespec& t = st.st_mtimespec;
+#else
+    const struct timespec& t = st.st_mtim;
+#endif
+    k.mtime = static_cast<int64_t>(t.tv_sec)*1000000000 + t.tv_nsec;
+#else
+    k.path = path;
+#endif
+    return k;
+}
+
+} // anonymous namespace
+
+std::shared_ptr<const wave_file_map>
+wave_file_map::open(const std::string& path)
+{
+    map_key key = file_key(path);
+    std::lock_guard<std::mutex> lock(map_mutex);
+    std::shared_ptr<const wave_file_map> m = map_registry[key].lock();
+    if (!m) {
+        m.reset(new wave_file_map(path));
+        map_registry[key] = m;
+        // forget expired mappings
+        for (auto i=map_registry.begin(); i!=map_registry.end();)
+            i = i->second.expired() ? map_registry.erase(i) : std::next(i);
+    }
+    return m;
+}
+
+wave_file_map::wave_file_map(const std::string& path)
+    : path_(path)
+    , data(0)
+    , size(0)
+{
+#ifdef VPP_HAVE_MMAP
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw(std::runtime_error("wave_file_map: cannot open " + path));
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw(std::runtime_error("wave_file_map: cannot open " + path));
+    }
+    size = static_cast<std::size_t>(st.st_size);
+    if (size) {
+        void* p = ::mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) {
+            ::close(fd);
+            throw(std::runtime_error("wave_file_map: cannot map " + path));
+        }
+        data = static_cast<const char*>(p);
+    }
+    ::close(fd);
+#else
+    std::ifstream in(path.c_str(), std::ios::binary | std::ios::ate);
+    if (!in)
+        throw(std::runtime_error("wave_file_map: cannot open " + path));
+    copy.resize(static_cast<std::size_t>(in.tellg()));
+    in.seekg(0);
+    if (!copy.empty() && !in.read(copy.data(), copy.size()))
+        throw(std::runtime_error("wave_file_map: cannot read " + path));
+    data = copy.data();
+    size = copy.size();
+#endif
+
+    try {
+        file_head h;
+        file_foot f;
+        if (size < sizeof(h) + sizeof(f))
+            throw(std::runtime_error("wave_file_map: not a vwf file " + path));
+        std::memcpy(&h, data, sizeof(h));
+        if (std::memcmp(h.magic, file_magic, sizeof(h.magic)) != 0)
+            throw(std::runtime_error("wave_file_map: not a vwf file " + path));
+        if (h.version != file_version)
+            throw(std::runtime_error("wave_file_map: unsupported version " + path));
+        std::memcpy(&f, data + size - sizeof(f), sizeof(f));
+        if (f.magic != index_magic)
+            throw(std::runtime_error("wave_file_map: missing index " + path));
+
+        const std::size_t entry = sizeof(block_info);
+        if (f.meta_offset > size || f.meta_bytes > size - f.meta_offset
+            || f.index_offset > size || f.index_count > (size - f.index_offset)/entry)
+            throw(std::runtime_error("wave_file_map: corrupt index " + path));
+        meta_.assign(data + f.meta_offset, f.meta_bytes);
+        index.resize(f.index_count);
+        if (!index.empty())
+            std::memcpy(index.data(), data + f.index_offset, index.size()*entry);
+        time_ends(index, time_end);
+    }
+    catch (...) {
+#ifdef VPP_HAVE_MMAP
+        if (data)
+            ::munmap(const_cast<char*>(data), size);
+#endif
+        throw;
+    }
+}
+
+wave_file_map::~wave_file_map()
+{
+#ifdef VPP_HAVE_MMAP
+    if (data)
+        ::munmap(const_cast<char*>(data), size);
+#endif
+}
+
+std::size_t
+wave_file_map::find_time(double t) const
+{
+    return std::lower_bound(time_end.begin(), time_end.end(), t) - time_end.begin();
+}
+
+wave_block_view
+wave_file_map::block(std::size_t k) const
+{
+    if (k >= index.size())
+        throw(std::out_of_range("wave_file_map: no such block"));
+    const block_info& b = index[k];
+    block_head h;
+    if (b.offset > size || size - b.offset < sizeof(h))
+        throw(std::runtime_error("wave_file_map: corrupt block"));
+    std::memcpy(&h, data + b.offset, sizeof(h));
+    if (h.magic != block_magic || h.payload_bytes != b.payload_bytes
+        || h.payload_bytes > size - b.offset - sizeof(h))
+        throw(std::runtime_error("wave_file_map: corrupt block"));
+    return wave_block_view(data + b.offset + sizeof(h)
+        , static_cast<std::size_t>(h.payload_bytes), h.record_count);
+}
+
+} // namespace vpp
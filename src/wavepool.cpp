@@ -0,0 +1,135 @@
+// $Id$
+
+#include <vpp/wavepool.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace scanlib;
+
+namespace vpp {
+
+//-----------------------------------------------------------------------------
+wave_record_pool::wave_record_pool(
+    std::size_t prealloc
+    , std::size_t reserve_samples
+    , std::size_t reserve_wavelets
+)
+    : created(0)
+    , growths(0)
+{
+    for (std::size_t k=0; k<prealloc; ++k) {
+        storage.emplace_back(new wave_record);
+        storage.back()->samples.reserve(reserve_samples);
+        storage.back()->wavelets.reserve(reserve_wavelets);
+        free_records.push_back(storage.back().get());
+    }
+}
+
+wave_record*
+wave_record_pool::acquire()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (free_records.empty()) {
+        storage.emplace_back(new wave_record);
+        ++created;
+        return storage.back().get();
+    }
+    wave_record* r = free_records.back();
+    free_records.pop_back();
+    return r;
+}
+
+void
+wave_record_pool::release(wave_record* r)
+{
+    if (!r)
+        return;
+    r->clear();
+    std::lock_guard<std::mutex> lock(mutex);
+    free_records.push_back(r);
+}
+
+std::size_t
+wave_record_pool::in_use() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return storage.size() - free_records.size();
+}
+
+//-----------------------------------------------------------------------------
+pooled_wave::pooled_wave(bool sync_to_pps, wave_record_pool* pool)
+    : wave(sync_to_pps, true)
+    , own_pool(pool ? 0 : new wave_record_pool)
+    , pool_(pool ? pool : own_pool.get())
+    , current(0)
+{
+}
+
+wave_record*
+pooled_wave::retain()
+{
+    if (!current)
+        throw(std::logic_error("pooled_wave::retain: not within on_record"));
+    wave_record* r = current;
+    current = 0;
+    return r;
+}
+
+void
+pooled_wave::on_wave(waveform& w)
+{
+    wave_record* r = pool_->acquire();
+    const std::size_t samples = r->samples.capacity();
+    const std::size_t wavelets = r->wavelets.capacity();
+    const std::size_t statistics = r->channel_statistic.capacity();
+
+    r->time_sorg = w.time_sorg;
+    r->time = w.time;
+    std::copy(w.origin, w.origin+3, r->origin);
+    std::copy(w.direction, w.direction+3, r->direction);
+    r->facet = w.facet;
+    r->line_angle = w.line_angle;
+    r->frame_angle = w.frame_angle;
+    r->pps = w.pps;
+
+    std::size_t total = 0;
+    for (std::size_t k=0; k<w.data.size(); ++k)
+        total += w.data[k].data.size();
+    r->samples.reserve(total);
+    r->wavelets.reserve(w.data.size());
+    for (std::size_t k=0; k<w.data.size(); ++k) {
+        const wavelet& x = w.data[k];
+        if (x.compressed) {
+            pool_->release(r);
+            throw(std::runtime_error("pooled_wave: compressed wavelet"));
+        }
+        r->add_wavelet(x.time, static_cast<uint32_t>(x.channel)
+            , x.data.data(), x.data.size());
+    }
+    r->channel_statistic.resize(w.channel_statistic.size());
+    for (std::size_t k=0; k<w.channel_statistic.size(); ++k) {
+        r->channel_statistic[k].mean = w.channel_statistic[k].mean;
+        r->channel_statistic[k].stdev = w.channel_statistic[k].stdev;
+    }
+
+    pool_->add_growth(
+        (r->samples.capacity() != samples)
+        + (r->wavelets.capacity() != wavelets)
+        + (r->channel_statistic.capacity() != statistics)
+    );
+
+    current = r;
+    try {
+        on_record(*r);
+    }
+    catch (...) {
+        pool_->release(current);
+        current = 0;
+        throw;
+    }
+    pool_->release(current);
+    current = 0;
+}
+
+} // namespace vpp
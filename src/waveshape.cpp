@@ -0,0 +1,320 @@
+// $Id$
+
+#include <vpp/waveshape.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace scanlib;
+
+namespace vpp {
+
+namespace {
+
+// samples used to estimate the baseline if no channel statistic is present
+const std::size_t baseline_samples = 16;
+
+const float nan = std::numeric_limits<float>::quiet_NaN();
+
+// baseline corrected samples of one wavelet
+class pulse
+{
+public:
+    pulse(const uint16_t* s, std::size_t n, float base)
+        : samples(s), count(n), baseline(base) {}
+
+    float operator[](std::size_t k) const { return samples[k] - baseline; }
+    std::size_t size() const { return count; }
+
+    // interpolated crossing of level left of the peak, NaN if none
+    double left(std::size_t peak, float level) const {
+        std::size_t j = peak;
+        while (j > 0 && (*this)[j-1] >= level)
+            --j;
+        if (j == 0)
+            return nan;
+        float a = (*this)[j-1], b = (*this)[j];
+        return double(j-1) + (level - a)/(b - a);
+    }
+
+    // interpolated crossing of level right of the peak, NaN if none
+    double right(std::size_t peak, float level) const {
+        std::size_t j = peak;
+        while (j+1 < count && (*this)[j+1] >= level)
+            ++j;
+        if (j+1 == count)
+            return nan;
+        float a = (*this)[j], b = (*this)[j+1];
+        return double(j) + (a - level)/(a - b);
+    }
+
+private:
+    const uint16_t* samples;
+    std::size_t count;
+    float baseline;
+};
+
+// vertex of the parabola through (-1,a), (0,b), (1,c), offset from 0
+double
+parabola_offset(double a, double b, double c)
+{
+    double d = a - 2*b + c;
+    if (d >= 0)
+        return 0;
+    return std::max(-0.5, std::min(0.5, 0.5*(a - c)/d));
+}
+
+float
+baseline(const wave_record& r, std::size_t k)
+{
+    const wave_record::wavelet_t& w = r.wavelets[k];
+    if (w.channel < r.channel_statistic.size()) {
+        float m = r.channel_statistic[w.channel].mean;
+        if (std::isfinite(m))
+            return m;
+    }
+    std::size_t n = std::min<std::size_t>(w.count, baseline_samples);
+    if (n == 0)
+        return 0;
+    const uint16_t* s = r.wavelet_samples(k);
+    double sum = 0;
+    for (std::size_t j=0; j<n; ++j)
+        sum += s[j];
+    return static_cast<float>(sum/n);
+}
+
+std::size_t
+highest(const uint16_t* s, std::size_t first, std::size_t last)
+{
+    return std::max_element(s + first, s + last + 1) - s;
+}
+
+} // anonymous namespace
+
+//-----------------------------------------------------------------------------
+echo_shape::echo_shape()
+    : amplitude(nan)
+    , pulse_width(nan)
+    , rise_time(nan)
+    , energy(nan)
+    , position(nan)
+    , channel(0)
+    , wavelet(0)
+{
+}
+
+//-----------------------------------------------------------------------------
+echo_shape_estimator::echo_shape_estimator()
+    : v_group(299792458.0/1.00027)
+    , search_radius(3)
+    , reference(std::numeric_limits<std::size_t>::max())
+{
+}
+
+void
+echo_shape_estimator::configure(const wave& w)
+{
+    sampling_time.clear();
+    delay.clear();
+    for (std::size_t k=0; k<w.channel_properties.size(); ++k) {
+        sampling_time.push_back(w.channel_properties[k].sampling_time);
+        delay.push_back(w.channel_properties[k].delay);
+    }
+    reference = w.reference_channel_index;
+}
+
+double
+echo_shape_estimator::emission_time(const wave_record& r) const
+{
+    for (std::size_t k=0; k<r.wavelets.size(); ++k) {
+        const wave_record::wavelet_t& w = r.wavelets[k];
+        if (w.channel != reference || w.channel >= sampling_time.size() || w.count == 0)
+            continue;
+        const uint16_t* s = r.wavelet_samples(k);
+        std::size_t p = highest(s, 0, w.count - 1);
+        double pos = double(p);
+        if (p > 0 && p+1 < w.count)
+            pos += parabola_offset(s[p-1], s[p], s[p+1]);
+        return w.time + pos*sampling_time[w.channel] - delay[w.channel];
+    }
+    return r.time_sorg;
+}
+
+bool
+echo_shape_estimator::measure(
+    const wave_record& r
+    , double t_ref
+    , const target& t
+    , echo_shape& e
+) const
+{
+    e = echo_shape();
+    const uint32_t channel = t.is_high_power ? 0 : 1;
+    if (channel >= sampling_time.size() || !(sampling_time[channel] > 0))
+        return false;
+    const double st = sampling_time[channel];
+    const double t_echo = t_ref + 2*t.echo_range/v_group;
+    const double radius = search_radius;
+
+    for (std::size_t k=0; k<r.wavelets.size(); ++k) {
+        const wave_record::wavelet_t& w = r.wavelets[k];
+        if (w.channel != channel || w.count == 0)
+            continue;
+        double pos = (t_echo + delay[channel] - w.time)/st;
+        if (pos < -radius || pos > double(w.count - 1) + radius)
+            continue;
+
+        const uint16_t* s = r.wavelet_samples(k);
+        long c = std::lround(pos);
+        std::size_t first = static_cast<std::size_t>(std::max(0L, c - long(search_radius)));
+        std::size_t last = static_cast<std::size_t>(std::min(long(w.count) - 1, c + long(search_radius)));
+        std::size_t peak = highest(s, first, last);
+
+        pulse p(s, w.count, baseline(r, k));
+        const float a = p[peak];
+        if (!(a > 0))
+            return false;
+
+        const double ns = st*1e9;
+        e.amplitude = a;
+        e.position = static_cast<float>(peak);
+        if (peak > 0 && peak+1 < w.count)
+            e.position += static_cast<float>(parabola_offset(p[peak-1], p[peak], p[peak+1]));
+        e.pulse_width = static_cast<float>((p.right(peak, 0.5f*a) - p.left(peak, 0.5f*a))*ns);
+        e.rise_time = static_cast<float>((p.left(peak, 0.9f*a) - p.left(peak, 0.1f*a))*ns);
+
+        double l10 = p.left(peak, 0.1f*a);
+        double r10 = p.right(peak, 0.1f*a);
+        if (l10 == l10 && r10 == r10) {
+            double sum = 0;
+            for (std::size_t j=static_cast<std::size_t>(std::ceil(l10)); j<=r10; ++j)
+                sum += p[j];
+            e.energy = static_cast<float>(sum*ns);
+        }
+        e.channel = channel;
+        e.wavelet = static_cast<uint32_t>(k);
+        return true;
+    }
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+shape_pointcloud::shape_pointcloud(bool sync_to_pps, bool shapes_)
+    : pooled_wave(sync_to_pps)
+    , shapes(shapes_)
+    , match_tolerance(50e-9)
+    , max_pending(64)
+    , shots_matched(0)
+    , shots_unmatched(0)
+    , waves_dropped(0)
+{
+}
+
+void
+shape_pointcloud::on_shot_end()
+{
+    pooled_wave::on_shot_end();
+
+    shot_t s;
+    if (!spare.empty()) {
+        s.targets.swap(spare.back());
+        spare.pop_back();
+    }
+    s.time_sorg = time_sorg;
+    s.targets.assign(targets.begin(), targets.begin() + target_count);
+
+    if (!shapes) {
+        deliver(s, 0);
+        spare.push_back(std::vector<target>());
+        spare.back().swap(s.targets);
+        return;
+    }
+    shots_pending.push_back(shot_t());
+    shots_pending.back().time_sorg = s.time_sorg;
+    shots_pending.back().targets.swap(s.targets);
+    match();
+}
+
+void
+shape_pointcloud::on_record(wave_record&)
+{
+    if (!shapes) {
+        ++waves_dropped;
+        return;
+    }
+    if (!estimator.configured())
+        estimator.configure(*this);
+    waves_pending.push_back(retain());
+    match();
+}
+
+void
+shape_pointcloud::deliver(shot_t& s, const wave_record* w)
+{
+    result.assign(s.targets.size(), echo_shape());
+    if (w) {
+        double t_ref = estimator.emission_time(*w);
+        for (std::size_t k=0; k<s.targets.size(); ++k)
+            estimator.measure(*w, t_ref, s.targets[k], result[k]);
+        ++shots_matched;
+    }
+    else
+        ++shots_unmatched;
+    on_shot_shapes(s.targets, result);
+}
+
+void
+shape_pointcloud::match()
+{
+    while (!shots_pending.empty() && !waves_pending.empty()) {
+        shot_t& s = shots_pending.front();
+        wave_record* w = waves_pending.front();
+        if (std::fabs(s.time_sorg - w->time_sorg) <= match_tolerance) {
+            deliver(s, w);
+            waves_pending.pop_front();
+            pool().release(w);
+        }
+        else if (s.time_sorg < w->time_sorg) {
+            deliver(s, 0);
+        }
+        else {
+            waves_pending.pop_front();
+            pool().release(w);
+            ++waves_dropped;
+            continue;
+        }
+        spare.push_back(std::vector<target>());
+        spare.back().swap(s.targets);
+        shots_pending.pop_front();
+    }
+
+    while (shots_pending.size() > max_pending) {
+        deliver(shots_pending.front(), 0);
+        spare.push_back(std::vector<target>());
+        spare.back().swap(shots_pending.front().targets);
+        shots_pending.pop_front();
+    }
+    while (waves_pending.size() > max_pending) {
+        pool().release(waves_pending.front());
+        waves_pending.pop_front();
+        ++waves_dropped;
+    }
+}
+
+void
+shape_pointcloud::flush()
+{
+    match();
+    while (!shots_pending.empty()) {
+        deliver(shots_pending.front(), 0);
+        shots_pending.pop_front();
+    }
+    while (!waves_pending.empty()) {
+        pool().release(waves_pending.front());
+        waves_pending.pop_front();
+        ++waves_dropped;
+    }
+}
+
+} // namespace vpp
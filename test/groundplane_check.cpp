@@ -0,0 +1,148 @@
+// $Id$
+
+//! \file groundplane_check.cpp
+//! Compares plane_fit::huber with statsmodels' RLM on a fixed point set.
+//!
+//! usage: groundplane_check groundplane_fixture.txt groundplane_summary.txt
+//!
+//! The fixture holds the points and the params, standard errors (H1
+//! covariance), scale, number of iterations and final deviance statsmodels
+//! got for them, the summary its summary() text, see groundplane_fixture.py.
+//! Fails unless the fit agrees to rounding and the plane report equals the
+//! summary except for date and time.
+
+#include <vpp/groundplane.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct fixture {
+    double params[3];
+    double bse[3];
+    double scale;
+    double deviance;
+    unsigned iterations;
+    std::vector<double> x, y, z;
+};
+
+void
+expect(std::istream& in, const std::string& key)
+{
+    std::string s;
+    if (!(in >> s) || s != key)
+        throw(std::runtime_error("groundplane_check: expected " + key + " in fixture"));
+}
+
+fixture
+load(const std::string& path)
+{
+    std::ifstream in(path.c_str());
+    if (!in)
+        throw(std::runtime_error("groundplane_check: cannot open " + path));
+    fixture f;
+    std::size_t n = 0;
+    expect(in, "params");
+    in >> f.params[0] >> f.params[1] >> f.params[2];
+    expect(in, "bse");
+    in >> f.bse[0] >> f.bse[1] >> f.bse[2];
+    expect(in, "scale");
+    in >> f.scale;
+    expect(in, "iterations");
+    in >> f.iterations;
+    expect(in, "deviance");
+    in >> f.deviance;
+    expect(in, "points");
+    in >> n;
+    f.x.resize(n);
+    f.y.resize(n);
+    f.z.resize(n);
+    for (std::size_t k=0; k<n; ++k)
+        in >> f.x[k] >> f.y[k] >> f.z[k];
+    if (!in)
+        throw(std::runtime_error("groundplane_check: truncated fixture " + path));
+    return f;
+}
+
+// the lines of a summary without the date and time, which differ by design
+std::vector<std::string>
+lines(std::istream& in)
+{
+    std::vector<std::string> v;
+    std::string s;
+    while (std::getline(in, s))
+        if (s.compare(0, 5, "Date:") != 0 && s.compare(0, 5, "Time:") != 0)
+            v.push_back(s);
+    return v;
+}
+
+bool
+close(const char* what, double got, double expected, double tolerance)
+{
+    const double d = std::fabs(got - expected);
+    if (d <= tolerance*std::fabs(expected))
+        return true;
+    std::cerr.precision(17);
+    std::cerr << what << ": " << got << ", statsmodels " << expected << "\n";
+    return false;
+}
+
+} // anonymous namespace
+
+int
+main(int argc, char* argv[])
+{
+    if (argc < 3) {
+        std::cerr << "usage: groundplane_check groundplane_fixture.txt groundplane_summary.txt\n";
+        return 2;
+    }
+    try {
+        const fixture e = load(argv[1]);
+        const vpp::plane_fit f = vpp::plane_fit::huber(
+            e.x.data(), e.y.data(), e.z.data(), e.x.size());
+
+        bool ok = true;
+        const char* params[3] = { "const", "x1", "x2" };
+        const char* bse[3] = { "std err const", "std err x1", "std err x2" };
+        for (unsigned i=0; i<3; ++i) {
+            ok = close(params[i], f.params[i], e.params[i], 1e-9) && ok;
+            ok = close(bse[i], f.bse[i], e.bse[i], 1e-6) && ok;
+        }
+        ok = close("scale", f.scale, e.scale, 1e-9) && ok;
+        ok = close("deviance", f.deviance, e.deviance, 1e-6) && ok;
+        if (f.iterations != e.iterations) {
+            std::cerr << "iterations: " << f.iterations
+                << ", statsmodels " << e.iterations << "\n";
+            ok = false;
+        }
+
+        std::ifstream in(argv[2]);
+        if (!in)
+            throw(std::runtime_error("groundplane_check: cannot open " + std::string(argv[2])));
+        std::stringstream report;
+        f.report(report);
+        const std::vector<std::string> got = lines(report), expected = lines(in);
+        for (std::size_t k=0; k<std::max(got.size(), expected.size()); ++k) {
+            const std::string a = k < got.size() ? got[k] : "";
+            const std::string b = k < expected.size() ? expected[k] : "";
+            if (a != b) {
+                std::cerr << "report: " << a << "\nstatsmodels: " << b << "\n";
+                ok = false;
+            }
+        }
+        std::cout << (ok ? "ok" : "FAILED") << "\n";
+        return ok ? 0 : 1;
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
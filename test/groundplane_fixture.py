@@ -0,0 +1,45 @@
+# $Id$
+#
+# Writes the fixture of groundplane_check: the lowest points of a 20 x 20
+# grid of 1 m cells over a tilted plane, a sixth of them on low vegetation,
+# and what statsmodels makes of them.
+#
+# usage: python3 groundplane_fixture.py [directory]
+#
+# groundplane_fixture.txt holds the expected params, bse, scale, number of
+# iterations and final deviance, then one "x y z" line per point;
+# groundplane_summary.txt the summary of the fit. Generated with
+# statsmodels 0.15.0 and numpy 2.4.
+
+import os
+import sys
+
+import numpy as np
+import statsmodels.api as sm
+
+directory = sys.argv[1] if len(sys.argv) > 1 else os.path.dirname(os.path.abspath(__file__))
+
+rng = np.random.default_rng(20260520)
+c = np.arange(-9.5, 10, 1.0)
+x, y = (a.ravel() for a in np.meshgrid(c, c))
+z = 101.3 + 0.02*x - 0.035*y + rng.normal(0, 0.02, x.size)
+vegetation = rng.random(x.size) < 1/6
+z[vegetation] += rng.uniform(0.3, 2.0, vegetation.sum())
+
+# fit what the check reads back
+text = ["%.1f %.1f %.6f" % p for p in zip(x, y, z)]
+x, y, z = np.array([[float(v) for v in t.split()] for t in text]).T
+
+fit = sm.RLM(z, sm.add_constant(np.column_stack([x, y])), M=sm.robust.norms.HuberT()).fit()
+
+with open(os.path.join(directory, "groundplane_fixture.txt"), "w") as out:
+    out.write("params %.17g %.17g %.17g\n" % tuple(fit.params))
+    out.write("bse %.17g %.17g %.17g\n" % tuple(fit.bse))
+    out.write("scale %.17g\n" % fit.scale)
+    out.write("iterations %d\n" % fit.fit_history["iteration"])
+    out.write("deviance %.17g\n" % fit.fit_history["deviance"][-1])
+    out.write("points %d\n" % len(text))
+    out.write("\n".join(text) + "\n")
+
+with open(os.path.join(directory, "groundplane_summary.txt"), "w") as out:
+    out.write(str(fit.summary()) + "\n")
@@ -0,0 +1,94 @@
+// $Id$
+
+//! \file waveconvert_check.cpp
+//! Compares a segmented wave_converter run with a single segment run.
+//!
+//! usage: waveconvert_check input.rxp work_prefix [threads]
+//!
+//! Converts the input once with one thread and once split into segments
+//! of at most a quarter of the file, and fails unless both files hold the
+//! same number of shots and neither holds a time_sorg twice.
+
+#include <vpp/waveconvert.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct shots {
+    uint64_t count;
+    uint64_t duplicates;
+};
+
+shots
+convert(const std::string& rxp, const std::string& vwf, unsigned threads, uint64_t segment_bytes)
+{
+    vpp::wave_converter c;
+    c.threads = threads;
+    c.min_segment_bytes = segment_bytes;
+    c.warmup_bytes = segment_bytes;
+    vpp::wave_converter::statistics st = c.run(rxp, vwf);
+    std::cout << vwf << ": " << st.segments << " segments, "
+        << st.records << " shots\n";
+
+    vpp::wave_file_reader in(vwf);
+    vpp::wave_record r;
+    std::vector<double> t;
+    while (in.read(r))
+        t.push_back(r.time_sorg);
+    std::sort(t.begin(), t.end());
+    shots s;
+    s.count = t.size();
+    s.duplicates = t.size() - (std::unique(t.begin(), t.end()) - t.begin());
+    return s;
+}
+
+} // anonymous namespace
+
+int
+main(int argc, char* argv[])
+{
+    if (argc < 3) {
+        std::cerr << "usage: waveconvert_check input.rxp work_prefix [threads]\n";
+        return 2;
+    }
+    const std::string rxp = argv[1];
+    const std::string prefix = argv[2];
+    const unsigned threads = argc > 3 ? std::atoi(argv[3]) : 4;
+    try {
+        std::ifstream in(rxp.c_str(), std::ios::binary | std::ios::ate);
+        const uint64_t size = static_cast<uint64_t>(in.tellg());
+        const uint64_t segment = std::max<uint64_t>(1, size/std::max(threads, 1u));
+
+        const shots one = convert(rxp, prefix + ".single.vwf", 1, size + 1);
+        const shots many = convert(rxp, prefix + ".segmented.vwf", threads, segment);
+
+        bool ok = true;
+        if (one.count != many.count) {
+            std::cerr << "shot count differs: " << one.count
+                << " single, " << many.count << " segmented\n";
+            ok = false;
+        }
+        if (one.duplicates || many.duplicates) {
+            std::cerr << "duplicate time_sorg: " << one.duplicates
+                << " single, " << many.duplicates << " segmented\n";
+            ok = false;
+        }
+        if (one.count == 0) {
+            std::cerr << "no shots in " << rxp << "\n";
+            ok = false;
+        }
+        std::cout << (ok ? "ok" : "FAILED") << "\n";
+        return ok ? 0 : 1;
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}